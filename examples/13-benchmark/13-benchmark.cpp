@@ -0,0 +1,467 @@
+#include "SC16IS7xxRK.h"
+
+// Benchmark for the driver. Each boot runs one combination of settings for TEST_DURATION_MS,
+// prints one result line, then resets to run the next combination, so the whole matrix runs
+// without reflashing. After the last combination, the benchmark stops. Press RESET to run it again.
+//
+// The matrix is scenarios[] x busSpeeds[] x polled and IRQ (IRQ only if USE_IRQ_PIN is defined)
+// x unbuffered and buffered x baudRates[]. The chip and SPI or I2C depend on the wiring, so they
+// are selected by the defines below.
+//
+// Scenarios:
+// - read (SC16IS7x0): Serial1 sends continuous data to the SC16IS7x0 (06-continuous-read, 07-buffered-read)
+// - write (SC16IS7x0): the SC16IS7x0 sends continuous data to Serial1, unbuffered or withBufferedWrite()
+// - modbus (SC16IS7x0): the SC16IS7x0 in withRS485() mode sends a Modbus RTU request using
+//   writeModbusFrame() and Serial1 responds with a 69-byte frame, longer than the FIFO. Always uses
+//   buffered read, so the unbuffered runs are skipped.
+// - dual-loop (SC16IS7x2): port A sends continuous data to port B (08-dual-loop)
+//
+// Results are printed to USB serial one per line, starting with "BENCH " followed by JSON:
+// - bytesPerSec: bytes received (read, dual-loop), received by Serial1 (write), or sent and received
+//   (modbus) per second. The line rate is baudRate / 10.
+// - busOpsPerByte: bus transactions per byte (rxBusOps or txBusOps from getStats())
+// - busTimeUsPerByte: microseconds of SPI or I2C transactions per byte, from getBusUtilization().
+//   This is time the bus was busy, not CPU time. With SPI DMA the thread is blocked during the
+//   transfer and other threads can run.
+// - latP50Us, latP99Us: read and dual-loop: IRQ to read buffer drained (withIRQ() and buffered read)
+//   or the interval between services of the port; write: time for each 64-byte write() call;
+//   modbus: request to response round trip
+// - sequenceGaps, lsrOverrun, rxBufferFull: reported separately, not added together. A single
+//   overrun usually causes both an lsrOverrun and a sequence gap.
+// - modbus only: framesPerSec, framesLost (no response), modbusFrames, modbusCrcErrors,
+//   modbusFrameErrors from getStats(), and turnaroundUs from getTurnaroundUs()
+//
+// The same scenarios can be run against the simulated chip on a computer, see test/host/bench.
+
+SerialLogHandler logHandler;
+
+SYSTEM_THREAD(ENABLED);
+
+// The cloud connection is not used to keep it from affecting the results
+SYSTEM_MODE(SEMI_AUTOMATIC);
+
+STARTUP(System.enableFeature(FEATURE_RETAINED_MEMORY));
+
+// Uncomment this to test a SC16IS7x0 (single port). Otherwise an SC16IS7x2 (dual port) is used.
+// - SC16IS7x0: connect Particle TX (Serial1) to SC16IS7x0 RX, and SC16IS7x0 TX to Particle RX
+// - SC16IS7x2: connect port A TX to port B RX
+// #define USE_SC16IS7X0
+
+// Uncomment this to use SPI and set to the CS pin
+// #define USE_SPI_CS D4
+
+// Uncomment this to also run each combination in interrupt mode and set to the IRQ pin
+// #define USE_IRQ_PIN D3
+
+// Must match your hardware. Baud rates faster than OSCILLATOR_FREQ_HZ / 16 are skipped.
+#define OSCILLATOR_FREQ_HZ 1843200
+
+#ifdef USE_SC16IS7X0
+static const char * const scenarios[] = { "read", "write", "modbus" };
+#else
+static const char * const scenarios[] = { "dual-loop" };
+#endif
+static const size_t numScenarios = sizeof(scenarios) / sizeof(scenarios[0]);
+
+#ifdef USE_SPI_CS
+// SPI speed in MHz
+static const uint32_t busSpeeds[] = { 4, 15 };
+#else
+// I2C speed in Hz
+static const uint32_t busSpeeds[] = { CLOCK_SPEED_100KHZ, CLOCK_SPEED_400KHZ, CLOCK_SPEED_1MHZ };
+#endif
+static const size_t numBusSpeeds = sizeof(busSpeeds) / sizeof(busSpeeds[0]);
+
+#ifdef USE_IRQ_PIN
+static const size_t numIrqModes = 2;
+#else
+static const size_t numIrqModes = 1;
+#endif
+
+static const int baudRates[] = { 9600, 19200, 38400, 57600, 115200, 230400, 460800, 921600 };
+static const size_t numBaudRates = sizeof(baudRates) / sizeof(baudRates[0]);
+
+static const size_t numRuns = numScenarios * numBusSpeeds * numIrqModes * 2 * numBaudRates;
+
+static const unsigned long TEST_DURATION_MS = 10000;
+static const uint32_t RUN_MAGIC = 0x3e6f91a3;
+
+// Modbus read holding registers request, and the response with 32 registers
+static const size_t MODBUS_REQUEST_SIZE = 6;
+static const size_t MODBUS_RESPONSE_REGISTERS = 32;
+static const size_t MODBUS_RESPONSE_SIZE = 3 + 2 * MODBUS_RESPONSE_REGISTERS;
+
+retained uint32_t runMagic;
+retained size_t runIndex;
+
+#ifdef USE_SC16IS7X0
+SC16IS7x0 extSerial;
+SC16IS7xxPort &rxPort = extSerial;
+SC16IS7xxPort &txPort = extSerial;
+#else
+SC16IS7x2 extSerial;
+SC16IS7xxPort &rxPort = extSerial.b();
+SC16IS7xxPort &txPort = extSerial.a();
+#endif
+
+const char *scenario;
+uint32_t busSpeed;
+bool useIrq;
+bool useBuffered;
+int baudRate;
+
+Thread *sendingThread;
+size_t writeIndex = 0;
+size_t readIndex = 0;
+uint32_t sequenceGaps = 0;
+uint32_t receivedBytes = 0;
+unsigned long runStart = 0;
+unsigned long readStart = 0;
+bool done = false;
+
+// write: time for each write() call, modbus: round trip time
+SC16IS7xxHistogram callTime;
+
+// modbus
+volatile uint32_t modbusResponses = 0;
+uint32_t modbusTransactions = 0;
+uint32_t modbusFramesLost = 0;
+
+void sendingThreadFunction(void *param);
+void modbusServerThreadFunction(void *param);
+void runModbusTransaction();
+void printResults(unsigned long elapsedMs);
+void nextRun();
+
+void setup()
+{
+    waitFor(Serial.isConnected, 10000);
+
+    if (runMagic != RUN_MAGIC) {
+        runMagic = RUN_MAGIC;
+        runIndex = 0;
+    }
+    if (runIndex >= numRuns) {
+        runIndex = 0;
+    }
+
+    // The baud rate changes fastest, then buffered, IRQ, bus speed, and scenario
+    size_t index = runIndex;
+    baudRate = baudRates[index % numBaudRates];
+    index /= numBaudRates;
+    useBuffered = (index % 2) != 0;
+    index /= 2;
+    useIrq = (index % numIrqModes) != 0;
+    index /= numIrqModes;
+    busSpeed = busSpeeds[index % numBusSpeeds];
+    index /= numBusSpeeds;
+    scenario = scenarios[index];
+
+    bool isModbus = (strcmp(scenario, "modbus") == 0);
+    bool isWrite = (strcmp(scenario, "write") == 0);
+
+    if (baudRate * 16 > OSCILLATOR_FREQ_HZ) {
+        Log.info("skipping baud=%d, too fast for oscillator", baudRate);
+        nextRun();
+        return;
+    }
+    if (isModbus && !useBuffered) {
+        // Modbus RTU framing requires buffered read
+        nextRun();
+        return;
+    }
+
+#ifdef USE_SPI_CS
+    extSerial.withSPI(&SPI, USE_SPI_CS, busSpeed); // SPI port, CS line, speed in MHz
+#else
+    extSerial.withI2C(&Wire, 0);
+    Wire.setSpeed(busSpeed);
+#endif
+    extSerial.withOscillatorFrequency(OSCILLATOR_FREQ_HZ);
+
+    extSerial.softwareReset();
+    extSerial.powerOnCheck();
+
+#ifdef USE_IRQ_PIN
+    if (useIrq) {
+        // Be sure to enable interrupt mode using withIRQ() before enabling buffered read
+        extSerial.withIRQ(USE_IRQ_PIN);
+    }
+#endif
+    if (isModbus) {
+        rxPort.withBufferedRead(1024);
+        rxPort.withRS485();
+        rxPort.withModbusRTU([](const uint8_t *frame, size_t length) {
+            modbusResponses = modbusResponses + 1;
+        });
+    }
+    else
+    if (isWrite) {
+        if (useBuffered) {
+            txPort.withBufferedWrite(4096);
+        }
+    }
+    else
+    if (useBuffered) {
+        rxPort.withBufferedRead(20000);
+    }
+    extSerial.withHistograms();
+
+#ifdef USE_SC16IS7X0
+    Serial1.begin(baudRate);
+    extSerial.begin(baudRate);
+#else
+    txPort.begin(baudRate);
+    rxPort.begin(baudRate);
+#endif
+
+    Log.info("starting 13-benchmark run %u of %u scenario=%s busSpeed=%lu irq=%d buffered=%d baud=%d",
+        runIndex + 1, numRuns, scenario, busSpeed, useIrq, useBuffered, baudRate);
+
+    runStart = millis();
+
+    if (isModbus) {
+        sendingThread = new Thread("server", modbusServerThreadFunction, (void *)nullptr, OS_THREAD_PRIORITY_DEFAULT, 2048);
+    }
+    else {
+        sendingThread = new Thread("sending", sendingThreadFunction, (void *)nullptr, OS_THREAD_PRIORITY_DEFAULT, 2048);
+    }
+}
+
+void loop()
+{
+    if (done) {
+        return;
+    }
+
+    if (strcmp(scenario, "modbus") == 0) {
+        runModbusTransaction();
+    }
+    else {
+        uint8_t readBuf[64];
+        int count;
+
+        if (strcmp(scenario, "write") == 0) {
+            // The SC16IS7x0 is sending, so check the data received by Serial1
+            count = 0;
+            while(count < (int)sizeof(readBuf) && Serial1.available()) {
+                readBuf[count++] = (uint8_t)Serial1.read();
+            }
+        }
+        else {
+            count = rxPort.read(readBuf, sizeof(readBuf));
+        }
+
+        if (count > 0) {
+            if (readStart == 0) {
+                // Start measuring from the first byte so startup time is not included
+                readStart = millis();
+                extSerial.getBusUtilization(true);
+                rxPort.getStats(true);
+                rxPort.getHistograms(true);
+                callTime = SC16IS7xxHistogram();
+                readIndex = readBuf[0];
+            }
+            receivedBytes += count;
+            for(int ii = 0; ii < count; ii++, readIndex++) {
+                if (readBuf[ii] != (readIndex & 0xff)) {
+                    // Resynchronize to the received data so one drop is only counted once
+                    sequenceGaps++;
+                    readIndex = readBuf[ii];
+                }
+            }
+        }
+    }
+
+    if (readStart != 0 && millis() - readStart >= TEST_DURATION_MS) {
+        printResults(millis() - readStart);
+        done = true;
+        nextRun();
+    }
+    else
+    if (readStart == 0 && millis() - runStart >= 2 * TEST_DURATION_MS) {
+        // Nothing was received, print the results anyway so the rest of the matrix runs
+        printResults(millis() - runStart);
+        done = true;
+        nextRun();
+    }
+}
+
+void runModbusTransaction()
+{
+    static const uint8_t request[MODBUS_REQUEST_SIZE] = { 0x11, 0x03, 0x00, 0x6b, 0x00, (uint8_t)MODBUS_RESPONSE_REGISTERS };
+
+    // Request and response time on the line, and a timeout with plenty of margin
+    uint32_t lineUs = (MODBUS_REQUEST_SIZE + 2 + MODBUS_RESPONSE_SIZE + 2) * 10 * 1000000 / baudRate;
+    uint32_t timeoutUs = 4 * lineUs + 50000;
+
+    uint32_t expected = modbusResponses + 1;
+    uint32_t requestUs = micros();
+    rxPort.writeModbusFrame(request, sizeof(request));
+    while(modbusResponses < expected && micros() - requestUs < timeoutUs) {
+        delay(1);
+    }
+    if (modbusResponses < expected) {
+        modbusFramesLost++;
+        return;
+    }
+    if (readStart == 0) {
+        // The first transaction is not measured
+        readStart = millis();
+        extSerial.getBusUtilization(true);
+        rxPort.getStats(true);
+        callTime = SC16IS7xxHistogram();
+        return;
+    }
+    callTime.add(micros() - requestUs);
+    modbusTransactions++;
+}
+
+void printResults(unsigned long elapsedMs)
+{
+    bool isModbus = (strcmp(scenario, "modbus") == 0);
+    bool isWrite = (strcmp(scenario, "write") == 0);
+
+    SC16IS7xxPortStats stats = rxPort.getStats();
+    SC16IS7xxPortHistograms hist = rxPort.getHistograms();
+    float busUtilization = extSerial.getBusUtilization();
+
+    double bytes;
+    uint32_t busOps;
+    const SC16IS7xxHistogram *latency;
+    if (isModbus) {
+        bytes = (double)modbusTransactions * (MODBUS_REQUEST_SIZE + 2 + MODBUS_RESPONSE_SIZE + 2);
+        busOps = stats.rxBusOps + stats.txBusOps;
+        latency = &callTime;
+    }
+    else
+    if (isWrite) {
+        bytes = (double)receivedBytes;
+        busOps = stats.txBusOps;
+        latency = &callTime;
+    }
+    else {
+        bytes = (double)stats.rxBytes;
+        busOps = stats.rxBusOps;
+        latency = (useIrq && useBuffered) ? &hist.irqToDrainUs : &hist.serviceIntervalUs;
+    }
+    double perByte = (bytes != 0) ? bytes : 1;
+    double busUs = (double)busUtilization / 100.0 * (double)elapsedMs * 1000.0;
+
+    char modbusFields[200];
+    modbusFields[0] = 0;
+    if (isModbus) {
+        snprintf(modbusFields, sizeof(modbusFields), ",\"framesPerSec\":%.1lf,\"framesLost\":%lu,\"modbusFrames\":%lu,"
+            "\"modbusCrcErrors\":%lu,\"modbusFrameErrors\":%lu,\"turnaroundUs\":%lu",
+            (double)modbusTransactions * 1000.0 / (double)elapsedMs, modbusFramesLost, stats.modbusFrames,
+            stats.modbusCrcErrors, stats.modbusFrameErrors, rxPort.getTurnaroundUs());
+    }
+
+    Serial.printlnf("BENCH {\"scenario\":\"%s\",\"chip\":\"%s\",\"bus\":\"%s\",\"busSpeed\":%lu,\"irq\":%s,\"buffered\":%s,"
+        "\"baud\":%d,\"lineRate\":%d,\"bytesPerSec\":%.0lf,\"busOpsPerByte\":%.3lf,\"busTimeUsPerByte\":%.1lf,"
+        "\"busUtilization\":%.1f,\"latP50Us\":%lu,\"latP99Us\":%lu,\"sequenceGaps\":%lu,\"lsrOverrun\":%lu,\"rxBufferFull\":%lu%s}",
+        scenario,
+#ifdef USE_SC16IS7X0
+        "SC16IS7x0",
+#else
+        "SC16IS7x2",
+#endif
+#ifdef USE_SPI_CS
+        "spi", busSpeed * 1000000,
+#else
+        "i2c", busSpeed,
+#endif
+        useIrq ? "true" : "false",
+        useBuffered ? "true" : "false",
+        baudRate, baudRate / 10,
+        bytes * 1000.0 / (double)elapsedMs,
+        (double)busOps / perByte,
+        busUs / perByte,
+        busUtilization,
+        latency->percentile(50), latency->percentile(99),
+        sequenceGaps, stats.lsrOverrun, stats.rxBufferFull,
+        modbusFields);
+}
+
+void nextRun()
+{
+    if (++runIndex < numRuns) {
+        // Give USB serial time to send the results
+        delay(1000);
+        System.reset();
+    }
+    else {
+        runIndex = 0;
+        Serial.println("BENCH done");
+        done = true;
+    }
+}
+
+void sendingThreadFunction(void *param)
+{
+    while(true) {
+#ifdef USE_SC16IS7X0
+        if (strcmp(scenario, "write") == 0) {
+            // Write as fast as the driver accepts the data, 64 bytes at a time
+            uint8_t writeBuf[64];
+            for(size_t ii = 0; ii < sizeof(writeBuf); ii++) {
+                writeBuf[ii] = (uint8_t)(writeIndex++ & 0xff);
+            }
+            uint32_t startUs = micros();
+            txPort.write(writeBuf, sizeof(writeBuf));
+            callTime.add(micros() - startUs);
+            continue;
+        }
+        while(Serial1.availableForWrite() > 10) {
+            Serial1.write(writeIndex++ & 0xff);
+        }
+#else
+        uint8_t writeBuf[64];
+        int avail = txPort.availableForWrite();
+        if (avail > (int)sizeof(writeBuf)) {
+            avail = (int)sizeof(writeBuf);
+        }
+        for(int ii = 0; ii < avail; ii++) {
+            writeBuf[ii] = (uint8_t)(writeIndex++ & 0xff);
+        }
+        if (avail > 0) {
+            txPort.write(writeBuf, avail);
+        }
+#endif
+        delay(1);
+    }
+}
+
+void modbusServerThreadFunction(void *param)
+{
+    // Serial1 is the Modbus server. It responds to each request with a valid CRC after the
+    // 3.5 character silence that ends the request.
+    uint8_t response[MODBUS_RESPONSE_SIZE + 2];
+    response[0] = 0x11;
+    response[1] = 0x03;
+    response[2] = (uint8_t)(2 * MODBUS_RESPONSE_REGISTERS);
+    for(size_t ii = 3; ii < MODBUS_RESPONSE_SIZE; ii++) {
+        response[ii] = (uint8_t)ii;
+    }
+    uint16_t crc = SC16IS7xxPort::modbusCRC16(response, MODBUS_RESPONSE_SIZE);
+    response[MODBUS_RESPONSE_SIZE] = (uint8_t)crc;
+    response[MODBUS_RESPONSE_SIZE + 1] = (uint8_t)(crc >> 8);
+
+    uint32_t gapUs = 35 * 1000000 / baudRate;
+    uint8_t request[MODBUS_REQUEST_SIZE + 2];
+    size_t requestSize = 0;
+
+    while(true) {
+        while(Serial1.available() && requestSize < sizeof(request)) {
+            request[requestSize++] = (uint8_t)Serial1.read();
+        }
+        if (requestSize == sizeof(request)) {
+            if (SC16IS7xxPort::modbusCRC16(request, requestSize) == 0) {
+                delayMicroseconds(gapUs);
+                Serial1.write(response, sizeof(response));
+            }
+            requestSize = 0;
+        }
+        delay(1);
+    }
+}
@@ -1,8 +1,117 @@
 #include "SC16IS7xxRK.h"
 
-static Logger _uartLogger = Logger("app.uart");
+Logger _uartLogger = Logger("app.uart");
 
 
+#if SC16IS7XX_TRACE_LEVEL == SC16IS7XX_TRACE_EVENTS
+SC16IS7xxEvent SC16IS7xxEventRing::events[SC16IS7XX_EVENT_RING_SIZE];
+std::atomic<uint32_t> SC16IS7xxEventRing::nextEvent(0);
+#endif
+
+// [static]
+void SC16IS7xxEventRing::add(uint8_t type, uint8_t channel, uint8_t reg, uint8_t value) {
+#if SC16IS7XX_TRACE_LEVEL == SC16IS7XX_TRACE_EVENTS
+    // Each caller gets its own slot, so multiple threads can add events without a lock
+    uint32_t index = nextEvent.fetch_add(1, std::memory_order_relaxed) % SC16IS7XX_EVENT_RING_SIZE;
+
+    SC16IS7xxEvent &event = events[index];
+    event.timeUs = micros();
+    event.type = type;
+    event.channel = channel;
+    event.reg = reg;
+    event.value = value;
+#endif
+}
+
+// [static]
+size_t SC16IS7xxEventRing::copy(SC16IS7xxEvent *eventsOut, size_t maxEvents) {
+    size_t count = 0;
+
+#if SC16IS7XX_TRACE_LEVEL == SC16IS7XX_TRACE_EVENTS
+    uint32_t end = nextEvent.load(std::memory_order_relaxed);
+    count = (end < SC16IS7XX_EVENT_RING_SIZE) ? end : SC16IS7XX_EVENT_RING_SIZE;
+    if (count > maxEvents) {
+        count = maxEvents;
+    }
+    for(size_t ii = 0; ii < count; ii++) {
+        eventsOut[ii] = events[(end - count + ii) % SC16IS7XX_EVENT_RING_SIZE];
+    }
+#endif
+
+    return count;
+}
+
+// [static]
+void SC16IS7xxEventRing::log(size_t maxEvents) {
+#if SC16IS7XX_TRACE_LEVEL == SC16IS7XX_TRACE_EVENTS
+    static const char * const typeNames[] = { "", "readRegister", "writeRegister", "readFifo", "writeFifo", "iir", "error" };
+
+    SC16IS7xxEvent event;
+    uint32_t end = nextEvent.load(std::memory_order_relaxed);
+    size_t count = (end < SC16IS7XX_EVENT_RING_SIZE) ? end : SC16IS7XX_EVENT_RING_SIZE;
+    if (count > maxEvents) {
+        count = maxEvents;
+    }
+    for(size_t ii = 0; ii < count; ii++) {
+        // Copy one at a time so a large array isn't needed on the stack
+        event = events[(end - count + ii) % SC16IS7XX_EVENT_RING_SIZE];
+        _uartLogger.info("%lu %s chan=%d reg=%d value=%d", event.timeUs, 
+            (event.type <= EVENT_ERROR) ? typeNames[event.type] : "unknown", event.channel, event.reg, event.value);
+    }
+#else
+    _uartLogger.info("event ring requires SC16IS7XX_TRACE_LEVEL=SC16IS7XX_TRACE_EVENTS");
+#endif
+}
+
+// [static]
+void SC16IS7xxEventRing::clear() {
+#if SC16IS7XX_TRACE_LEVEL == SC16IS7XX_TRACE_EVENTS
+    nextEvent.store(0, std::memory_order_relaxed);
+#endif
+}
+
+void SC16IS7xxHistogram::add(uint32_t valueUs) {
+    size_t bucket = (valueUs < 2) ? 0 : (size_t)(31 - __builtin_clz(valueUs));
+    if (bucket >= NUM_BUCKETS) {
+        bucket = NUM_BUCKETS - 1;
+    }
+    buckets[bucket]++;
+    count++;
+    sumUs += valueUs;
+    if (valueUs > maxUs) {
+        maxUs = valueUs;
+    }
+}
+
+uint32_t SC16IS7xxHistogram::percentile(uint8_t percent) const {
+    if (count == 0) {
+        return 0;
+    }
+    uint32_t target = (uint32_t)(((uint64_t)count * percent + 99) / 100);
+    if (target == 0) {
+        target = 1;
+    }
+
+    uint32_t sum = 0;
+    for(size_t ii = 0; ii < NUM_BUCKETS - 1; ii++) {
+        sum += buckets[ii];
+        if (sum >= target) {
+            uint32_t upper = (2UL << ii) - 1;
+            return (upper < maxUs) ? upper : maxUs;
+        }
+    }
+    return maxUs;
+}
+
+void SC16IS7xxHistogram::log(const char *name) const {
+    _uartLogger.info("%s count=%lu mean=%lu p50=%lu p99=%lu max=%lu", name, count, mean(), percentile(50), percentile(99), maxUs);
+    for(size_t ii = 0; ii < NUM_BUCKETS; ii++) {
+        if (buckets[ii]) {
+            _uartLogger.info("  %lu-%lu us: %lu", (ii == 0) ? 0UL : (1UL << ii), (2UL << ii) - 1, buckets[ii]);
+        }
+    }
+}
+
 SC16IS7xxBuffer::SC16IS7xxBuffer() {
 
 }
@@ -17,7 +126,7 @@ void SC16IS7xxBuffer::free() {
 }
 
 
-bool SC16IS7xxBuffer::init(size_t bufSize) {
+bool SC16IS7xxBuffer::init(size_t bufSize, bool singleProducerSingleConsumer) {
     bool result = false;
 
     free();
@@ -25,7 +134,9 @@ bool SC16IS7xxBuffer::init(size_t bufSize) {
     buf = new uint8_t[bufSize];
     if (buf) {
         this->bufSize = bufSize;
-        readOffset = writeOffset = 0;
+        this->singleProducerSingleConsumer = singleProducerSingleConsumer;
+        readOffset.store(0);
+        writeOffset.store(0);
         result = true;
     }
 
@@ -33,53 +144,204 @@ bool SC16IS7xxBuffer::init(size_t bufSize) {
 }
 
 size_t SC16IS7xxBuffer::availableToRead() const {
-    size_t result;
+    BufferLock bufferLock(*this);
+
+    // In single producer, single consumer mode this may be called from either side. The acquire
+    // loads guarantee that the bytes counted are visible to the caller.
+    return usedBytes(readOffset.load(std::memory_order_acquire), writeOffset.load(std::memory_order_acquire));
+}
+
+int SC16IS7xxBuffer::read() {
+    int result = -1;
 
-    WITH_LOCK(*this) {
-        result = writeOffset - readOffset;
+    BufferLock bufferLock(*this);
+
+    // Only the consumer modifies readOffset, so a relaxed load is sufficient. The acquire load of 
+    // writeOffset pairs with the release store in the producer so the data in buf is visible.
+    size_t readOff = readOffset.load(std::memory_order_relaxed);
+    if (readOff != writeOffset.load(std::memory_order_acquire)) {
+        result = buf[readOff];
+
+        // The release store makes sure the byte is read before the producer can overwrite it
+        readOffset.store(advanceOffset(readOff, 1), std::memory_order_release);
     }
 
     return result;
 }
 
-int SC16IS7xxBuffer::read() {
+int SC16IS7xxBuffer::read(uint8_t *buffer, size_t size) {
     int result = -1;
 
-    WITH_LOCK(*this) {
-        if (readOffset < writeOffset) {
-            result = buf[readOffset++ % bufSize];
-            if (readOffset == writeOffset) {
-                readOffset = writeOffset = 0;
-            }
+    BufferLock bufferLock(*this);
+
+    size_t readOff = readOffset.load(std::memory_order_relaxed);
+    size_t writeOff = writeOffset.load(std::memory_order_acquire);
+    if (readOff != writeOff) {
+        size_t count = usedBytes(readOff, writeOff);
+        if (count > size) {
+            count = size;
+        }
+
+        // Copy in at most two segments: readOff to the end of buf, then from the beginning of buf
+        size_t firstCount = bufSize - readOff;
+        if (firstCount > count) {
+            firstCount = count;
         }
+        memcpy(buffer, &buf[readOff], firstCount);
+        if (firstCount < count) {
+            memcpy(&buffer[firstCount], buf, count - firstCount);
+        }
+
+        readOffset.store(advanceOffset(readOff, count), std::memory_order_release);
+        result = (int)count;
     }
 
     return result;
 }
 
-int SC16IS7xxBuffer::read(uint8_t *buffer, size_t size) {
+int SC16IS7xxBuffer::peek() const {
     int result = -1;
 
-    WITH_LOCK(*this) {
-        if (readOffset < writeOffset) {
-            result = (int)(writeOffset - readOffset);
-            if (result > (int)size) {
-                result = (int)size;
-            }
+    BufferLock bufferLock(*this);
 
-            for(int ii = 0; ii < result; ii++) {
-                buffer[ii] = buf[readOffset++ % bufSize];
-            }
+    size_t readOff = readOffset.load(std::memory_order_relaxed);
+    if (readOff != writeOffset.load(std::memory_order_acquire)) {
+        result = buf[readOff];
+    }
 
-            if (readOffset == writeOffset) {
-                readOffset = writeOffset = 0;
-            }
+    return result;
+}
+
+int SC16IS7xxBuffer::peek(uint8_t *buffer, size_t size) const {
+    int result = -1;
+
+    BufferLock bufferLock(*this);
+
+    size_t readOff = readOffset.load(std::memory_order_relaxed);
+    size_t writeOff = writeOffset.load(std::memory_order_acquire);
+    if (readOff != writeOff) {
+        size_t count = usedBytes(readOff, writeOff);
+        if (count > size) {
+            count = size;
+        }
+
+        size_t firstCount = bufSize - readOff;
+        if (firstCount > count) {
+            firstCount = count;
+        }
+        memcpy(buffer, &buf[readOff], firstCount);
+        if (firstCount < count) {
+            memcpy(&buffer[firstCount], buf, count - firstCount);
         }
+
+        result = (int)count;
+    }
+
+    return result;
+}
+
+size_t SC16IS7xxBuffer::peekContiguous(const uint8_t *&data) const {
+    size_t result = 0;
+
+    BufferLock bufferLock(*this);
+
+    size_t readOff = readOffset.load(std::memory_order_relaxed);
+    size_t writeOff = writeOffset.load(std::memory_order_acquire);
+    if (readOff != writeOff) {
+        // If the data wraps around, only return the part up to the end of buf
+        result = (writeOff > readOff) ? (writeOff - readOff) : (bufSize - readOff);
+        data = &buf[readOff];
+    }
+    else {
+        data = nullptr;
     }
 
     return result;
 }
 
+size_t SC16IS7xxBuffer::consume(size_t count) {
+    BufferLock bufferLock(*this);
+
+    size_t readOff = readOffset.load(std::memory_order_relaxed);
+    size_t used = usedBytes(readOff, writeOffset.load(std::memory_order_acquire));
+    if (count > used) {
+        count = used;
+    }
+    if (count > 0) {
+        readOffset.store(advanceOffset(readOff, count), std::memory_order_release);
+    }
+
+    return count;
+}
+
+int SC16IS7xxBuffer::find(uint8_t value, size_t offset, size_t limit) const {
+    BufferLock bufferLock(*this);
+
+    size_t readOff = readOffset.load(std::memory_order_relaxed);
+    size_t used = usedBytes(readOff, writeOffset.load(std::memory_order_acquire));
+    if (limit > used) {
+        limit = used;
+    }
+    if (offset >= limit) {
+        return -1;
+    }
+
+    // The first segment is from readOff to the end of buf, the second from the beginning of buf
+    size_t firstCount = bufSize - readOff;
+    if (offset < firstCount) {
+        size_t count = ((limit < firstCount) ? limit : firstCount) - offset;
+        const uint8_t *found = (const uint8_t *)memchr(&buf[readOff + offset], value, count);
+        if (found) {
+            return (int)(found - &buf[readOff]);
+        }
+        offset = firstCount;
+    }
+    if (offset < limit) {
+        const uint8_t *found = (const uint8_t *)memchr(&buf[offset - firstCount], value, limit - offset);
+        if (found) {
+            return (int)(found - buf + firstCount);
+        }
+    }
+    return -1;
+}
+
+void SC16IS7xxBuffer::getWriteSpace(uint8_t *&first, size_t &firstSize, uint8_t *&second, size_t &secondSize) const {
+    first = second = nullptr;
+    firstSize = secondSize = 0;
+
+    if (!buf) {
+        return;
+    }
+
+    BufferLock bufferLock(*this);
+
+    size_t writeOff = writeOffset.load(std::memory_order_relaxed);
+
+    // The - 1 factor is required because readOffset == writeOffset means empty buffer, not bufSize bytes
+    size_t avail = bufSize - usedBytes(readOffset.load(std::memory_order_acquire), writeOff) - 1;
+
+    firstSize = bufSize - writeOff;
+    if (firstSize > avail) {
+        firstSize = avail;
+    }
+    if (firstSize > 0) {
+        first = &buf[writeOff];
+    }
+    if (firstSize < avail) {
+        second = buf;
+        secondSize = avail - firstSize;
+    }
+}
+
+void SC16IS7xxBuffer::commit(size_t count) {
+    BufferLock bufferLock(*this);
+
+    if (count > 0) {
+        // The release store publishes the data written to buf to the consumer
+        writeOffset.store(advanceOffset(writeOffset.load(std::memory_order_relaxed), count), std::memory_order_release);
+    }
+}
+
 size_t SC16IS7xxBuffer::availableToWrite() const {
     size_t result;
 
@@ -101,17 +363,30 @@ size_t SC16IS7xxBuffer::write(const uint8_t *buffer, size_t size) {
         return 0;
     }
 
-    WITH_LOCK(*this) {
-        // The - 1 factor is required because readOffset == writeOffset means empty buffer, not bufSize bytes
-        size_t avail = bufSize - (writeOffset - readOffset) - 1;
-        if (size > avail) {
-            size = avail;
-        }
-        for(size_t ii = 0; ii < size; ii++) {
-            buf[writeOffset++ % bufSize] = buffer[ii];
-        }
+    BufferLock bufferLock(*this);
+
+    // Only the producer modifies writeOffset. The acquire load of readOffset pairs with the
+    // release store in the consumer so we don't overwrite bytes that have not been read yet.
+    size_t writeOff = writeOffset.load(std::memory_order_relaxed);
+
+    // The - 1 factor is required because readOffset == writeOffset means empty buffer, not bufSize bytes
+    size_t avail = bufSize - usedBytes(readOffset.load(std::memory_order_acquire), writeOff) - 1;
+    if (size > avail) {
+        size = avail;
+    }
+    // Copy in at most two segments: writeOff to the end of buf, then from the beginning of buf
+    size_t firstCount = bufSize - writeOff;
+    if (firstCount > size) {
+        firstCount = size;
+    }
+    memcpy(&buf[writeOff], buffer, firstCount);
+    if (firstCount < size) {
+        memcpy(buf, &buffer[firstCount], size - firstCount);
     }
 
+    // The release store publishes the data written to buf to the consumer
+    writeOffset.store(advanceOffset(writeOff, size), std::memory_order_release);
+
     return size;
 }
 
@@ -120,36 +395,37 @@ void SC16IS7xxBuffer::writeCallback(std::function<void(uint8_t *buffer, size_t &
         return;
     }
 
-    WITH_LOCK(*this) {
-        // The - 1 factor is required because readOffset == writeOffset means empty buffer, not bufSize bytes
-        size_t avail = bufSize - (writeOffset - readOffset) - 1;
-        
-        while(avail > 0) {
-            size_t writeOffsetInBlock = writeOffset % bufSize;
-            size_t bytesThisBlock = bufSize - writeOffsetInBlock;
-            if (bytesThisBlock > avail) {
-                bytesThisBlock = avail;
-            }
-            size_t callbackSize = bytesThisBlock;
-            callback(&buf[writeOffsetInBlock], callbackSize);
-
-            writeOffset += callbackSize;
-            avail -= callbackSize;
-
-            if (callbackSize < bytesThisBlock) {
-                // Didn't read a full buffer. Also handles the end of data case of callbackSize == 0
-                break;
-            }
+    BufferLock bufferLock(*this);
+
+    size_t writeOff = writeOffset.load(std::memory_order_relaxed);
+
+    // The - 1 factor is required because readOffset == writeOffset means empty buffer, not bufSize bytes
+    size_t avail = bufSize - usedBytes(readOffset.load(std::memory_order_acquire), writeOff) - 1;
+    
+    while(avail > 0) {
+        size_t bytesThisBlock = bufSize - writeOff;
+        if (bytesThisBlock > avail) {
+            bytesThisBlock = avail;
         }
-    }
+        size_t callbackSize = bytesThisBlock;
+        callback(&buf[writeOff], callbackSize);
 
+        writeOff = advanceOffset(writeOff, callbackSize);
+        writeOffset.store(writeOff, std::memory_order_release);
+        avail -= callbackSize;
 
+        if (callbackSize < bytesThisBlock) {
+            // Didn't read a full buffer. Also handles the end of data case of callbackSize == 0
+            break;
+        }
+    }
 }
 
 
 SC16IS7xxPort &SC16IS7xxPort::withTransmissionControlLevels(uint8_t haltLevel, uint8_t resumeLevel) {
-    if (haltLevel > resumeLevel) {
-        tcr = (uint8_t)((haltLevel & 0xF) << 4 | (resumeLevel & 0xf));
+    if (haltLevel > resumeLevel && haltLevel <= 60) {
+        // TCR[3:0] is the halt level and TCR[7:4] is the resume level, both in units of 4 characters
+        tcr = (uint8_t)(((resumeLevel / 4) & 0xf) << 4 | ((haltLevel / 4) & 0xf));
     }
     else {
         _uartLogger.error("invalid parameters to withTransmissionControlLevels");
@@ -166,91 +442,176 @@ bool SC16IS7xxPort::begin(int baudRate, uint32_t options) {
 	// https://www.digikey.com/product-detail/en/avx-corp-kyocera-corp/KC3225K1.84320C1GE00/1253-1488-1-ND/5322590
 	// Another suggested frequency from the data sheet is 3.072 MHz
 
-    // Enable buffered read mode
-    if (bufferedReadSize != 0) {
-        // TODO: Delete readBuffer if it already exists
+    if (multidrop && bufferedReadSize == 0) {
+        _uartLogger.error("withMultidrop requires withBufferedRead");
+        return false;
+    }
+    if (frameDelimiterEnabled && (bufferedReadSize == 0 || multidrop)) {
+        _uartLogger.error("withFrameDelimiter requires withBufferedRead and cannot be used with withMultidrop");
+        return false;
+    }
+    if (modbusEnabled && (bufferedReadSize == 0 || multidrop)) {
+        _uartLogger.error("withModbusRTU requires withBufferedRead and cannot be used with withMultidrop");
+        return false;
+    }
+
+    // The divisor latch divides the clock frequency (optionally prescaled by 4) to 16x the baud rate.
+    // Check this first so nothing is changed if the baud rate cannot be used.
+    uint16_t div;
+    bool prescaler4;
+    actualBaudRate = calculateDivisor(interface->oscillatorFreqHz, baudRate, div, prescaler4);
+    baudRateError = (actualBaudRate != 0) ? 
+        (float)(((double)interface->oscillatorFreqHz / ((prescaler4 ? 64.0 : 16.0) * div) - baudRate) * 100.0 / baudRate) : 100.0f;
+
+    if (actualBaudRate == 0 || baudRate > MAX_BAUD_RATE || fabsf(baudRateError) > baudRateTolerance) {
+        _uartLogger.error("baudRate=%d not supported, closest is %d (%.2f%% error) with oscillator %d Hz", 
+            baudRate, actualBaudRate, baudRateError, interface->oscillatorFreqHz);
+        return false;
+    }
 
-        readBuffer = new SC16IS7xxBuffer();
-        if (readBuffer) {
-            readBuffer->init(bufferedReadSize);
+    // begin() can be called again, for example to change the baud rate. The buffers from the last call 
+    // are replaced while the worker thread is not using them, and each thread function is only registered once.
+    WITH_LOCK(interface->workerMutex) {
+        delete readBuffer;
+        readBuffer = nullptr;
+        delete writeBuffer;
+        writeBuffer = nullptr;
 
-            readDataAvailable = false;
+        // Enable buffered read mode
+        if (bufferedReadSize != 0) {
+            readBuffer = new SC16IS7xxBuffer();
+            if (readBuffer) {
+                readBuffer->init(bufferedReadSize, bufferedReadLockFree);
 
-            interface->registerThreadFunction([this]() {
-                // This code is called from the worker thread
+                readDataAvailable = false;
 
                 if (interface->irqPin != PIN_INVALID) {
-                    // Blocks until the interrupt handler unlocks
-                    if (!readDataAvailable) {
-                        return;
+                    if (!readThreadFunctionRegistered) {
+                        readThreadFunctionRegistered = true;
+                        interface->registerThreadFunction([this]() {
+                            // This code is called from the worker thread
+                            if (readBuffer) {
+                                readFifoToBuffer();
+                            }
+                        });
                     }
-                    // _uartLogger.trace("readDataAvailable=true in buffered read thread");
-                    readDataAvailable = false;
                 }
+                else {
+                    // When polling, the worker thread reads all ports in buffered read mode in a single
+                    // bus transaction from serviceReadBuffers()
+                    interface->registerThreadFunction(nullptr);
+                }
+            }
+        }
 
-                size_t rxAvailable = available();
-                if (rxAvailable) {                    
-                    readBuffer->writeCallback([this, &rxAvailable](uint8_t *buffer, size_t &size) {
-                        if (size > rxAvailable) {
-                            size = rxAvailable;
-                        }
-                        if (size > interface->readInternalMax()) {
-                            size = interface->readInternalMax();
-                        }                        
-                        if (size > 0) {
-                            interface->readInternal(channel, buffer, size);
-                            rxAvailable -= size;
+        // Enable buffered write mode
+        if (bufferedWriteSize != 0) {
+            writeBuffer = new SC16IS7xxBuffer();
+            if (writeBuffer) {
+                writeBuffer->init(bufferedWriteSize, bufferedWriteLockFree);
+
+                if (!writeThreadFunctionRegistered) {
+                    writeThreadFunctionRegistered = true;
+                    interface->registerThreadFunction([this]() {
+                        // This code is called from the worker thread
+                        if (writeBuffer) {
+                            writeBufferToFifo();
                         }
                     });
                 }
-            });
+            }
         }
     }
 
-    // TODO: Do we want to have buffered write mode as well?
+    // All of the register writes are done in a single bus transaction at the end of begin(). The chip
+    // may have been reset since the last begin(), so nothing is skipped because of the shadow registers.
+    interface->invalidateShadowRegisters();
+    SC16IS7xxBatch batch;
 
-	// The divider devices the clock frequency to 16x the baud rate
-	int div = interface->oscillatorFreqHz / (baudRate * 16);
+    _uartLogger.trace("baudRate=%d div=%u prescaler=%d actual=%d error=%.2f%% options=0x%08lx", 
+        baudRate, div, prescaler4 ? 4 : 1, actualBaudRate, baudRateError, options);
+
+    // options set break, parity, stop bits, and word length
+    lcr = (uint8_t)(options & 0x3f);
+    if (multidrop) {
+        // The parity bit is the 9th bit, address (1) or data (0). Parity forced to 0 LCR[5:3] = 111
+        // sends data bytes, and received address bytes are flagged as parity errors.
+        lcr = (lcr & 0x07) | 0b00111000;
+    }
 
-    _uartLogger.trace("baudRate=%d div=%d options=0x%08lx", baudRate, div, options);
+    // Time to transfer one character in microseconds, used for adaptive polling
+    // Start bit + word length LCR[1:0] + parity LCR[3] + stop bits LCR[2], in half bits since 5-bit words with 2 stop bits use 1.5
+    uint32_t halfBits = 2 + 2 * ((lcr & 0x03) + 5);
+    if ((lcr & 0x08) != 0) {
+        halfBits += 2;
+    }
+    if ((lcr & 0x04) != 0) {
+        halfBits += ((lcr & 0x03) == 0) ? 3 : 4;
+    }
+    else {
+        halfBits += 2;
+    }
+    charTimeUs = (uint32_t)((halfBits * 500000UL + actualBaudRate - 1) / actualBaudRate);
+    rxDeadlineUs = txDeadlineUs = micros();
+    txDeadlineValid = false;
+
+    if (modbusEnabled) {
+        // The Modbus specification uses a fixed 1750 microsecond silence above 19200 baud
+        modbusGapUs = (actualBaudRate > 19200) ? 1750 : (charTimeUs * 7 + 1) / 2;
+        modbusLastRxUs = modbusTxEndUs = rxDeadlineUs;
+        modbusRxTimeout = false;
+        if (!modbusFrame) {
+            modbusFrame = new uint8_t[MODBUS_MAX_FRAME];
+        }
+    }
 
     // Hardware flow control
 
     // EFR can only be set when Enhanced Feature Registers are only accessible when LCR = 0xBF 0b10111111
-    interface->writeRegister(channel, SC16IS7xxInterface::LCR_REG, SC16IS7xxInterface::LCR_ENABLE_ENHANCED_FEATURE_REG); // 0xbf
+    batch.addWriteRegister(channel, SC16IS7xxInterface::LCR_REG, SC16IS7xxInterface::LCR_ENABLE_ENHANCED_FEATURE_REG); // 0xbf
 
     // Set EFR[4] = 1 and MCR[2] = 1, required to set TCR
     // Basically, TCR and MSR are the same register, and the purpose is dependent on EFR[4]
     efr = 0b00010000; // Enable enhanced functions EFR[4]
-    interface->writeRegister(channel, SC16IS7xxInterface::EFR_REG, efr);
+    batch.addWriteRegister(channel, SC16IS7xxInterface::EFR_REG, efr);
 
+    // IER, MCR, TCR, and TLR are in the general register set, which is only accessible when LCR[7] = 0.
+    // With LCR = 0xBF, register 4 - 7 are the Xon/Xoff registers instead.
+    batch.addWriteRegister(channel, SC16IS7xxInterface::LCR_REG, lcr);
+
+    // Writing to the divisor latches DLL and DLH to set the baud clock must not be done during Sleep mode. 
+    // Therefore, it is advisable to disable Sleep mode using IER[4] before writing to DLL or DLH.
+    // The power-on state is 0, and we will change it below if necessary to enable interrupts
+    ier = 0;
+    batch.addWriteRegister(channel, SC16IS7xxInterface::IER_REG, ier);
 
     // The boot value of MCR is 0x00
-    // We always use the default divisor prescaler of 1 using MCR[7] = 0. The divide by 4 isn't necessary for 
-    // the standard crystal values.
-    if ((options & OPTIONS_FLOW_CONTROL_RTS_CTS) != 0) {
-        mcr = 0b00000100; // TCR and TLR enable MCR[2]
-        interface->writeRegister(channel, SC16IS7xxInterface::MCR_REG, mcr);
+    // MCR[7] selects the divide by 4 clock prescaler, which is only needed for low baud rates with
+    // fast oscillators. It can only be changed when EFR[4] = 1, which was set above.
+    mcr = prescaler4 ? 0b10000000 : 0;
+    // EFR[3:0] software flow control mode from options bits 11:8
+    uint8_t softwareFlowControl = (uint8_t)((options >> 8) & 0x0f);
+
+    // The TCR halt and resume levels are used for both auto RTS and sending Xoff and Xon EFR[3:2]
+    if ((options & OPTIONS_FLOW_CONTROL_RTS_CTS) != 0 || (softwareFlowControl & 0b1100) != 0) {
+        mcr |= 0b00000100; // TCR and TLR enable MCR[2]
+        batch.addWriteRegister(channel, SC16IS7xxInterface::MCR_REG, mcr);
 
         // TCR must be set before flow control is enabled in the EFR
-        // tcr is set from withTransmissionControlLevels. Default value is halt at 60, resume at 30.
+        // tcr is set from withTransmissionControlLevels. Default value is halt at 60, resume at 28.
         // TCR can only be set when MCR[2] = 1 and EFR[4] = 1, otherwise it is the MSR (modem status register)
-        interface->writeRegister(channel, SC16IS7xxInterface::TCR_REG, tcr);
-        interface->writeRegister(channel, SC16IS7xxInterface::TLR_REG, 0);
+        batch.addWriteRegister(channel, SC16IS7xxInterface::TCR_REG, tcr);
+        batch.addWriteRegister(channel, SC16IS7xxInterface::TLR_REG, 0);
     }
     else {
-        mcr = 0;
-        interface->writeRegister(channel, SC16IS7xxInterface::MCR_REG, mcr);
+        batch.addWriteRegister(channel, SC16IS7xxInterface::MCR_REG, mcr);
     }
-    // When enabling flow control, output is setting set to 5 bits!
 
     // EFR can only be set when Enhanced Feature Registers are only accessible when LCR = 0xBF 0b10111111
     // If that were an actual config it would be divisor latch + set parity to 0, 8 data bits, 2 stop bits
-    interface->writeRegister(channel, SC16IS7xxInterface::LCR_REG, SC16IS7xxInterface::LCR_ENABLE_ENHANCED_FEATURE_REG); // 0xbf
+    batch.addWriteRegister(channel, SC16IS7xxInterface::LCR_REG, SC16IS7xxInterface::LCR_ENABLE_ENHANCED_FEATURE_REG); // 0xbf
 
     // Enable RTS or CTS
-    // Clear enhanced function enable EFR[4] so TCR goes back to being MSR now that TCR is set?
-    // efr = 0;
     if ((options & OPTIONS_FLOW_CONTROL_RTS) != 0) {
         // RTS flow enable EFR[6]
         efr |= 0b01000000;
@@ -259,25 +620,52 @@ bool SC16IS7xxPort::begin(int baudRate, uint32_t options) {
         // CTS flow enable EFR[7]
         efr |= 0b10000000;            
     }
-    interface->writeRegister(channel, SC16IS7xxInterface::EFR_REG, efr);
-
-    // options set break, parity, stop bits, and word length
-    lcr = (uint8_t)(options & 0x3f);
-
-    // Writing to the divisor latches DLL and DLH to set the baud clock must not be done during Sleep mode. 
-    // Therefore, it is advisable to disable Sleep mode using IER[4] before writing to DLL or DLH.
-    // The power-on state is 0, and we will change it below if necessary to enable interrupts
-    ier = 0;
-    interface->writeRegister(channel, SC16IS7xxInterface::IER_REG, ier);
+    if (softwareFlowControl != 0) {
+        // Xon and Xoff characters are in the enhanced register set, like EFR. In multidrop mode XOFF2 is the address.
+        batch.addWriteRegister(channel, SC16IS7xxInterface::XON1_REG, xonXoff[0]);
+        batch.addWriteRegister(channel, SC16IS7xxInterface::XON2_REG, xonXoff[1]);
+        batch.addWriteRegister(channel, SC16IS7xxInterface::XOFF1_REG, xonXoff[2]);
+        if (!multidrop) {
+            batch.addWriteRegister(channel, SC16IS7xxInterface::XOFF2_REG, xonXoff[3]);
+        }
+        efr |= softwareFlowControl;
+    }
+    if (frameDelimiterEnabled && interface->irqPin != PIN_INVALID) {
+        // Special character detect EFR[5] interrupts when the character in XOFF2 is received
+        efr |= 0b00100000;
+        batch.addWriteRegister(channel, SC16IS7xxInterface::XOFF2_REG, frameDelimiter);
+    }
+    if (multidrop) {
+        // In 9-bit mode, special character detect EFR[5] enables automatic address detection using XOFF2
+        efr |= 0b00100000;
+        batch.addWriteRegister(channel, SC16IS7xxInterface::XOFF2_REG, multidropAddress);
+    }
+    batch.addWriteRegister(channel, SC16IS7xxInterface::EFR_REG, efr);
 
     // DLL_REG and DHL_REG are accessible only when LCR[7] = 1 and not 0xBF.
-	interface->writeRegister(channel, SC16IS7xxInterface::LCR_REG, SC16IS7xxInterface::LCR_SPECIAL_ENABLE_DIVISOR_LATCH); // 0x80
-	interface->writeRegister(channel, SC16IS7xxInterface::DLL_REG, div & 0xff);
-	interface->writeRegister(channel, SC16IS7xxInterface::DLH_REG, div >> 8);
-	interface->writeRegister(channel, SC16IS7xxInterface::LCR_REG, lcr); // Clears LCR_SPECIAL_ENABLE_DIVISOR_LATCH
+	batch.addWriteRegister(channel, SC16IS7xxInterface::LCR_REG, SC16IS7xxInterface::LCR_SPECIAL_ENABLE_DIVISOR_LATCH); // 0x80
+	batch.addWriteRegister(channel, SC16IS7xxInterface::DLL_REG, div & 0xff);
+	batch.addWriteRegister(channel, SC16IS7xxInterface::DLH_REG, div >> 8);
+	batch.addWriteRegister(channel, SC16IS7xxInterface::LCR_REG, lcr); // Clears LCR_SPECIAL_ENABLE_DIVISOR_LATCH
 
 	// Enable FIFOs
-	interface->writeRegister(channel, SC16IS7xxInterface::FCR_IIR_REG, 0x07); // Enable FIFO, Clear RX and TX FIFOs
+	batch.addWriteRegister(channel, SC16IS7xxInterface::FCR_IIR_REG, 0x07); // Enable FIFO, Clear RX and TX FIFOs
+
+    // EFCR is in the general register set. EFCR[4] lets the transmitter control RTS for RS-485 direction, 
+    // EFCR[5] inverts it so RTS is high while transmitting.
+    efcr = 0;
+    if (multidrop) {
+        // 9-bit mode EFCR[0], with the receiver disabled EFCR[1] until this port's address is received
+        efcr |= 0b00000011;
+        multidropMatched = false;
+    }
+    if (rs485) {
+        efcr |= 0b00010000;
+        if (rs485RtsHighDuringTx) {
+            efcr |= 0b00100000;
+        }
+    }
+    batch.addWriteRegister(channel, SC16IS7xxInterface::EFCR_REG, efcr);
 
     if (interface->irqPin != PIN_INVALID) {
         // Enable interrupt mode
@@ -289,86 +677,947 @@ bool SC16IS7xxPort::begin(int baudRate, uint32_t options) {
             if (readFifoInterruptLevel < 4) {
                 readFifoInterruptLevel = 4;
             }
-            if (readFifoInterruptLevel > 64) {
-                readFifoInterruptLevel = 64;
+            if (readFifoInterruptLevel > 60) {
+                readFifoInterruptLevel = 60;
             }
-            tlr &= 0x0f; // preserve LHR level
+            tlr &= 0x0f; // preserve THR level
             tlr |= (uint8_t)((readFifoInterruptLevel / 4) << 4);
 
-        	interface->writeRegister(channel, SC16IS7xxInterface::TLR_REG, tlr);
+            interruptRHR = interruptRxTimeout = [this]() {
+                // Received data, or timeout. Drain the FIFO now, which clears the interrupt 
+                // so handleIIR can move on to the next pending source.
+                readDataAvailable = true;
+                readFifoToBuffer();
+            };
+
+            if (modbusEnabled) {
+                // The RX timeout occurs after 4 character times without data, so the data in the FIFO
+                // is the end of a Modbus RTU frame
+                interruptRxTimeout = [this]() {
+                    modbusRxTimeout = true;
+                    readDataAvailable = true;
+                    readFifoToBuffer();
+                };
+            }
+        }
+
+        if (writeBuffer) {
+            // The THR interrupt (IER[1]) is only enabled by the worker thread when there is data
+            // waiting in the write buffer, otherwise it would be asserted continuously.
+            thrInterruptEnabled = false;
+            writeSpaceAvailable = false;
+
+            if (writeFifoInterruptLevel < 4) {
+                writeFifoInterruptLevel = 4;
+            }
+            if (writeFifoInterruptLevel > 60) {
+                writeFifoInterruptLevel = 60;
+            }
+            tlr &= 0xf0; // preserve RHR level
+            tlr |= (uint8_t)(writeFifoInterruptLevel / 4);
+
+            interruptTHR = [this]() {
+                // TX FIFO has at least writeFifoInterruptLevel spaces. Reading IIR cleared the interrupt.
+                writeSpaceAvailable = true;
+                writeBufferToFifo();
+            };
+        }
+
+        if (readBuffer || writeBuffer) {
+            // TLR is only accessible when MCR[2] = 1 and EFR[4] = 1. EFR[4] was set above.
+            mcr |= 0b00000100;
+            batch.addWriteRegister(channel, SC16IS7xxInterface::MCR_REG, mcr);
+
+        	batch.addWriteRegister(channel, SC16IS7xxInterface::TLR_REG, tlr);
             _uartLogger.trace("tlr=0x%02x", tlr);
+        }
 
-            interruptRHR = interruptRxTimeout = [this]() {
-                // Received data, or timeout, release the read mutex
+        if (frameDelimiterEnabled) {
+            // Special character interrupt IER[5] when the delimiter is received, so the FIFO is read 
+            // immediately instead of waiting for the RX trigger level or timeout. It uses the same 
+            // IIR value as Xoff, so Xoff is not reported separately.
+            ier |= 0b00100000;
+
+            interruptXoff = [this]() {
                 readDataAvailable = true;
-                // _uartLogger.trace("readDataAvailable set in IRQ handler");
+                readFifoToBuffer();
+            };
+        }
+        else
+        if ((softwareFlowControl & 0b0011) != 0) {
+            // Xoff interrupt IER[5] when the other side pauses transmission. IER[7:4] can only be set
+            // when EFR[4] = 1, which was set above. Reading IIR clears the interrupt.
+            ier |= 0b00100000;
+
+            interruptXoff = [this]() {
+                ATOMIC_BLOCK() {
+                    stats.xoffReceived++;
+                }
+                if (xoffHandler) {
+                    xoffHandler();
+                }
             };
         }
 
         _uartLogger.trace("ier=0x%02x", ier);
-    	interface->writeRegister(channel, SC16IS7xxInterface::IER_REG, ier);
+    	batch.addWriteRegister(channel, SC16IS7xxInterface::IER_REG, ier);
     }
 
     if (interface->enableGPIO) {
         // Enable GPIO mode (this does not set the individual pin modes, etc.)
     }
 
-	return true;
+	return interface->execute(batch);
+}
+
+// [static]
+int SC16IS7xxPort::calculateDivisor(int oscillatorFreqHz, int baudRate, uint16_t &divisor, bool &prescaler4) {
+    int actualBaudRate = 0;
+    double bestError = 0;
+
+    divisor = 1;
+    prescaler4 = false;
+
+    if (oscillatorFreqHz <= 0 || baudRate <= 0) {
+        return 0;
+    }
+
+    // baud = oscillatorFreqHz / (prescaler * 16 * divisor). Prescaler 1 is tried first so it is used 
+    // when both produce the same error.
+    for(uint32_t prescaler = 1; prescaler <= 4; prescaler += 3) {
+        uint64_t denom = (uint64_t)prescaler * 16 * (uint64_t)baudRate;
+
+        // Round to the nearest divisor instead of truncating, which is always too fast
+        uint64_t div = ((uint64_t)oscillatorFreqHz + denom / 2) / denom;
+        if (div < 1) {
+            div = 1;
+        }
+        if (div > 0xffff) {
+            div = 0xffff;
+        }
+
+        double actual = (double)oscillatorFreqHz / (double)(prescaler * 16 * div);
+        double error = fabs(actual - baudRate);
+        if (actualBaudRate == 0 || error < bestError) {
+            bestError = error;
+            actualBaudRate = (int)(actual + 0.5);
+            divisor = (uint16_t)div;
+            prescaler4 = (prescaler == 4);
+        }
+    }
+
+    return actualBaudRate;
 }
 
 int SC16IS7xxPort::available() {
+    if (readBuffer) {
+        return (int) readBuffer->availableToRead();
+    }
+    else {
+        return availableInternal();
+    }
+}
+
+int SC16IS7xxPort::availableInternal() {
+    ATOMIC_BLOCK() {
+        stats.rxBusOps++;
+    }
 	return interface->readRegister(channel, SC16IS7xxInterface::RXLVL_REG);
 }
 
 int SC16IS7xxPort::availableForWrite() {
-	return interface->readRegister(channel, SC16IS7xxInterface::TXLVL_REG);
+    if (writeBuffer) {
+        return (int) writeBuffer->availableToWrite();
+    }
+    else {
+        return availableForWriteInternal();
+    }
 }
 
+int SC16IS7xxPort::availableForWriteInternal() {
+    ATOMIC_BLOCK() {
+        stats.txBusOps++;
+    }
+	return interface->readRegister(channel, SC16IS7xxInterface::TXLVL_REG);
+}
 
-int SC16IS7xxPort::read() {    
-	if (hasPeek) {
-		hasPeek = false;
-		return peekByte;
-	}
-	else {
-        if (!readBuffer) {
-            if (available()) {
-                return interface->readRegister(channel, SC16IS7xxInterface::RHR_THR_REG);
-            }
-            else {
-                return -1;
+void SC16IS7xxPort::readFifoToBuffer() {
+    if (interface->irqPin != PIN_INVALID) {
+        // Blocks until the interrupt handler unlocks
+        if (!readDataAvailable) {
+            if (!modbusEnabled || !isModbusGapElapsed()) {
+                return;
             }
+            // A frame that ended when the FIFO was emptied does not cause an RX timeout. But the RHR 
+            // interrupt only occurs at the trigger level and the RX timeout is 4 character times, longer 
+            // than the 3.5 character gap, so the end of a longer frame may still be in the FIFO. Read 
+            // RXLVL and drain the FIFO, and checkModbusFrame() only completes the frame if it was empty.
         }
         else {
-            return readBuffer->read();
+            // _uartLogger.trace("readDataAvailable=true in buffered read thread");
+            readDataAvailable = false;
         }
-	}
-}
+    }
+    else
+    if (interface->adaptivePolling) {
+        if (!isServiceDue(rxDeadlineUs)) {
+            return;
+        }
+    }
 
-int SC16IS7xxPort::peek() {
-	if (!hasPeek) {
-		peekByte = read();
-		hasPeek = true;
-	}
-	return peekByte;
+    SC16IS7xxBatch &batch = interface->workerBatch;
+    batch.clear();
+    addReadFifoToBatch(batch);
+    interface->execute(batch);
+    completeReadFifoBatch();
+
+    if (interface->histogramsEnabled && interface->irqPin != PIN_INVALID) {
+        // Only the first drain after each falling edge is counted. If IRQ stays asserted, later drains 
+        // would be measured from an old edge.
+        uint32_t now = micros();
+        ATOMIC_BLOCK() {
+            if (interface->irqSequence != lastIrqSequence) {
+                lastIrqSequence = interface->irqSequence;
+                histograms.irqToDrainUs.add(now - interface->irqTimeUs);
+            }
+        }
+    }
 }
 
-void SC16IS7xxPort::flush() {
-	while(availableForWrite() < 64) {
-		delay(1);
-	}
-}
+void SC16IS7xxPort::addReadFifoToBatch(SC16IS7xxBatch &batch) {
+    // Read RXLVL, then read that many bytes directly into the free space in the read buffer. Since the 
+    // number of bytes isn't known until RXLVL is read, the FIFO reads use rxRemaining, which is decremented
+    // as bytes are read. The free space may be in two pieces because the buffer is circular, and each 
+    // piece may require more than one transaction with I2C.
+    rxLevel = rxRemaining = 0;
+    rxBytesRead = 0;
+    rxLineStatus = 0;
+
+    if (multidrop) {
+        // The FIFO can only be read as a block if it does not contain address bytes, which is not known until
+        // LSR is read, so completeReadFifoBatch() reads it. RXLVL is read first so LSR covers every byte counted.
+        batch.addReadRegister(channel, SC16IS7xxInterface::RXLVL_REG, &rxRemaining);
+        batch.addReadRegister(channel, SC16IS7xxInterface::LSR_REG, &rxLineStatus);
+        return;
+    }
 
-size_t SC16IS7xxPort::write(uint8_t c) {
+    // LSR is read for the overrun and error counters in stats
+    batch.addReadRegister(channel, SC16IS7xxInterface::LSR_REG, &rxLineStatus);
+    batch.addReadRegister(channel, SC16IS7xxInterface::RXLVL_REG, &rxRemaining);
+
+    addReadFifoDataToBatch(batch);
+}
+
+void SC16IS7xxPort::addReadFifoDataToBatch(SC16IS7xxBatch &batch) {
+    uint8_t *region[2];
+    size_t regionSize[2];
+    readBuffer->getWriteSpace(region[0], regionSize[0], region[1], regionSize[1]);
+    rxFirstRegionSize = regionSize[0];
+    rxRegion[0] = region[0];
+    rxRegion[1] = region[1];
+
+    size_t fifoLeft = 64;
+    for(size_t ii = 0; ii < 2 && fifoLeft > 0; ii++) {
+        size_t offset = 0;
+        while(offset < regionSize[ii] && fifoLeft > 0) {
+            size_t count = regionSize[ii] - offset;
+            if (count > fifoLeft) {
+                count = fifoLeft;
+            }
+            if (count > interface->readInternalMax()) {
+                count = interface->readInternalMax();
+            }
+            if (!batch.addReadFifo(channel, &region[ii][offset], count, &rxRemaining, &rxBytesRead)) {
+                return;
+            }
+            offset += count;
+            fifoLeft -= count;
+        }
+    }
+}
+
+void SC16IS7xxPort::completeReadFifoBatch() {
+    size_t fifoReads;
+    if (multidrop) {
+        rxLevel = rxRemaining;
+        fifoReads = readFifoMultidrop();
+
+        // LSR[2] flags address bytes in 9-bit mode, not parity errors
+        rxLineStatus &= ~0b00000100;
+    }
+    else {
+        // rxRemaining is now the number of bytes left in the FIFO, typically 0 unless the buffer is full
+        rxLevel = rxRemaining + rxBytesRead;
+        fifoReads = fifoReadCount();
+    }
+
+    // Check the new data for the delimiter before committing it, since the reader can use it after that
+    bool delimiterReceived = false;
+    if (frameDelimiterEnabled && rxBytesRead > 0) {
+        size_t firstCount = (rxBytesRead < rxFirstRegionSize) ? rxBytesRead : rxFirstRegionSize;
+        delimiterReceived = memchr(rxRegion[0], frameDelimiter, firstCount) != nullptr ||
+            (rxBytesRead > firstCount && memchr(rxRegion[1], frameDelimiter, rxBytesRead - firstCount) != nullptr);
+    }
+    readBuffer->commit(rxBytesRead);
+
+    size_t bufferLevel = readBuffer->availableToRead();
+
+    countLineStatus(rxLineStatus);
+    ATOMIC_BLOCK() {
+        stats.rxBytes += rxBytesRead;
+        stats.rxBusOps += 2 + fifoReads;
+        if (rxLevel > stats.rxFifoHighWater) {
+            stats.rxFifoHighWater = rxLevel;
+        }
+        if (bufferLevel > stats.rxBufferHighWater) {
+            stats.rxBufferHighWater = bufferLevel;
+        }
+        if (rxRemaining > 0) {
+            stats.rxBufferFull++;
+        }
+        stats.serviceCount++;
+    }
+    recordService();
+
+    if (delimiterReceived && frameHandler) {
+        frameHandler();
+    }
+
+    if (modbusEnabled) {
+        checkModbusFrame(rxBytesRead);
+    }
+
+    if (interface->irqPin == PIN_INVALID && interface->adaptivePolling) {
+        uint32_t now = micros();
+        int32_t lateUs = (int32_t)(now - rxDeadlineUs);
+        ATOMIC_BLOCK() {
+            if (lateUs > pollingStats.rxMaxLateUs) {
+                pollingStats.rxMaxLateUs = lateUs;
+            }
+            if (rxLevel > pollingStats.rxMaxFifoLevel) {
+                pollingStats.rxMaxFifoLevel = rxLevel;
+            }
+            pollingStats.rxServiceCount++;
+        }
+
+        // Assume data arrives at the full line rate and schedule the next check for when the FIFO
+        // could reach the target level. When the line is idle this is the longest interval.
+        size_t targetLevel = interface->adaptivePollingFifoLevel;
+        uint32_t intervalUs = (targetLevel > rxRemaining) ? (uint32_t)(targetLevel - rxRemaining) * charTimeUs : 0;
+        if (intervalUs > interface->adaptivePollingMaxIntervalMs * 1000) {
+            intervalUs = interface->adaptivePollingMaxIntervalMs * 1000;
+        }
+        if (modbusEnabled && intervalUs > modbusGapUs) {
+            // Two frames in the FIFO at once can't be separated, so read at least once per inter-frame gap
+            intervalUs = modbusGapUs;
+        }
+        pollingStats.rxIntervalUs = intervalUs;
+        rxDeadlineUs = now + intervalUs;
+
+        if (modbusEnabled && readBuffer->availableToRead() > 0) {
+            // Check again when the partial frame could be complete
+            uint32_t gapDeadlineUs = modbusLastRxUs + modbusGapUs;
+            if ((int32_t)(gapDeadlineUs - rxDeadlineUs) < 0) {
+                rxDeadlineUs = gapDeadlineUs;
+            }
+        }
+    }
+}
+
+void SC16IS7xxPort::checkModbusFrame(size_t bytesRead) {
+    uint32_t now = micros();
+    bool rxTimeout = modbusRxTimeout;
+    modbusRxTimeout = false;
+
+    if (bytesRead > 0) {
+        // The last byte arrived before now, so the gap measured from here is never too short
+        modbusLastRxUs = now;
+    }
+
+    size_t length = readBuffer->availableToRead();
+    if (length == 0) {
+        return;
+    }
+    if (rxTimeout) {
+        // The chip already saw 4 character times of silence, unless data was left in the FIFO
+        if (rxRemaining > 0) {
+            return;
+        }
+    }
+    else
+    if (bytesRead > 0 || (now - modbusLastRxUs) < modbusGapUs) {
+        return;
+    }
+
+    if (length < 4 || length > MODBUS_MAX_FRAME) {
+        // Address, function code, and CRC are required
+        ATOMIC_BLOCK() {
+            stats.modbusFrameErrors++;
+        }
+        readBuffer->consume(length);
+        return;
+    }
+
+    // The worker thread is the only reader in Modbus RTU mode, so it can pass the frame without copying 
+    // it unless it wraps around the end of the read buffer
+    const uint8_t *frame;
+    if (readBuffer->peekContiguous(frame) < length) {
+        readBuffer->peek(modbusFrame, length);
+        frame = modbusFrame;
+    }
+
+    if (modbusCRC16(frame, length) == 0) {
+        ATOMIC_BLOCK() {
+            stats.modbusFrames++;
+        }
+        if (modbusHandler) {
+            modbusHandler(frame, length - 2);
+        }
+    }
+    else {
+        ATOMIC_BLOCK() {
+            stats.modbusCrcErrors++;
+        }
+    }
+    readBuffer->consume(length);
+}
+
+bool SC16IS7xxPort::isModbusGapElapsed() const {
+    return readBuffer->availableToRead() > 0 && (micros() - modbusLastRxUs) >= modbusGapUs;
+}
+
+void SC16IS7xxPort::updateModbusWaitMs(uint32_t now, system_tick_t &waitMs) const {
+    if (!modbusEnabled || !readBuffer || readBuffer->availableToRead() == 0) {
+        return;
+    }
+    int32_t remainingUs = (int32_t)(modbusLastRxUs + modbusGapUs - now);
+    system_tick_t ms = (remainingUs > 0) ? (system_tick_t)(remainingUs / 1000) + 1 : 1;
+    if (ms < waitMs) {
+        waitMs = ms;
+    }
+}
+
+size_t SC16IS7xxPort::fifoReadCount() const {
+    // The FIFO reads were split at the end of the first buffer region and at readInternalMax()
+    size_t maxRead = interface->readInternalMax();
+    size_t firstCount = (rxBytesRead < rxFirstRegionSize) ? rxBytesRead : rxFirstRegionSize;
+    return (firstCount + maxRead - 1) / maxRead + (rxBytesRead - firstCount + maxRead - 1) / maxRead;
+}
+
+size_t SC16IS7xxPort::readFifoMultidrop() {
+    if (rxRemaining == 0) {
+        return 0;
+    }
+
+    if ((rxLineStatus & 0x80) == 0) {
+        // LSR[7] = 0, so there are no address bytes in the FIFO
+        if (multidropMatched) {
+            // Data for this address, read directly into the buffer. The worker batch has already been executed.
+            SC16IS7xxBatch &batch = interface->workerBatch;
+            batch.clear();
+            addReadFifoDataToBatch(batch);
+            interface->execute(batch);
+            return fifoReadCount();
+        }
+        else {
+            // Data for another address that arrived before the receiver was disabled
+            uint8_t discard[64];
+            size_t count = rxRemaining;
+            size_t fifoReads = 0;
+            while(count > 0) {
+                size_t chunk = (count < interface->readInternalMax()) ? count : interface->readInternalMax();
+                if (!interface->readInternal(channel, discard, chunk)) {
+                    break;
+                }
+                count -= chunk;
+                fifoReads++;
+            }
+            rxRemaining = (uint8_t)count;
+            return fifoReads;
+        }
+    }
+
+    // There are address bytes in the FIFO. LSR[2] is the address flag for the byte at the top of the FIFO,
+    // so LSR and RHR are read for each byte, up to MAX_OPS / 2 bytes per transaction. The line status
+    // is counted for each byte from those LSR reads, so only the overrun flag is kept from the first one.
+    rxLineStatus &= 0b00000010;
+
+    uint8_t *region[2];
+    size_t regionSize[2];
+    readBuffer->getWriteSpace(region[0], regionSize[0], region[1], regionSize[1]);
+    size_t space = regionSize[0] + regionSize[1];
+    rxFirstRegionSize = regionSize[0];
+    rxRegion[0] = region[0];
+    rxRegion[1] = region[1];
+
+    uint8_t pairs[SC16IS7xxBatch::MAX_OPS / 2][2];
+    size_t busOps = 0;
+    bool bufferFull = false;
+
+    while(rxRemaining > 0) {
+        size_t count = (rxRemaining < SC16IS7xxBatch::MAX_OPS / 2) ? rxRemaining : SC16IS7xxBatch::MAX_OPS / 2;
+        if (count > space - rxBytesRead) {
+            // Any byte in this transaction may be data for this address, even if it is not matched yet, 
+            // so no more bytes are read than fit in the buffer. If the buffer is full, data is left in 
+            // the FIFO, but bytes for other addresses are read one at a time until this address matches.
+            count = space - rxBytesRead;
+            if (count == 0) {
+                if (multidropMatched) {
+                    break;
+                }
+                count = 1;
+            }
+        }
+
+        SC16IS7xxBatch &batch = interface->workerBatch;
+        batch.clear();
+        for(size_t ii = 0; ii < count; ii++) {
+            batch.addReadRegister(channel, SC16IS7xxInterface::LSR_REG, &pairs[ii][0]);
+            batch.addReadRegister(channel, SC16IS7xxInterface::RHR_THR_REG, &pairs[ii][1]);
+        }
+        if (!interface->execute(batch)) {
+            break;
+        }
+        busOps += 2 * count;
+        rxRemaining -= (uint8_t)count;
+
+        for(size_t ii = 0; ii < count; ii++) {
+            uint8_t lsr = pairs[ii][0];
+            uint8_t c = pairs[ii][1];
+
+            // LSR[2] is the address flag, not a parity error
+            countLineStatus(lsr & ~0b00000100);
+
+            if ((lsr & 0b00000100) != 0) {
+                // Address byte
+                bool matched = (c == multidropAddress);
+                if (multidropMatched && !matched) {
+                    // The chip enabled the receiver when it received this port's address. Disable it 
+                    // EFCR[1] so data for other addresses is discarded until this address is received again.
+                    efcr |= 0b00000010;
+                    interface->writeRegister(channel, SC16IS7xxInterface::EFCR_REG, efcr);
+                    busOps++;
+                }
+                else
+                if (matched && (efcr & 0b00000010) != 0) {
+                    // The chip enables the receiver when it receives this address, but if the receiver was 
+                    // disabled above after this address byte was received, it must be enabled again.
+                    efcr &= ~0b00000010;
+                    interface->writeRegister(channel, SC16IS7xxInterface::EFCR_REG, efcr);
+                    busOps++;
+                }
+                multidropMatched = matched;
+            }
+            else
+            if (multidropMatched) {
+                if (rxBytesRead >= space) {
+                    // Not expected since count is limited to the free space, but never write past the buffer
+                    bufferFull = true;
+                }
+                else
+                if (rxBytesRead < regionSize[0]) {
+                    region[0][rxBytesRead++] = c;
+                }
+                else {
+                    region[1][rxBytesRead++ - regionSize[0]] = c;
+                }
+            }
+        }
+    }
+    if (bufferFull) {
+        ATOMIC_BLOCK() {
+            stats.rxBufferFull++;
+        }
+    }
+    return busOps;
+}
+
+void SC16IS7xxPort::writeBufferToFifo() {
+    size_t txAvailable = 0;
+
+    if (thrInterruptEnabled) {
+        if (!writeSpaceAvailable) {
+            // Wait for the THR interrupt
+            return;
+        }
+        writeSpaceAvailable = false;
+
+        // The THR interrupt means there are at least writeFifoInterruptLevel spaces in the TX FIFO
+        // so there's no need to read TXLVL
+        txAvailable = writeFifoInterruptLevel;
+    }
+
+    if (writeBuffer->availableToRead() == 0) {
+        // Nothing to send, don't query the chip
+        setTHRInterrupt(false);
+        return;
+    }
+
+    bool adaptivePolling = false;
+    if (interface->irqPin == PIN_INVALID && interface->adaptivePolling && txDeadlineValid) {
+        if (!isServiceDue(txDeadlineUs)) {
+            return;
+        }
+        adaptivePolling = true;
+    }
+
+    if (txAvailable == 0) {
+        txAvailable = (size_t) availableForWriteInternal();
+    }
+    size_t txSpace = txAvailable;
+    size_t fifoWrites = 0;
+
+    while(true) {
+        while(txAvailable > 0) {
+            const uint8_t *data;
+            size_t count = writeBuffer->peekContiguous(data);
+            if (count == 0) {
+                break;
+            }
+            if (count > txAvailable) {
+                count = txAvailable;
+            }
+            if (count > interface->writeInternalMax()) {
+                count = interface->writeInternalMax();
+            }
+            fifoWrites++;
+            if (!interface->writeInternal(channel, data, count)) {
+                // Failed to write, leave the data in the buffer and try again later
+                break;
+            }
+            writeBuffer->consume(count);
+            txAvailable -= count;
+        }
+        if (!thrInterruptEnabled || txAvailable > 0 || writeBuffer->availableToRead() == 0) {
+            break;
+        }
+
+        // The TX FIFO keeps draining while it's being refilled. The THR interrupt only occurs when
+        // the free space rises to writeFifoInterruptLevel, so if it's still at or above that level
+        // there won't be another interrupt. Keep filling until it's below the level.
+        size_t level = (size_t) availableForWriteInternal();
+        if (level < writeFifoInterruptLevel) {
+            break;
+        }
+        txAvailable = level;
+        txSpace += level;
+    }
+
+    ATOMIC_BLOCK() {
+        stats.txBytes += txSpace - txAvailable;
+        stats.txBusOps += fifoWrites;
+        stats.serviceCount++;
+    }
+    if (!readBuffer) {
+        // In buffered read mode the interval is measured from the RX service, which happens every time
+        recordService();
+    }
+
+    if (interface->irqPin != PIN_INVALID) {
+        // If there is more data to send, let the chip tell us when there is room in the FIFO
+        // instead of polling TXLVL.
+        setTHRInterrupt(writeBuffer->availableToRead() > 0);
+    }
+    else
+    if (interface->adaptivePolling) {
+        uint32_t now = micros();
+        ATOMIC_BLOCK() {
+            if (adaptivePolling) {
+                int32_t lateUs = (int32_t)(now - txDeadlineUs);
+                if (lateUs > pollingStats.txMaxLateUs) {
+                    pollingStats.txMaxLateUs = lateUs;
+                }
+            }
+            pollingStats.txServiceCount++;
+        }
+
+        if (writeBuffer->availableToRead() > 0) {
+            // Schedule the next refill for when the FIFO would drain to the low water mark. If the
+            // write buffer is empty, write() wakes the worker thread instead.
+            size_t fifoLevel = 64 - (txSpace - txAvailable);
+            size_t lowWater = 64 - interface->adaptivePollingFifoLevel;
+            uint32_t intervalUs = (fifoLevel > lowWater) ? (uint32_t)(fifoLevel - lowWater) * charTimeUs : 0;
+            if (intervalUs > interface->adaptivePollingMaxIntervalMs * 1000) {
+                intervalUs = interface->adaptivePollingMaxIntervalMs * 1000;
+            }
+            pollingStats.txIntervalUs = intervalUs;
+            txDeadlineUs = now + intervalUs;
+            txDeadlineValid = true;
+        }
+        else {
+            txDeadlineValid = false;
+        }
+    }
+}
+
+bool SC16IS7xxPort::isServiceDue(uint32_t deadlineUs) const {
+    // The worker thread can only sleep in 1 millisecond increments, so anything due within the
+    // next millisecond is serviced now instead of waiting another tick.
+    return (int32_t)(deadlineUs - micros()) < 1000;
+}
+
+void SC16IS7xxPort::updateNextServiceUs(uint32_t now, uint32_t &nextServiceUs) const {
+    if (readBuffer) {
+        int32_t delta = (int32_t)(rxDeadlineUs - now);
+        if (delta < (int32_t)nextServiceUs) {
+            nextServiceUs = (delta > 0) ? (uint32_t)delta : 0;
+        }
+    }
+    if (writeBuffer && txDeadlineValid) {
+        int32_t delta = (int32_t)(txDeadlineUs - now);
+        if (delta < (int32_t)nextServiceUs) {
+            nextServiceUs = (delta > 0) ? (uint32_t)delta : 0;
+        }
+    }
+}
+
+SC16IS7xxPollingStats SC16IS7xxPort::getPollingStats(bool reset) {
+    SC16IS7xxPollingStats result;
+
+    ATOMIC_BLOCK() {
+        result = pollingStats;
+        if (reset) {
+            pollingStats = SC16IS7xxPollingStats();
+        }
+    }
+    return result;
+}
+
+void SC16IS7xxPort::setTHRInterrupt(bool enable) {
+    if (enable != thrInterruptEnabled) {
+        thrInterruptEnabled = enable;
+        if (enable) {
+            ier |= 0b00000010;
+        }
+        else {
+            ier &= ~0b00000010;
+            writeSpaceAvailable = false;
+        }
+        interface->writeRegister(channel, SC16IS7xxInterface::IER_REG, ier);
+    }
+}
+
+int SC16IS7xxPort::read() {    
+	if (hasPeek) {
+		hasPeek = false;
+		return peekByte;
+	}
+	else {
+        if (!readBuffer) {
+            if (available()) {
+                ATOMIC_BLOCK() {
+                    stats.rxBytes++;
+                    stats.rxBusOps++;
+                }
+                return interface->readRegister(channel, SC16IS7xxInterface::RHR_THR_REG);
+            }
+            else {
+                return -1;
+            }
+        }
+        else {
+            lineScanned = 0;
+            return readBuffer->read();
+        }
+	}
+}
+
+int SC16IS7xxPort::peek() {
+    if (readBuffer) {
+        // The buffer supports peek directly so hasPeek is not used in buffered read mode
+        return readBuffer->peek();
+    }
+	if (!hasPeek) {
+		peekByte = read();
+		hasPeek = true;
+	}
+	return peekByte;
+}
+
+void SC16IS7xxPort::flush() {
+    if (writeBuffer) {
+        while(writeBuffer->availableToRead() > 0) {
+            delay(1);
+        }
+    }
+    if (rs485) {
+        flushRS485();
+        return;
+    }
+	while(availableForWriteInternal() < 64) {
+		delay(1);
+	}
+}
+
+void SC16IS7xxPort::flushRS485() {
+    // Sleep while all but the last character in the TX FIFO is sent
+    int txLevel = availableForWriteInternal();
+    if (txLevel < 63) {
+        uint32_t waitUs = (uint32_t)(63 - txLevel) * charTimeUs;
+        if (waitUs >= 1000) {
+            delay(waitUs / 1000);
+        }
+    }
+
+    // TXLVL is 64 as soon as the last character moves to the transmit shift register, so poll
+    // LSR[6] (THR and TSR empty) at half character intervals instead
+    uint32_t busyUs = micros();
+    while(true) {
+        uint32_t pollUs = micros();
+        uint8_t lsr = interface->readRegister(channel, SC16IS7xxInterface::LSR_REG);
+        ATOMIC_BLOCK() {
+            stats.txBusOps++;
+        }
+        // Reading LSR clears the error bits, so count them here
+        countLineStatus(lsr);
+        if ((lsr & 0x40) != 0) {
+            break;
+        }
+        busyUs = pollUs;
+        delayMicroseconds(charTimeUs / 2);
+    }
+
+    if (!multidrop && (efcr & 0b00000010) != 0) {
+        // Enable the receiver EFCR[1]
+        efcr &= ~0b00000010;
+        interface->writeRegister(channel, SC16IS7xxInterface::EFCR_REG, efcr);
+    }
+
+    turnaroundUs = micros() - busyUs;
+}
+
+void SC16IS7xxPort::rs485BeforeWrite() {
+    // In multidrop mode EFCR[1] is used for address matching
+    if (rs485SuppressEcho && !multidrop && (efcr & 0b00000010) == 0) {
+        // Disable the receiver EFCR[1] until flush()
+        efcr |= 0b00000010;
+        interface->writeRegister(channel, SC16IS7xxInterface::EFCR_REG, efcr);
+    }
+}
+
+bool SC16IS7xxPort::writeModbusFrame(const uint8_t *frame, size_t size) {
+    if (size == 0 || size > MODBUS_MAX_FRAME - 2) {
+        return false;
+    }
+
+    // The frame must be sent without gaps, so it's written with the CRC in one write()
+    uint8_t buf[MODBUS_MAX_FRAME];
+    memcpy(buf, frame, size);
+    uint16_t crc = modbusCRC16(frame, size);
+    buf[size++] = (uint8_t)(crc & 0xff);
+    buf[size++] = (uint8_t)(crc >> 8);
+
+    // Wait for the inter-frame silence after the last frame sent or received. modbusLastRxUs is 
+    // updated by the worker thread, so check again after waiting in case more data arrived.
+    while(true) {
+        uint32_t now = micros();
+        uint32_t lastUs = ((int32_t)(modbusLastRxUs - modbusTxEndUs) > 0) ? modbusLastRxUs : modbusTxEndUs;
+        int32_t waitUs = (int32_t)(lastUs + modbusGapUs - now);
+        if (waitUs <= 0) {
+            break;
+        }
+        if (waitUs >= 1000) {
+            delay(waitUs / 1000);
+        }
+        else {
+            delayMicroseconds(waitUs);
+        }
+    }
+
+    bool result = (write(buf, size) == size);
+
+    if (rs485) {
+        // Waits until the last character has been sent and enables the receiver for the response
+        flush();
+        modbusTxEndUs = micros();
+    }
+    else {
+        // write() returns when the frame is in the TX FIFO or write buffer, behind any data that was 
+        // already queued. The write buffer is checked before TXLVL so bytes the worker thread moves 
+        // between them are counted twice rather than not at all, and 1 is added for the character 
+        // in the transmit shift register, which TXLVL does not include.
+        size_t queued = writeBuffer ? writeBuffer->availableToRead() : 0;
+        int txLevel = availableForWriteInternal();
+        if (txLevel <= 64) {
+            queued += 64 - txLevel;
+        }
+        modbusTxEndUs = micros() + (uint32_t)(queued + 1) * charTimeUs;
+    }
+    return result;
+}
+
+// [static]
+uint16_t SC16IS7xxPort::modbusCRC16(const uint8_t *data, size_t size, uint16_t crc) {
+    static const uint16_t table[256] = {
+    0x0000, 0xc0c1, 0xc181, 0x0140, 0xc301, 0x03c0, 0x0280, 0xc241,
+    0xc601, 0x06c0, 0x0780, 0xc741, 0x0500, 0xc5c1, 0xc481, 0x0440,
+    0xcc01, 0x0cc0, 0x0d80, 0xcd41, 0x0f00, 0xcfc1, 0xce81, 0x0e40,
+    0x0a00, 0xcac1, 0xcb81, 0x0b40, 0xc901, 0x09c0, 0x0880, 0xc841,
+    0xd801, 0x18c0, 0x1980, 0xd941, 0x1b00, 0xdbc1, 0xda81, 0x1a40,
+    0x1e00, 0xdec1, 0xdf81, 0x1f40, 0xdd01, 0x1dc0, 0x1c80, 0xdc41,
+    0x1400, 0xd4c1, 0xd581, 0x1540, 0xd701, 0x17c0, 0x1680, 0xd641,
+    0xd201, 0x12c0, 0x1380, 0xd341, 0x1100, 0xd1c1, 0xd081, 0x1040,
+    0xf001, 0x30c0, 0x3180, 0xf141, 0x3300, 0xf3c1, 0xf281, 0x3240,
+    0x3600, 0xf6c1, 0xf781, 0x3740, 0xf501, 0x35c0, 0x3480, 0xf441,
+    0x3c00, 0xfcc1, 0xfd81, 0x3d40, 0xff01, 0x3fc0, 0x3e80, 0xfe41,
+    0xfa01, 0x3ac0, 0x3b80, 0xfb41, 0x3900, 0xf9c1, 0xf881, 0x3840,
+    0x2800, 0xe8c1, 0xe981, 0x2940, 0xeb01, 0x2bc0, 0x2a80, 0xea41,
+    0xee01, 0x2ec0, 0x2f80, 0xef41, 0x2d00, 0xedc1, 0xec81, 0x2c40,
+    0xe401, 0x24c0, 0x2580, 0xe541, 0x2700, 0xe7c1, 0xe681, 0x2640,
+    0x2200, 0xe2c1, 0xe381, 0x2340, 0xe101, 0x21c0, 0x2080, 0xe041,
+    0xa001, 0x60c0, 0x6180, 0xa141, 0x6300, 0xa3c1, 0xa281, 0x6240,
+    0x6600, 0xa6c1, 0xa781, 0x6740, 0xa501, 0x65c0, 0x6480, 0xa441,
+    0x6c00, 0xacc1, 0xad81, 0x6d40, 0xaf01, 0x6fc0, 0x6e80, 0xae41,
+    0xaa01, 0x6ac0, 0x6b80, 0xab41, 0x6900, 0xa9c1, 0xa881, 0x6840,
+    0x7800, 0xb8c1, 0xb981, 0x7940, 0xbb01, 0x7bc0, 0x7a80, 0xba41,
+    0xbe01, 0x7ec0, 0x7f80, 0xbf41, 0x7d00, 0xbdc1, 0xbc81, 0x7c40,
+    0xb401, 0x74c0, 0x7580, 0xb541, 0x7700, 0xb7c1, 0xb681, 0x7640,
+    0x7200, 0xb2c1, 0xb381, 0x7340, 0xb101, 0x71c0, 0x7080, 0xb041,
+    0x5000, 0x90c1, 0x9181, 0x5140, 0x9301, 0x53c0, 0x5280, 0x9241,
+    0x9601, 0x56c0, 0x5780, 0x9741, 0x5500, 0x95c1, 0x9481, 0x5440,
+    0x9c01, 0x5cc0, 0x5d80, 0x9d41, 0x5f00, 0x9fc1, 0x9e81, 0x5e40,
+    0x5a00, 0x9ac1, 0x9b81, 0x5b40, 0x9901, 0x59c0, 0x5880, 0x9841,
+    0x8801, 0x48c0, 0x4980, 0x8941, 0x4b00, 0x8bc1, 0x8a81, 0x4a40,
+    0x4e00, 0x8ec1, 0x8f81, 0x4f40, 0x8d01, 0x4dc0, 0x4c80, 0x8c41,
+    0x4400, 0x84c1, 0x8581, 0x4540, 0x8701, 0x47c0, 0x4680, 0x8641,
+    0x8201, 0x42c0, 0x4380, 0x8341, 0x4100, 0x81c1, 0x8081, 0x4040
+    };
+
+    for(size_t ii = 0; ii < size; ii++) {
+        crc = (crc >> 8) ^ table[(crc ^ data[ii]) & 0xff];
+    }
+    return crc;
+}
+
+size_t SC16IS7xxPort::write(uint8_t c) {
+    if (writeBuffer) {
+        return write(&c, 1);
+    }
+    if (rs485) {
+        rs485BeforeWrite();
+    }
 
 	if (writeBlocksWhenFull) {
 		// Block until there is room in the buffer
+        uint32_t startUs = micros();
+        bool blocked = false;
 		while(availableForWrite() == 0) {
 			delay(1);
+            blocked = true;
 		}
+        if (blocked) {
+            uint32_t elapsedUs = micros() - startUs;
+            ATOMIC_BLOCK() {
+                stats.writeBlockedUs += elapsedUs;
+            }
+        }
 	}
 
 	interface->writeRegister(channel, SC16IS7xxInterface::RHR_THR_REG, c);
+    ATOMIC_BLOCK() {
+        stats.txBytes++;
+        stats.txBusOps++;
+    }
 
 	return 1;
 }
@@ -377,6 +1626,37 @@ size_t SC16IS7xxPort::write(const uint8_t *buffer, size_t size) {
 	size_t written = 0;
 	bool done = false;
 
+    if (rs485 && size > 0) {
+        rs485BeforeWrite();
+    }
+
+    if (writeBuffer) {
+        while(size > 0) {
+            size_t count = writeBuffer->write(buffer, size);
+            buffer += count;
+            size -= count;
+            written += count;
+
+            // In IRQ mode, the worker thread is only woken by the chip, so wake it so it can
+            // start sending data
+            interface->wakeWorker();
+
+            if (size > 0) {
+                if (!writeBlocksWhenFull) {
+                    break;
+                }
+                // Buffer is full, wait for the worker thread to send some data
+                uint32_t startUs = micros();
+                delay(1);
+                uint32_t elapsedUs = micros() - startUs;
+                ATOMIC_BLOCK() {
+                    stats.writeBlockedUs += elapsedUs;
+                }
+            }
+        }
+        return written;
+    }
+
 	while(size > 0 && !done) {
 		size_t count = size;
 		if (count > interface->writeInternalMax()) {
@@ -384,13 +1664,22 @@ size_t SC16IS7xxPort::write(const uint8_t *buffer, size_t size) {
 		}
 
 		if (writeBlocksWhenFull) {
+            uint32_t startUs = micros();
+            bool blocked = false;
 			while(true) {
 				int avail = availableForWrite();
 				if (count <= (size_t) avail) {
 					break;
 				}
 				delay(1);
+                blocked = true;
 			}
+            if (blocked) {
+                uint32_t elapsedUs = micros() - startUs;
+                ATOMIC_BLOCK() {
+                    stats.writeBlockedUs += elapsedUs;
+                }
+            }
 		}
 		else {
 			int avail = availableForWrite();
@@ -408,6 +1697,10 @@ size_t SC16IS7xxPort::write(const uint8_t *buffer, size_t size) {
 			// Failed to write
 			break;
 		}
+        ATOMIC_BLOCK() {
+            stats.txBytes += count;
+            stats.txBusOps++;
+        }
 		buffer += count;
 		size -= count;
 		written += count;
@@ -433,140 +1726,626 @@ int SC16IS7xxPort::read(uint8_t *buffer, size_t size) {
         if (!interface->readInternal(channel, buffer, size)) {
             return -1;
         }
+        ATOMIC_BLOCK() {
+            stats.rxBytes += size;
+            stats.rxBusOps++;
+        }
     	return (int) size;
     }
     else {
+        lineScanned = 0;
         return readBuffer->read(buffer, size);
     }
 }
 
+int SC16IS7xxPort::peek(uint8_t *buffer, size_t size) {
+    if (readBuffer) {
+        return readBuffer->peek(buffer, size);
+    }
+    else {
+        return -1;
+    }
+}
+
+size_t SC16IS7xxPort::peekContiguous(const uint8_t *&data) {
+    if (readBuffer) {
+        return readBuffer->peekContiguous(data);
+    }
+    else {
+        data = nullptr;
+        return 0;
+    }
+}
 
-void SC16IS7xxPort::handleIIR() {
-    uint8_t iir = interface->readRegister(channel, SC16IS7xxInterface::FCR_IIR_REG) & 0x3f;
+size_t SC16IS7xxPort::consume(size_t count) {
+    if (readBuffer) {
+        lineScanned = 0;
+        return readBuffer->consume(count);
+    }
+    else {
+        return 0;
+    }
+}
 
-    const char *reason = "unknown";
+bool SC16IS7xxPort::findLine(uint8_t delimiter, size_t maxLength, size_t &length, bool &delimited) {
+    if (delimiter != lineScanDelimiter) {
+        lineScanDelimiter = delimiter;
+        lineScanned = 0;
+    }
 
-    switch(iir) {
-        case 0b000110:
-            if (interruptLineStatus) {
-                interruptLineStatus();
-            }
-            reason = "line status";
+    // Search up to maxLength + 1 bytes so a line of exactly maxLength bytes and its delimiter is found.
+    // Only the bytes that arrived since the last call are searched.
+    size_t avail = readBuffer->availableToRead();
+    size_t limit = (avail < maxLength + 1) ? avail : maxLength + 1;
+    int index = readBuffer->find(delimiter, lineScanned, limit);
+    if (index >= 0) {
+        length = (size_t)index + 1;
+        delimited = true;
+        lineScanned = 0;
+        return true;
+    }
+    if (avail > maxLength || (avail > 0 && avail >= readBuffer->capacity())) {
+        // Too long, return a piece of maxLength bytes. If maxLength is not smaller than the read buffer, a full
+        // buffer without a delimiter is returned instead, because no more data can be added until it is read.
+        length = (avail < maxLength) ? avail : maxLength;
+        delimited = false;
+        lineScanned = 0;
+        return true;
+    }
+    lineScanned = limit;
+    return false;
+}
+
+int SC16IS7xxPort::readLine(char *buffer, size_t size, char delimiter) {
+    size_t length;
+    bool delimited;
+
+    if (!readBuffer || size < 2 || !findLine((uint8_t)delimiter, size - 1, length, delimited)) {
+        return -1;
+    }
+
+    // length is at most size bytes, including the delimiter, which is replaced by the null terminator
+    readBuffer->read((uint8_t *)buffer, length);
+    if (delimited) {
+        length--;
+    }
+    buffer[length] = 0;
+    return (int)length;
+}
+
+SC16IS7xxPort &SC16IS7xxPort::onLine(std::function<void(const char *line, size_t length)> handler, size_t maxLength, char delimiter) {
+    if (lineBuffer) {
+        delete[] lineBuffer;
+    }
+    lineBuffer = new char[maxLength + 1];
+    lineMaxLength = lineBuffer ? maxLength : 0;
+    lineDelimiter = delimiter;
+    lineHandler = handler;
+    return *this;
+}
+
+size_t SC16IS7xxPort::processLines() {
+    size_t lines = 0;
+    size_t length;
+    bool delimited;
+
+    if (!readBuffer || !lineHandler || lineMaxLength == 0) {
+        return 0;
+    }
+
+    while(findLine((uint8_t)lineDelimiter, lineMaxLength, length, delimited)) {
+        size_t lineLength = delimited ? length - 1 : length;
+
+        const uint8_t *data;
+        size_t contiguous = readBuffer->peekContiguous(data);
+        if (delimited && contiguous >= length) {
+            // The whole line is contiguous, so replace the delimiter with a null terminator in place. The 
+            // producer never modifies data that has not been consumed, so the consumer can.
+            char *line = (char *)const_cast<uint8_t *>(data);
+            line[lineLength] = 0;
+            lineHandler(line, lineLength);
+            readBuffer->consume(length);
+        }
+        else {
+            // Wraps around the end of the read buffer, or a piece of a long line
+            readBuffer->read((uint8_t *)lineBuffer, length);
+            lineBuffer[lineLength] = 0;
+            lineHandler(lineBuffer, lineLength);
+        }
+        lines++;
+    }
+    return lines;
+}
+
+
+void SC16IS7xxPort::handleIIR() {
+    // IIR only reports the highest priority pending interrupt. Keep reading it until IIR[0] = 1 
+    // (no interrupt pending) so all pending sources are handled during this wakeup. Each handler 
+    // must clear its source (by reading data, LSR, etc.) or the same source is reported again,
+    // so the number of iterations is limited.
+    size_t causes = 0;
+
+    while(causes < IIR_MAX_CAUSES_PER_IRQ) {
+        uint8_t iir = interface->readRegister(channel, SC16IS7xxInterface::FCR_IIR_REG) & 0x3f;
+        if ((iir & 0x01) != 0) {
+            // No interrupt pending
             break;
+        }
+        causes++;
+
+        const char *reason = "unknown";
+
+        switch(iir) {
+            case 0b000110:
+                // Reading LSR clears the line status interrupt
+                lineStatus = interface->readRegister(channel, SC16IS7xxInterface::LSR_REG);
+                countLineStatus(lineStatus);
+                if (interruptLineStatus) {
+                    interruptLineStatus();
+                }
+                reason = "line status";
+                break;
+
+            case 0b001100:
+                if (interruptRxTimeout) {
+                    interruptRxTimeout();
+                }
+                reason = "rx timeout";
+                break;
+
+            case 0b000100:
+                if (interruptRHR) {
+                    interruptRHR();
+                }
+                reason = "RHR";
+                break;
+
+            case 0b000010:
+                if (interruptTHR) {
+                    interruptTHR();
+                }
+                reason = "THR";
+                break;
+
+            case 0b000000:
+                if (interruptModemStatus) {
+                    interruptModemStatus();
+                }
+                reason = "modem status";
+                break;
+
+            case 0b110000:
+                if (interruptIO) {
+                    interruptIO();
+                }
+                reason = "IO";
+                break;
+
+            case 0b010000:
+                if (interruptXoff) {
+                    interruptXoff();
+                }
+                reason = "Xoff";
+                break;
+
+            case 0b100000:
+                if (interruptCTS_RTS) {
+                    interruptCTS_RTS();
+                }
+                reason = "CTS RTS";
+                break;
+
+            default:
+                break;
+
+        }
 
-        case 0b001100:
-            if (interruptRxTimeout) {
-                interruptRxTimeout();
+        SC16IS7XX_TRACE_BUS(SC16IS7xxEventRing::EVENT_IIR, channel, SC16IS7xxInterface::FCR_IIR_REG, iir, 
+            "handleIIR %s (0x%02x)", reason, iir);
+        (void) reason; // Only used when SC16IS7XX_TRACE_LEVEL is SC16IS7XX_TRACE_LOG
+    }
+
+    if (causes > 0) {
+        ATOMIC_BLOCK() {
+            irqStats.wakeups++;
+            irqStats.causes += causes;
+            irqStats.causesPerWakeup[causes - 1]++;
+            if (causes > irqStats.maxCausesPerWakeup) {
+                irqStats.maxCausesPerWakeup = (uint8_t) causes;
             }
-            reason = "rx timeout";
-            break;
+            if (causes == IIR_MAX_CAUSES_PER_IRQ) {
+                irqStats.limitReached++;
+            }
+        }
+    }
+}
+
+SC16IS7xxPortStats SC16IS7xxPort::getStats(bool reset) {
+    SC16IS7xxPortStats result;
+
+    ATOMIC_BLOCK() {
+        result = stats;
+        if (reset) {
+            stats = SC16IS7xxPortStats();
+        }
+    }
+    return result;
+}
+
+SC16IS7xxPortHistograms SC16IS7xxPort::getHistograms(bool reset) {
+    SC16IS7xxPortHistograms result;
+
+    ATOMIC_BLOCK() {
+        result = histograms;
+        if (reset) {
+            histograms = SC16IS7xxPortHistograms();
+        }
+    }
+    return result;
+}
+
+void SC16IS7xxPort::recordService() {
+    if (!interface->histogramsEnabled) {
+        return;
+    }
+    uint32_t now = micros();
+    ATOMIC_BLOCK() {
+        if (lastServiceValid) {
+            histograms.serviceIntervalUs.add(now - lastServiceUs);
+        }
+        lastServiceUs = now;
+        lastServiceValid = true;
+    }
+}
+
+void SC16IS7xxPort::countLineStatus(uint8_t lsr) {
+    if ((lsr & 0b00011110) == 0) {
+        // No errors (the common case)
+        return;
+    }
+    ATOMIC_BLOCK() {
+        if ((lsr & 0b00000010) != 0) {
+            stats.lsrOverrun++;
+        }
+        if ((lsr & 0b00000100) != 0) {
+            stats.lsrParity++;
+        }
+        if ((lsr & 0b00001000) != 0) {
+            stats.lsrFraming++;
+        }
+        if ((lsr & 0b00010000) != 0) {
+            stats.lsrBreak++;
+        }
+    }
+}
+
+SC16IS7xxIrqStats SC16IS7xxPort::getIrqStats(bool reset) {
+    SC16IS7xxIrqStats result;
+
+    ATOMIC_BLOCK() {
+        result = irqStats;
+        if (reset) {
+            irqStats = SC16IS7xxIrqStats();
+        }
+    }
+    return result;
+}
+
+
+SC16IS7xxInterface &SC16IS7xxInterface::withI2C(TwoWire *wire, uint8_t addr) {
+    this->wire = wire;
+    this->i2cAddr = addr;
+    if (this->i2cAddr < 0x10) {
+        this->i2cAddr += 0x48;
+    }
+    this->spi = nullptr;
+
+    wire->begin();
+
+    return *this;
+}
+
+SC16IS7xxInterface &SC16IS7xxInterface::withI2CBufferSize(size_t bufferSize) {
+    if (bufferSize < 2) {
+        bufferSize = 2;
+    }
+    i2cBufferSize = bufferSize;
+    return *this;
+}
+
+SC16IS7xxInterface &SC16IS7xxInterface::withSPI(SPIClass *spi, pin_t csPin, size_t speedMHz) {
+    this->wire = nullptr;
+    this->spi = spi;
+    this->csPin = csPin;
+    // The SC16IS7xx all require MSBFIRST  and MODE0, so 
+    this->spiSettings = SPISettings(speedMHz*MHZ, MSBFIRST, SPI_MODE0);
+
+    spi->begin(csPin);
+
+    pinMode(this->csPin, OUTPUT);
+    digitalWrite(this->csPin, HIGH);
+
+    return *this;
+}
+
+
+SC16IS7xxInterface &SC16IS7xxInterface::withIRQ(pin_t _irqPin, PinMode mode) { 
+    irqPin = _irqPin;
+
+    // mode defaults to INPUT_PULLUP but you could set it to INPUT instead.
+    pinMode(irqPin, mode);
+
+    // The ISR only wakes the worker thread, since I2C and SPI transactions cannot be done from an ISR.
+    // The worker thread blocks on this semaphore instead of waking up every millisecond.
+    if (!workerSemaphore) {
+        os_semaphore_create(&workerSemaphore, 1, 0);
+    }
+    attachInterrupt(irqPin, &SC16IS7xxInterface::irqHandler, this, FALLING);
+
+    registerThreadFunction([this]() {
+        // This is called from the worker thread after the ISR wakes it, or the idle timeout expires
+        if (pinReadFast(irqPin) == LOW) {
+            // Interrupt triggered
+            // _uartLogger.trace("irqPin LOW");
+
+            forEachPort([](SC16IS7xxPort *port) {
+                // Each port has to check the IIR register
+                port->handleIIR();
+            });
+
+        }
+    });
+
+
+    return *this; 
+}
+
+
+SC16IS7xxInterface &SC16IS7xxInterface::withAdaptivePolling(uint8_t fifoLevel, system_tick_t maxIntervalMs) {
+    if (fifoLevel < 1) {
+        fifoLevel = 1;
+    }
+    if (fifoLevel > 63) {
+        fifoLevel = 63;
+    }
+    adaptivePolling = true;
+    adaptivePollingFifoLevel = fifoLevel;
+    adaptivePollingMaxIntervalMs = maxIntervalMs;
+
+    if (!workerSemaphore) {
+        os_semaphore_create(&workerSemaphore, 1, 0);
+    }
+
+    return *this;
+}
+
+#ifndef DOXYGEN_DO_NOT_DOCUMENT
+// The SPI DMA completion callback has no context parameter, so there is one callback per SPI bus. 
+// Interfaces sharing a bus share a slot, which is safe because the bus is locked during the transfer.
+typedef struct {
+    SPIClass *spi;
+    os_semaphore_t semaphore;
+} SpiDmaSlot;
 
-        case 0b000100:
-            if (interruptRHR) {
-                interruptRHR();
-            }
-            reason = "RHR";
-            break;
+static SpiDmaSlot spiDmaSlots[SC16IS7xxInterface::SPI_DMA_MAX_BUSES];
 
-        case 0b000010:
-            if (interruptTHR) {
-                interruptTHR();
-            }
-            reason = "THR";
-            break;
+static void spiDmaCallback0() {
+    os_semaphore_give(spiDmaSlots[0].semaphore, false);
+}
+static void spiDmaCallback1() {
+    os_semaphore_give(spiDmaSlots[1].semaphore, false);
+}
+static const wiring_spi_dma_transfercomplete_callback_t spiDmaCallbacks[SC16IS7xxInterface::SPI_DMA_MAX_BUSES] = {
+    spiDmaCallback0, spiDmaCallback1
+};
+#endif // DOXYGEN_DO_NOT_DOCUMENT
 
-        case 0b000000:
-            if (interruptModemStatus) {
-                interruptModemStatus();
-            }
-            reason = "modem status";
-            break;
+SC16IS7xxInterface &SC16IS7xxInterface::withSpiDma(size_t minSize) {
+    if (!spi) {
+        _uartLogger.info("withSpiDma requires withSPI");
+        return *this;
+    }
 
-        case 0b110000:
-            if (interruptIO) {
-                interruptIO();
+    for(size_t ii = 0; ii < SPI_DMA_MAX_BUSES; ii++) {
+        if (spiDmaSlots[ii].spi == spi || spiDmaSlots[ii].spi == nullptr) {
+            if (!spiDmaSlots[ii].semaphore) {
+                os_semaphore_create(&spiDmaSlots[ii].semaphore, 1, 0);
             }
-            reason = "IO";
+            spiDmaSlots[ii].spi = spi;
+            spiDmaSlot = (int)ii;
             break;
+        }
+    }
+    if (spiDmaSlot < 0) {
+        _uartLogger.error("withSpiDma too many SPI buses");
+    }
+    spiDmaMinSize = (minSize > 0) ? minSize : 1;
 
-        case 0b010000:
-            if (interruptXoff) {
-                interruptXoff();
-            }
-            reason = "Xoff";
-            break;
+    return *this;
+}
 
-        case 0b100000:
-            if (interruptCTS_RTS) {
-                interruptCTS_RTS();
-            }
-            reason = "CTS RTS";
-            break;
+bool SC16IS7xxInterface::readFifoSpiDma(uint8_t channel, uint8_t *buffer, size_t size) {
+    os_semaphore_t semaphore = spiDmaSlots[spiDmaSlot].semaphore;
 
-        default:
-            break;
+    // Clear a give left over from a transfer that timed out
+    os_semaphore_take(semaphore, 0, false);
 
+    // bit 7 (0x80) = read
+    pinResetFast(csPin);
+    spi->transfer(0x80 | RHR_THR_REG << 3 | channel << 1);
+    spi->transfer(NULL, buffer, size, spiDmaCallbacks[spiDmaSlot]);
+
+    // Other threads run while the DMA transfer is in progress
+    bool result = (os_semaphore_take(semaphore, SPI_DMA_TIMEOUT_MS, false) == 0);
+    if (!result) {
+        spi->transferCancel();
+        _uartLogger.error("readFifoSpiDma timeout size=%u", size);
     }
+    pinSetFast(csPin);
 
-    _uartLogger.trace("handleIIR %s (0x%02x)", reason, iir);
+    SC16IS7XX_TRACE_BUS(result ? SC16IS7xxEventRing::EVENT_READ_FIFO : SC16IS7xxEventRing::EVENT_ERROR, channel, 
+        RHR_THR_REG, size, "readInternal %d bytes (DMA)", size);
 
+	return result;
 }
 
-
-SC16IS7xxInterface &SC16IS7xxInterface::withI2C(TwoWire *wire, uint8_t addr) {
-    this->wire = wire;
-    this->i2cAddr = addr;
-    if (this->i2cAddr < 0x10) {
-        this->i2cAddr += 0x48;
+SC16IS7xxInterface &SC16IS7xxInterface::withShadowRegisters(bool enable) {
+    beginTransaction();
+    shadowEnabled = enable;
+    for(size_t ii = 0; ii < SHADOW_MAX_CHANNELS; ii++) {
+        shadowValid[ii] = 0;
     }
-    this->spi = nullptr;
+    endTransaction();
 
-    wire->begin();
+    return *this;
+}
 
+SC16IS7xxInterface &SC16IS7xxInterface::withHistograms(bool enable) {
+    ATOMIC_BLOCK() {
+        busBusyUs = 0;
+        busWindowStartUs = micros();
+    }
+    histogramsEnabled = enable;
     return *this;
 }
 
-SC16IS7xxInterface &SC16IS7xxInterface::withSPI(SPIClass *spi, pin_t csPin, size_t speedMHz) {
-    this->wire = nullptr;
-    this->spi = spi;
-    this->csPin = csPin;
-    // The SC16IS7xx all require MSBFIRST  and MODE0, so 
-    this->spiSettings = SPISettings(speedMHz*MHZ, MSBFIRST, SPI_MODE0);
+SC16IS7xxHistogram SC16IS7xxInterface::getBusOpHistogram(bool reset) {
+    SC16IS7xxHistogram result;
 
-    spi->begin(csPin);
+    ATOMIC_BLOCK() {
+        result = busOpHistogram;
+        if (reset) {
+            busOpHistogram = SC16IS7xxHistogram();
+        }
+    }
+    return result;
+}
 
-    pinMode(this->csPin, OUTPUT);
-    digitalWrite(this->csPin, HIGH);
+float SC16IS7xxInterface::getBusUtilization(bool reset) {
+    uint64_t busyUs;
+    uint32_t elapsedUs;
+    uint32_t now = micros();
+
+    ATOMIC_BLOCK() {
+        busyUs = busBusyUs;
+        elapsedUs = now - busWindowStartUs;
+        if (reset) {
+            busBusyUs = 0;
+            busWindowStartUs = now;
+        }
+    }
+    if (elapsedUs == 0) {
+        return 0.0;
+    }
+    return (float)busyUs * 100.0 / (float)elapsedUs;
+}
+
+void SC16IS7xxInterface::recordBusOp(uint32_t durationUs) {
+    ATOMIC_BLOCK() {
+        busOpHistogram.add(durationUs);
+    }
+}
+
+void SC16IS7xxInterface::recordBusBusy(uint32_t durationUs) {
+    ATOMIC_BLOCK() {
+        busBusyUs += durationUs;
+    }
+}
 
+SC16IS7xxInterface &SC16IS7xxInterface::withShadowVerify(system_tick_t intervalMs) {
+    shadowVerifyIntervalMs = intervalMs;
     return *this;
 }
 
+void SC16IS7xxInterface::invalidateShadowRegisters() {
+    beginTransaction();
+    for(size_t ii = 0; ii < SHADOW_MAX_CHANNELS; ii++) {
+        shadowValid[ii] = 0;
+    }
+    endTransaction();
+}
+
+bool SC16IS7xxInterface::verifyShadowRegisters() {
+    // Register number and register set (0 = general, 1 = special, 2 = enhanced) for each SHADOW_ index
+    static const uint8_t shadowRegs[SHADOW_NUM_REGS][2] = {
+        { IER_REG, 0 }, { LCR_REG, 0 }, { MCR_REG, 0 }, { TCR_REG, 0 }, { TLR_REG, 0 }, { SPR_REG, 0 },
+        { IODIR_REG, 0 }, { IOINTENA_REG, 0 }, { EFCR_REG, 0 }, { DLL_REG, 1 }, { DLH_REG, 1 },
+        { EFR_REG, 2 }, { XON1_REG, 2 }, { XON2_REG, 2 }, { XOFF1_REG, 2 }, { XOFF2_REG, 2 }
+    };
+    bool good = true;
 
-SC16IS7xxInterface &SC16IS7xxInterface::withIRQ(pin_t _irqPin, PinMode mode) { 
-    irqPin = _irqPin;
+    beginTransaction();
 
-    // mode defaults to INPUT_PULLUP but you could set it to INPUT instead.
-    pinMode(irqPin, mode);
+    for(uint8_t channel = 0; channel < SHADOW_MAX_CHANNELS; channel++) {
+        if (shadowValid[channel] == 0) {
+            continue;
+        }
 
-    registerThreadFunction([this]() {
-        // This is called 1000 times per second from the worker thread
-        if (pinReadFast(irqPin) == LOW) {
-            // Interrupt triggered
-            // _uartLogger.trace("irqPin LOW");
+        uint8_t lcrValue;
+        if (!readRegisterUncached(channel, LCR_REG, lcrValue)) {
+            good = false;
+            continue;
+        }
+        if (isShadowValid(channel, SHADOW_LCR) && shadowValues[channel][SHADOW_LCR] != lcrValue) {
+            // If LCR is wrong, the cache may have been filled from the wrong register set
+            _uartLogger.error("shadow register mismatch chan=%d LCR shadow=0x%02x chip=0x%02x", 
+                channel, shadowValues[channel][SHADOW_LCR], lcrValue);
+            shadowValid[channel] = 0;
+            good = false;
+            continue;
+        }
 
-            forEachPort([](SC16IS7xxPort *port) {
-                // Each port has to check the IIR register
-                port->handleIIR();
-            });
+        // TCR and TLR replace MSR and SPR when MCR[2] = 1 and EFR[4] = 1
+        bool tcrTlr = isShadowValid(channel, SHADOW_EFR) && isShadowValid(channel, SHADOW_MCR) &&
+            (shadowValues[channel][SHADOW_EFR] & 0x10) != 0 && (shadowValues[channel][SHADOW_MCR] & 0x04) != 0;
+
+        // Keep the word length, parity, and stop bits when switching register sets, except for the enhanced
+        // set which requires exactly 0xBF
+        uint8_t setLcr[3];
+        setLcr[0] = lcrValue & ~LCR_SPECIAL_ENABLE_DIVISOR_LATCH;
+        setLcr[1] = setLcr[0] | LCR_SPECIAL_ENABLE_DIVISOR_LATCH;
+        if (setLcr[1] == LCR_ENABLE_ENHANCED_FEATURE_REG) {
+            setLcr[1] = LCR_SPECIAL_ENABLE_DIVISOR_LATCH;
+        }
+        setLcr[2] = LCR_ENABLE_ENHANCED_FEATURE_REG;
+
+        for(uint8_t set = 0; set < 3; set++) {
+            bool lcrChanged = false;
 
+            for(uint8_t index = 0; index < SHADOW_NUM_REGS; index++) {
+                if (shadowRegs[index][1] != set || index == SHADOW_LCR || !isShadowValid(channel, index)) {
+                    continue;
+                }
+                if ((index == SHADOW_TCR || index == SHADOW_TLR) && !tcrTlr) {
+                    continue;
+                }
+                if (index == SHADOW_SPR && tcrTlr) {
+                    continue;
+                }
+                if (!lcrChanged && setLcr[set] != lcrValue) {
+                    writeRegisterUncached(channel, LCR_REG, setLcr[set]);
+                }
+                lcrChanged = true;
+
+                uint8_t value;
+                if (readRegisterUncached(channel, shadowRegs[index][0], value) && value != shadowValues[channel][index]) {
+                    _uartLogger.error("shadow register mismatch chan=%d reg=%d set=%d shadow=0x%02x chip=0x%02x", 
+                        channel, shadowRegs[index][0], set, shadowValues[channel][index], value);
+                    shadowValid[channel] &= ~(1 << index);
+                    good = false;
+                }
+            }
+            if (lcrChanged && setLcr[set] != lcrValue) {
+                writeRegisterUncached(channel, LCR_REG, lcrValue);
+            }
         }
-    });
+    }
 
+    endTransaction();
 
-    return *this; 
+    return good;
 }
 
-
 SC16IS7xxInterface &SC16IS7xxInterface::softwareReset() {
     writeRegister(0, SC16IS7xxInterface::IOCONTROL_REG, 0x08); // Bit 3 = SRESET
     return *this;
@@ -589,6 +2368,9 @@ const size_t numExpectedRegisters = sizeof(expectedRegisters) / sizeof(expectedR
 
 bool SC16IS7xxInterface::powerOnCheck() {
     bool good = true;
+
+    // The registers are checked on the chip, and the chip may have been reset since they were cached
+    invalidateShadowRegisters();
     
     for(size_t ii = 0; ii < numExpectedRegisters; ii++) {
         uint8_t value = readRegister(0, expectedRegisters[ii].reg);
@@ -609,234 +2391,374 @@ bool SC16IS7xxInterface::powerOnCheck() {
 
 void SC16IS7xxInterface::beginTransaction() {
     if (spi) {
-        spi->beginTransaction(spiSettings);
-        pinResetFast(csPin);
+        SC16IS7xxSpiTransport::beginTransaction(*this);
     }
     else 
     if (wire) {
-        wire->lock();
+        SC16IS7xxI2CTransport::beginTransaction(*this);
     }
 }
 
 void SC16IS7xxInterface::endTransaction() {
     if (spi) {
-        pinSetFast(csPin);
-        spi->endTransaction();
+        SC16IS7xxSpiTransport::endTransaction(*this);
     }
     else 
     if (wire) {
-        wire->unlock();
+        SC16IS7xxI2CTransport::endTransaction(*this);
     }
-
 }
 
 
-
-
 // Note: reg is the register 0 - 15, not the shifted value with the channel select bits. Channel is always 0
 // on the SC16IS7xxInterface.
 uint8_t SC16IS7xxInterface::readRegister(uint8_t channel, uint8_t reg) {
-    uint8_t value = 0;
-
-    beginTransaction();
-
     if (spi) {
-        spi->transfer(0x80 | reg << 3 | channel << 1);
-        value = (uint8_t) spi->transfer(0);
-
-        endTransaction();
+        return readRegisterT<SC16IS7xxSpiTransport>(channel, reg);
     }
     else
     if (wire) {
-
-        wire->beginTransmission(i2cAddr);
-        wire->write(reg << 3 | channel << 1);
-        wire->endTransmission(false);
-
-        wire->requestFrom(i2cAddr, 1, true);
-        value = (uint8_t) wire->read();
-    }
-
-    switch(reg) {
-        case RXLVL_REG:
-        case TXLVL_REG:
-            // Don't log these because they're called continuously
-            break;
-
-        default:
-        	_uartLogger.trace("readRegister chan=%d reg=%d value=%d", channel, reg, value);
-            break;
+        return readRegisterT<SC16IS7xxI2CTransport>(channel, reg);
     }
-
-    endTransaction();
-
-	return value;
+	return 0;
 }
 
 // Note: reg is the register 0 - 15, not the shifted value with the channel select bits
 bool SC16IS7xxInterface::writeRegister(uint8_t channel, uint8_t reg, uint8_t value) {
-    bool result = false;
-
-    beginTransaction();
-
     if (spi) {
-        spi->transfer(reg << 3 | channel << 1);
-        spi->transfer(value);
-
-        _uartLogger.trace("writeRegister chan=%d reg=%d value=%d", channel, reg, value);
+        return writeRegisterT<SC16IS7xxSpiTransport>(channel, reg, value);
     }
     else
     if (wire) {
-        wire->beginTransmission(i2cAddr);
-        wire->write(reg << 3 | channel << 1);
-        wire->write(value);
+        return writeRegisterT<SC16IS7xxI2CTransport>(channel, reg, value);
+    }
+	return false;
+}
 
-        int stat = wire->endTransmission(true);
+bool SC16IS7xxInterface::readInternal(uint8_t channel, uint8_t *buffer, size_t size) {
+    if (spi) {
+        return readInternalT<SC16IS7xxSpiTransport>(channel, buffer, size);
+    }
+    else
+    if (wire) {
+        return readInternalT<SC16IS7xxI2CTransport>(channel, buffer, size);
+    }
+	return false;
+}
 
-        // stat:
-        // 0: success
-        // 1: busy timeout upon entering endTransmission()
-        // 2: START bit generation timeout
-        // 3: end of address transmission timeout
-        // 4: data byte transfer timeout
-        // 5: data byte transfer succeeded, busy timeout immediately after
+bool SC16IS7xxInterface::writeInternal(uint8_t channel, const uint8_t *buffer, size_t size) {
+    if (spi) {
+        return writeInternalT<SC16IS7xxSpiTransport>(channel, buffer, size);
+    }
+    else
+    if (wire) {
+        return writeInternalT<SC16IS7xxI2CTransport>(channel, buffer, size);
+    }
+	return false;
+}
 
-        _uartLogger.trace("writeRegister chan=%d reg=%d value=%d stat=%d", channel, reg, value, stat);
+bool SC16IS7xxInterface::execute(SC16IS7xxBatch &batch) {
+    // The transport is selected once for the whole batch, not for each operation
+    if (spi) {
+        return executeT<SC16IS7xxSpiTransport>(batch);
+    }
+    else
+    if (wire) {
+        return executeT<SC16IS7xxI2CTransport>(batch);
+    }
+	return false;
+}
 
-        result = (stat == 0);
+bool SC16IS7xxInterface::shadowLookup(uint8_t channel, uint8_t reg, uint8_t &value, uint8_t &index) const {
+    if (!shadowEnabled) {
+        index = SHADOW_NOT_CACHED;
+        return false;
     }
 
-    endTransaction();
+    index = shadowIndex(channel, reg);
+    if (isShadowValid(channel, index)) {
+        value = shadowValues[channel][index];
+        return true;
+    }
+    return false;
+}
 
-	return result;
+void SC16IS7xxInterface::shadowStore(uint8_t channel, uint8_t index, uint8_t value) {
+    if (index == SHADOW_EFCR && (value & 0x01) != 0 && channel < SHADOW_MAX_CHANNELS) {
+        // In 9-bit mode EFCR[0], the chip enables the receiver EFCR[1] when it receives the address in XOFF2
+        shadowValid[channel] &= ~(1 << index);
+        return;
+    }
+    if (channel < SHADOW_MAX_CHANNELS && index < SHADOW_NUM_REGS) {
+        shadowValues[channel][index] = value;
+        shadowValid[channel] |= (1 << index);
+    }
 }
 
+bool SC16IS7xxInterface::shadowSkipWrite(uint8_t channel, uint8_t reg, uint8_t value, uint8_t &index) const {
+    uint8_t shadowValue;
 
-bool SC16IS7xxInterface::readInternal(uint8_t channel, uint8_t *buffer, size_t size) {
-    bool result = false;
+    // Register already contains this value
+    return shadowLookup(channel, reg, shadowValue, index) && shadowValue == value;
+}
 
-    beginTransaction();
+void SC16IS7xxInterface::shadowAfterWrite(uint8_t channel, uint8_t reg, uint8_t index, uint8_t value, bool result) {
+    if (!shadowEnabled) {
+        return;
+    }
 
-    if (spi) {
-        // bit 7 (0x80) = read
-    	spi->transfer(0x80 | RHR_THR_REG << 3 | channel << 1);
-    	spi->transfer(NULL, buffer, size, NULL);
-        _uartLogger.trace("readInternal %d bytes", size);
-        result = true;
+    if (reg == IOCONTROL_REG && (value & 0x08) != 0) {
+        // SRESET resets all registers on all channels to their default values
+        for(size_t ii = 0; ii < SHADOW_MAX_CHANNELS; ii++) {
+            shadowValid[ii] = 0;
+        }
     }
     else
-    if (wire) {
-        wire->beginTransmission(i2cAddr);
-        wire->write(RHR_THR_REG << 3 | channel << 1);
-        wire->endTransmission(false);
-
-        uint8_t numRcvd = wire->requestFrom(i2cAddr, size, (uint8_t)true);
-        if (numRcvd == size) {
-            for(size_t ii = 0; ii < size; ii++) {
-                buffer[ii] = (uint8_t) wire->read();
-            }
-
-            _uartLogger.trace("readInternal %d bytes", size);
-
-            result = true;
+    if (index < SHADOW_NUM_REGS) {
+        if (result) {
+            shadowStore(channel, index, value);
+        }
+        else {
+            // Not sure what the register contains now
+            shadowValid[channel] &= ~(1 << index);
         }
-        if (numRcvd < size) {
-            _uartLogger.info("readInternal failed numRcvd=%u size=%u", numRcvd, size);
+    }
+    else
+    if (index == SHADOW_UNKNOWN && channel < SHADOW_MAX_CHANNELS) {
+        // Can't tell which register this was, so anything other than LCR could have changed
+        shadowValid[channel] &= (1 << SHADOW_LCR);
+    }
+}
+
+uint8_t SC16IS7xxInterface::shadowIndex(uint8_t channel, uint8_t reg) const {
+    if (channel >= SHADOW_MAX_CHANNELS) {
+        return SHADOW_NOT_CACHED;
+    }
+    if (reg == LCR_REG) {
+        // LCR is accessible in all register sets
+        return SHADOW_LCR;
+    }
+    if (!isShadowValid(channel, SHADOW_LCR)) {
+        return SHADOW_UNKNOWN;
+    }
+    uint8_t lcrValue = shadowValues[channel][SHADOW_LCR];
+
+    if (lcrValue == LCR_ENABLE_ENHANCED_FEATURE_REG) {
+        // Enhanced register set
+        switch(reg) {
+            case EFR_REG:
+                return SHADOW_EFR;
+            case XON1_REG:
+                return SHADOW_XON1;
+            case XON2_REG:
+                return SHADOW_XON2;
+            case XOFF1_REG:
+                return SHADOW_XOFF1;
+            case XOFF2_REG:
+                return SHADOW_XOFF2;
+            default:
+                return SHADOW_UNKNOWN;
         }
     }
 
+    switch(reg) {
+        case DLL_REG: // RHR_THR_REG
+            return ((lcrValue & LCR_SPECIAL_ENABLE_DIVISOR_LATCH) != 0) ? SHADOW_DLL : SHADOW_NOT_CACHED;
 
-    endTransaction();
+        case DLH_REG: // IER_REG
+            return ((lcrValue & LCR_SPECIAL_ENABLE_DIVISOR_LATCH) != 0) ? SHADOW_DLH : SHADOW_IER;
 
-	return result;
-}
+        case MCR_REG:
+            return SHADOW_MCR;
 
+        case TCR_REG: // MSR_REG
+        case TLR_REG: // SPR_REG
+            if (!isShadowValid(channel, SHADOW_EFR) || !isShadowValid(channel, SHADOW_MCR)) {
+                return SHADOW_UNKNOWN;
+            }
+            if ((shadowValues[channel][SHADOW_EFR] & 0x10) != 0 && (shadowValues[channel][SHADOW_MCR] & 0x04) != 0) {
+                return (reg == TCR_REG) ? SHADOW_TCR : SHADOW_TLR;
+            }
+            return (reg == TCR_REG) ? SHADOW_NOT_CACHED : SHADOW_SPR;
 
-bool SC16IS7xxInterface::writeInternal(uint8_t channel, const uint8_t *buffer, size_t size) {
-    bool result = true;
+        case IODIR_REG:
+            return SHADOW_IODIR;
 
-    beginTransaction();
+        case IOINTENA_REG:
+            return SHADOW_IOINTENA;
 
-    if (spi) {
-        spi->transfer(RHR_THR_REG << 3 | channel << 1);
-    	spi->transfer(const_cast<uint8_t *>(buffer), NULL, size, NULL);
+        case EFCR_REG:
+            return SHADOW_EFCR;
+
+        default:
+            // FCR/IIR, LSR, TXLVL, RXLVL, IOSTATE, IOCONTROL
+            return SHADOW_NOT_CACHED;
+    }
+}
 
-        _uartLogger.trace("writeInternal size=%d", size);
+bool SC16IS7xxInterface::readRegisterUncached(uint8_t channel, uint8_t reg, uint8_t &value) {
+    if (spi) {
+        return SC16IS7xxSpiTransport::readRegister(*this, channel, reg, value);
     }
     else
     if (wire) {
-        wire->beginTransmission(i2cAddr);
-        wire->write(RHR_THR_REG << 3 | channel << 1);
-        wire->write(buffer, size);
-
-        int stat = wire->endTransmission(true);
-
-        // stat:
-        // 0: success
-        // 1: busy timeout upon entering endTransmission()
-        // 2: START bit generation timeout
-        // 3: end of address transmission timeout
-        // 4: data byte transfer timeout
-        // 5: data byte transfer succeeded, busy timeout immediately after
-
-        _uartLogger.trace("writeInternal size=%d stat=%d", size, stat);
-
-        result = (stat == 0);
+        return SC16IS7xxI2CTransport::readRegister(*this, channel, reg, value);
     }
+    value = 0;
+	return false;
+}
 
-	return result;
+bool SC16IS7xxInterface::writeRegisterUncached(uint8_t channel, uint8_t reg, uint8_t value) {
+    if (spi) {
+        return SC16IS7xxSpiTransport::writeRegister(*this, channel, reg, value);
+    }
+    else
+    if (wire) {
+        return SC16IS7xxI2CTransport::writeRegister(*this, channel, reg, value);
+    }
+	return false;
 }
 
 size_t SC16IS7xxInterface::readInternalMax() const {
-    size_t value = 0;
-
     if (spi) {
-        // SPI does allow a large value here, but the FIFO is limited to this size.
-        value = 64;
+        return SC16IS7xxSpiTransport::readInternalMax(*this);
     }
     else
     if (wire) {
-        // Newer version of Device OS can change the size of the I2C buffer on some
-        // platforms, but this should be big enough for most I2C use cases.
-        value = 32;
+        return SC16IS7xxI2CTransport::readInternalMax(*this);
     }
-    return value;
+    return 0;
 }
 
 size_t SC16IS7xxInterface::writeInternalMax() const {
-    size_t value = 0;
-
     if (spi) {
-        // SPI does allow a large value here, but the FIFO is limited to this size.
-        value = 64;
+        return SC16IS7xxSpiTransport::writeInternalMax(*this);
     }
     else
     if (wire) {
-        // Newer version of Device OS can change the size of the I2C buffer on some
-        // platforms, but this should be big enough for most I2C use cases.
-        // Note that this is not 32!
-        value = 31;
+        return SC16IS7xxI2CTransport::writeInternalMax(*this);
     }
-    return value;
+    return 0;
 }
 
 void SC16IS7xxInterface::registerThreadFunction(std::function<void()> fn) {
     if (!workerThread) {
         workerThread = new Thread("uart", threadFunctionStatic, (void *)this, OS_THREAD_PRIORITY_DEFAULT, 2048);        
     }
-    threadFunctions.push_back(fn);
+    if (fn) {
+        WITH_LOCK(workerMutex) {
+            threadFunctions.push_back(fn);
+        }
+    }
+}
+
+void SC16IS7xxInterface::serviceReadBuffers() {
+    // Read RXLVL and the FIFO data for every port in buffered read mode in a single bus transaction
+    workerBatch.clear();
+
+    bool hasWork = false;
+    forEachPort([this, &hasWork](SC16IS7xxPort *port) {
+        port->rxBatched = false;
+        if (port->readBuffer && irqPin == PIN_INVALID) {
+            if (!adaptivePolling || port->isServiceDue(port->rxDeadlineUs)) {
+                port->addReadFifoToBatch(workerBatch);
+                port->rxBatched = true;
+                hasWork = true;
+            }
+        }
+    });
+
+    if (hasWork) {
+        execute(workerBatch);
+
+        forEachPort([](SC16IS7xxPort *port) {
+            if (port->rxBatched) {
+                port->completeReadFifoBatch();
+            }
+        });
+    }
 }
 
 
 void SC16IS7xxInterface::threadFunction() {
+    size_t irqStillAssertedCount = 0;
+
 	while(true) {
-        for(auto fn : threadFunctions) {
-            fn();
+        // workerMutex is held while servicing the ports, but not while waiting, so begin() can replace the buffers
+        WITH_LOCK(workerMutex) {
+            if (shadowEnabled && shadowVerifyIntervalMs != 0 && millis() - shadowVerifyLastMs >= shadowVerifyIntervalMs) {
+                shadowVerifyLastMs = millis();
+                verifyShadowRegisters();
+            }
+
+            serviceReadBuffers();
+
+            for(const auto &fn : threadFunctions) {
+                fn();
+            }
+        }
+
+        if (irqPin != PIN_INVALID && workerSemaphore) {
+            if (pinReadFast(irqPin) == LOW) {
+                // IRQ is level-sensitive on the chip. If a new interrupt source became pending while
+                // we were servicing the last one, IRQ never went high so there won't be another falling
+                // edge. Service it again right away, but don't spin if something can't be cleared.
+                if (++irqStillAssertedCount < IRQ_MAX_IMMEDIATE_RETRIES) {
+                    continue;
+                }
+                os_semaphore_take(workerSemaphore, 1, false);
+            }
+            else {
+                irqStillAssertedCount = 0;
+
+                // Wake up early if a Modbus RTU frame could be complete without an RX timeout interrupt
+                uint32_t now = micros();
+                system_tick_t waitMs = irqIdleTimeoutMs;
+                WITH_LOCK(workerMutex) {
+                    forEachPort([now, &waitMs](SC16IS7xxPort *port) {
+                        port->updateModbusWaitMs(now, waitMs);
+                    });
+                }
+                os_semaphore_take(workerSemaphore, waitMs, false);
+            }
+        }
+        else
+        if (adaptivePolling && workerSemaphore) {
+            // Sleep until the earliest port deadline. wakeWorker() ends the sleep early when there's
+            // new data to write.
+            uint32_t now = micros();
+            uint32_t nextServiceUs = adaptivePollingMaxIntervalMs * 1000;
+            WITH_LOCK(workerMutex) {
+                forEachPort([now, &nextServiceUs](SC16IS7xxPort *port) {
+                    port->updateNextServiceUs(now, nextServiceUs);
+                });
+            }
+
+            system_tick_t sleepMs = (system_tick_t)(nextServiceUs / 1000);
+            if (sleepMs < 1) {
+                sleepMs = 1;
+            }
+            os_semaphore_take(workerSemaphore, sleepMs, false);
+        }
+        else {
+    		delay(1);
         }
-		delay(1);
 	}
 }
 
+void SC16IS7xxInterface::wakeWorker() {
+    if (workerSemaphore) {
+        os_semaphore_give(workerSemaphore, false);
+    }
+}
+
+void SC16IS7xxInterface::irqHandler() {
+    // Called at interrupt time. Only wake the worker thread, and save the time for the histograms.
+    irqTimeUs = micros();
+    irqSequence = irqSequence + 1;
+    os_semaphore_give(workerSemaphore, false);
+}
+
 // [static]
 void SC16IS7xxInterface::threadFunctionStatic(void *param) {
 	SC16IS7xxInterface *This = (SC16IS7xxInterface *)param;
@@ -850,6 +2772,58 @@ SC16IS7x0::SC16IS7x0() {
     interface = this;
 }
 
+bool SC16IS7xxBatch::addReadRegister(uint8_t channel, uint8_t reg, uint8_t *value) {
+    Op *op = addOp(OP_READ_REGISTER, channel);
+    if (op) {
+        op->reg = reg;
+        op->value = value;
+    }
+    return op != nullptr;
+}
+
+bool SC16IS7xxBatch::addWriteRegister(uint8_t channel, uint8_t reg, uint8_t value) {
+    Op *op = addOp(OP_WRITE_REGISTER, channel);
+    if (op) {
+        op->reg = reg;
+        op->writeValue = value;
+    }
+    return op != nullptr;
+}
+
+bool SC16IS7xxBatch::addReadFifo(uint8_t channel, uint8_t *buffer, size_t size, uint8_t *remaining, size_t *bytesRead) {
+    Op *op = addOp(OP_READ_FIFO, channel);
+    if (op) {
+        op->buffer = buffer;
+        op->size = size;
+        op->remaining = remaining;
+        op->bytesRead = bytesRead;
+    }
+    return op != nullptr;
+}
+
+bool SC16IS7xxBatch::addWriteFifo(uint8_t channel, const uint8_t *buffer, size_t size) {
+    Op *op = addOp(OP_WRITE_FIFO, channel);
+    if (op) {
+        op->buffer = const_cast<uint8_t *>(buffer);
+        op->size = size;
+    }
+    return op != nullptr;
+}
+
+SC16IS7xxBatch::Op *SC16IS7xxBatch::addOp(uint8_t type, uint8_t channel) {
+    if (numOps >= MAX_OPS) {
+        _uartLogger.error("SC16IS7xxBatch full");
+        overflow = true;
+        return nullptr;
+    }
+    Op *op = &ops[numOps++];
+    *op = Op();
+    op->type = type;
+    op->channel = channel;
+    return op;
+}
+
+
 SC16IS7x2::SC16IS7x2() {
     for(size_t ii = 0; ii < (sizeof(ports) / sizeof(ports[0])); ii++) {
         ports[ii].channel = ii;
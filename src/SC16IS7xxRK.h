@@ -3,9 +3,109 @@
 
 #include "Particle.h"
 
+#include <atomic>
 
 class SC16IS7xxInterface; // Forward declaration
 class SC16IS7x2; // Forward declaration
+class SC16IS7xxBatch; // Forward declaration
+
+extern Logger _uartLogger; //!< Logger for this library (category app.uart), also used by the inline transport functions
+
+/**
+ * @brief Tracing of bus transactions (register reads and writes, FIFO reads and writes)
+ * 
+ * - SC16IS7XX_TRACE_NONE (0, default): No tracing. The trace calls are removed at compile time.
+ * - SC16IS7XX_TRACE_EVENTS (1): Record a binary event in SC16IS7xxEventRing for each transaction
+ * - SC16IS7XX_TRACE_LOG (2): Log each transaction using the app.uart logger at trace level
+ * 
+ * Define this in your build flags, or before including SC16IS7xxRK.h in every file, including the library.
+ */
+#ifndef SC16IS7XX_TRACE_LEVEL
+#define SC16IS7XX_TRACE_LEVEL 0
+#endif
+
+#define SC16IS7XX_TRACE_NONE 0 //!< SC16IS7XX_TRACE_LEVEL: no bus transaction tracing
+#define SC16IS7XX_TRACE_EVENTS 1 //!< SC16IS7XX_TRACE_LEVEL: binary event ring
+#define SC16IS7XX_TRACE_LOG 2 //!< SC16IS7XX_TRACE_LEVEL: trace log messages
+
+/**
+ * @brief Number of events in SC16IS7xxEventRing when SC16IS7XX_TRACE_LEVEL is SC16IS7XX_TRACE_EVENTS
+ */
+#ifndef SC16IS7XX_EVENT_RING_SIZE
+#define SC16IS7XX_EVENT_RING_SIZE 256
+#endif
+
+/**
+ * @brief Event recorded in SC16IS7xxEventRing
+ */
+struct SC16IS7xxEvent {
+    uint32_t timeUs; //!< micros() value when the event was recorded
+    uint8_t type; //!< One of the SC16IS7xxEventRing::EVENT_ constants
+    uint8_t channel; //!< Channel (0 or 1)
+    uint8_t reg; //!< Register for register events, 0 otherwise
+    uint8_t value; //!< Register value, number of bytes for FIFO events, or IIR for EVENT_IIR
+};
+
+/**
+ * @brief Ring of binary trace events, enabled by setting SC16IS7XX_TRACE_LEVEL to SC16IS7XX_TRACE_EVENTS
+ * 
+ * Recording an event is a micros() call, an atomic increment, and an 8 byte store, so it can be used where 
+ * trace logging would generate far too many messages. The oldest events are overwritten. There is a 
+ * single ring shared by all chips.
+ */
+class SC16IS7xxEventRing {
+public:
+    /**
+     * @brief Record an event. Can be called from any thread.
+     */
+    static void add(uint8_t type, uint8_t channel, uint8_t reg, uint8_t value);
+
+    /**
+     * @brief Copy the most recent events, oldest first
+     * 
+     * @param events Array to copy to
+     * @param maxEvents Number of elements in events
+     * @return size_t Number of events copied
+     * 
+     * Events recorded while copying may be included or missed.
+     */
+    static size_t copy(SC16IS7xxEvent *events, size_t maxEvents);
+
+    /**
+     * @brief Log the most recent events using the app.uart logger at info level, oldest first
+     * 
+     * @param maxEvents Maximum number of events to log
+     */
+    static void log(size_t maxEvents = SC16IS7XX_EVENT_RING_SIZE);
+
+    /**
+     * @brief Discard all events
+     */
+    static void clear();
+
+    static const uint8_t EVENT_READ_REGISTER = 1; //!< Register read. value is the value read.
+    static const uint8_t EVENT_WRITE_REGISTER = 2; //!< Register write. value is the value written.
+    static const uint8_t EVENT_READ_FIFO = 3; //!< RX FIFO read. value is the number of bytes.
+    static const uint8_t EVENT_WRITE_FIFO = 4; //!< TX FIFO write. value is the number of bytes.
+    static const uint8_t EVENT_IIR = 5; //!< Interrupt handled. value is the IIR.
+    static const uint8_t EVENT_ERROR = 6; //!< Bus operation failed. reg is the register, value the number of bytes for FIFO operations.
+
+protected:
+#if SC16IS7XX_TRACE_LEVEL == SC16IS7XX_TRACE_EVENTS
+    static SC16IS7xxEvent events[SC16IS7XX_EVENT_RING_SIZE]; //!< Event storage
+    static std::atomic<uint32_t> nextEvent; //!< Number of events ever recorded; the next event goes at nextEvent % SC16IS7XX_EVENT_RING_SIZE
+#endif
+};
+
+#ifndef DOXYGEN_DO_NOT_DOCUMENT
+#if SC16IS7XX_TRACE_LEVEL == SC16IS7XX_TRACE_LOG
+#define SC16IS7XX_TRACE_BUS(type, channel, reg, value, ...) _uartLogger.trace(__VA_ARGS__)
+#elif SC16IS7XX_TRACE_LEVEL == SC16IS7XX_TRACE_EVENTS
+#define SC16IS7XX_TRACE_BUS(type, channel, reg, value, ...) SC16IS7xxEventRing::add(type, channel, reg, (uint8_t)(value))
+#else
+#define SC16IS7XX_TRACE_BUS(type, channel, reg, value, ...) do {} while(0)
+#endif
+#endif // DOXYGEN_DO_NOT_DOCUMENT
 
 /**
  * @brief Class used internally for buffering data
@@ -14,7 +114,13 @@ class SC16IS7x2; // Forward declaration
  * buffer allocated on the heap.
  * 
  * You do not create one of these objects; it's created automatically when using
- * withBufferedRead().
+ * withBufferedRead() or withBufferedWrite().
+ * 
+ * The buffer can operate in two modes. By default, a mutex protects the buffer so any
+ * number of threads can read and write. In single producer, single consumer (SPSC) mode
+ * exactly one thread writes and exactly one other thread reads. In that case the read
+ * and write offsets are atomic and no lock is taken, which is much faster for 
+ * single-byte reads.
  */
 class SC16IS7xxBuffer {
 public:
@@ -32,12 +138,16 @@ public:
      * @brief Allocate the buffer
      * 
      * @param bufSize Size of the buffer in bytes
+     * @param singleProducerSingleConsumer true if only one thread writes and only one thread reads (lock-free mode)
      * @return true The buffer was allocated
      * @return false The buffer could not be allocated, typically out of heap space, or no contiguous block available
      * 
-     * This is called from withBufferedRead(), 
+     * This is called from begin() when using withBufferedRead() or withBufferedWrite().
+     * 
+     * One byte of the buffer is always left unused so a full buffer can be distinguished from
+     * an empty one, so the buffer can hold at most bufSize - 1 bytes.
      */
-    bool init(size_t bufSize);
+    bool init(size_t bufSize, bool singleProducerSingleConsumer = false);
 
     // Read API
 
@@ -68,6 +178,59 @@ public:
      */
     int read(uint8_t *buffer, size_t size);
 
+    /**
+     * @brief Return the next byte without removing it from the buffer
+     * 
+     * @return int The byte value (0 - 255) or -1 if there is no data available to read.
+     */
+    int peek() const;
+
+    /**
+     * @brief Copy multiple bytes of data to a buffer without removing them from the buffer
+     * 
+     * @param buffer The buffer to store data into
+     * @param size The number of bytes requested
+     * @return int The number of bytes actually copied, or -1 if there is no data available.
+     * 
+     * Use consume() to remove the data from the buffer after processing it.
+     */
+    int peek(uint8_t *buffer, size_t size) const;
+
+    /**
+     * @brief Get a pointer to the contiguous data at the read position without copying it
+     * 
+     * @param data Filled in with a pointer into the buffer, or nullptr if there is no data
+     * @return size_t The number of bytes that can be accessed at data, 0 if there is no data.
+     * 
+     * Because the buffer is circular, the data available to read may be in two segments. This
+     * only returns the first segment. After calling consume() with the returned size, calling 
+     * peekContiguous() again will return the second segment.
+     * 
+     * The data remains valid until you call consume() or read(). The producer never overwrites
+     * data that has not been consumed. This must only be called from the consumer thread.
+     */
+    size_t peekContiguous(const uint8_t *&data) const;
+
+    /**
+     * @brief Remove bytes from the buffer without copying them, typically after peek() or peekContiguous()
+     * 
+     * @param count Number of bytes to remove
+     * @return size_t Number of bytes actually removed, which may be smaller if there was less data in the buffer
+     */
+    size_t consume(size_t count);
+
+    /**
+     * @brief Find a byte in the data available to read without copying it
+     * 
+     * @param value The byte to find
+     * @param offset Number of bytes after the read position to start searching, typically the number already searched
+     * @param limit Number of bytes after the read position to stop searching
+     * @return int Position of the byte relative to the read position, or -1 if not found
+     * 
+     * Both segments of the circular buffer are searched using memchr. This must only be called from the consumer thread.
+     */
+    int find(uint8_t value, size_t offset, size_t limit) const;
+
     // Write API
 
     /**
@@ -77,6 +240,11 @@ public:
      */
     size_t availableToWrite() const;
 
+    /**
+     * @brief The maximum number of bytes the buffer can hold, which is one less than the size passed to init()
+     */
+    size_t capacity() const { return (bufSize > 0) ? bufSize - 1 : 0; };
+
     /**
      * @brief Write data to the buffer
      * 
@@ -108,6 +276,32 @@ public:
      */
     void writeCallback(std::function<void(uint8_t *buffer, size_t &size)> callback);
 
+    /**
+     * @brief Get the free space in the buffer so it can be written to directly without copying
+     * 
+     * @param first Filled in with a pointer to the first free region, or nullptr
+     * @param firstSize Filled in with the size of the first free region in bytes
+     * @param second Filled in with a pointer to the second free region (the start of the buffer), or nullptr
+     * @param secondSize Filled in with the size of the second free region in bytes
+     * 
+     * Because the buffer is circular, the free space can be in two pieces. Write data to first, then second,
+     * then call commit() with the number of bytes written. The consumer never modifies the free space. This 
+     * must only be called from the producer thread.
+     */
+    void getWriteSpace(uint8_t *&first, size_t &firstSize, uint8_t *&second, size_t &secondSize) const;
+
+    /**
+     * @brief Make bytes written to the space returned by getWriteSpace() available to read
+     * 
+     * @param count The number of bytes written, which must not exceed firstSize + secondSize
+     */
+    void commit(size_t count);
+
+    /**
+     * @brief Returns true if the buffer is in lock-free single producer, single consumer mode
+     */
+    bool isSingleProducerSingleConsumer() const { return singleProducerSingleConsumer; };
+
     /**
      * @brief Lock the buffer mutex
      * 
@@ -115,6 +309,9 @@ public:
      * since they can be accessed from two different threads. The buffer is written from
      * the worker thread and read from whatever thread the user is reading from, typically
      * the application loop thread.
+     * 
+     * In single producer, single consumer mode the buffer functions do not use this mutex,
+     * but you can still lock it for your own purposes.
      */
     void lock() const { mutex.lock(); }
 
@@ -155,14 +352,266 @@ protected:
      */
     void free();
 
+    /**
+     * @brief Number of bytes in the buffer for a given pair of offsets - used internally
+     */
+    size_t usedBytes(size_t readOff, size_t writeOff) const { return (writeOff >= readOff) ? (writeOff - readOff) : (bufSize - readOff + writeOff); };
+
+    /**
+     * @brief Advance an offset by count bytes, wrapping at bufSize - used internally
+     */
+    size_t advanceOffset(size_t offset, size_t count) const { offset += count; if (offset >= bufSize) { offset -= bufSize; } return offset; };
+
+    /**
+     * @brief Locks the mutex for the lifetime of the object, except in single producer, single consumer mode
+     */
+    class BufferLock {
+    public:
+        /**
+         * @brief Lock the buffer, unless it's in lock-free mode
+         */
+        explicit BufferLock(const SC16IS7xxBuffer &buffer) : buffer(buffer) { if (!buffer.singleProducerSingleConsumer) { buffer.lock(); } };
+
+        /**
+         * @brief Unlock the buffer, unless it's in lock-free mode
+         */
+        ~BufferLock() { if (!buffer.singleProducerSingleConsumer) { buffer.unlock(); } };
+
+    protected:
+        const SC16IS7xxBuffer &buffer; //!< Buffer to lock
+    };
 
     uint8_t *buf = nullptr; //!< Buffer, allocated on heap
 	size_t bufSize = 0; //!< Size of buffer in bytes
-    size_t readOffset = 0; //!< Where to read from next, may be larger than bufSize
-    size_t writeOffset = 0; //!< Where to write to next, may be larger than bufSize
+    std::atomic<size_t> readOffset{0}; //!< Where to read from next (0 <= readOffset < bufSize). Only modified by the consumer.
+    std::atomic<size_t> writeOffset{0}; //!< Where to write to next (0 <= writeOffset < bufSize). Only modified by the producer.
+    bool singleProducerSingleConsumer = false; //!< Lock-free mode, one thread writes and one thread reads
     mutable RecursiveMutex mutex; //!< Mutex to use to access buf, readOffset, or writeOffset
 };
 
+/**
+ * @brief A list of register and FIFO operations executed in a single bus transaction
+ * 
+ * Normally each readRegister() or writeRegister() call begins and ends its own SPI or I2C
+ * transaction. With a batch, the SPI settings are set or the I2C lock is obtained once
+ * for all of the operations, which can be for either channel. With SPI, CS is still toggled
+ * between operations because the chip requires it.
+ * 
+ * The operations are stored in a fixed size array, so no memory is allocated. Use 
+ * SC16IS7xxInterface::execute() to run the batch. Results of reads are stored when the
+ * batch is executed.
+ */
+class SC16IS7xxBatch {
+public:
+    /**
+     * @brief Construct an empty batch
+     */
+    SC16IS7xxBatch() {};
+
+    /**
+     * @brief Add a register read
+     * 
+     * @param channel The channel (0 or 1)
+     * @param reg The register number (0 - 15)
+     * @param value Where to store the value when the batch is executed
+     * @return true The operation was added
+     * @return false The batch is full
+     */
+    bool addReadRegister(uint8_t channel, uint8_t reg, uint8_t *value);
+
+    /**
+     * @brief Add a register write
+     * 
+     * @param channel The channel (0 or 1)
+     * @param reg The register number (0 - 15)
+     * @param value The value to write
+     * @return true The operation was added
+     * @return false The batch is full
+     */
+    bool addWriteRegister(uint8_t channel, uint8_t reg, uint8_t value);
+
+    /**
+     * @brief Add a read from the RX FIFO
+     * 
+     * @param channel The channel (0 or 1)
+     * @param buffer Where to store the data
+     * @param size Maximum number of bytes to read. Must not exceed SC16IS7xxInterface::readInternalMax().
+     * @param remaining Optional. If not null, the number of bytes read is limited to this value, which is 
+     * then decremented by the number of bytes read. Typically this is the value of an earlier RXLVL read
+     * in the same batch.
+     * @param bytesRead Optional. If not null, incremented by the number of bytes actually read.
+     * @return true The operation was added
+     * @return false The batch is full
+     */
+    bool addReadFifo(uint8_t channel, uint8_t *buffer, size_t size, uint8_t *remaining = nullptr, size_t *bytesRead = nullptr);
+
+    /**
+     * @brief Add a write to the TX FIFO
+     * 
+     * @param channel The channel (0 or 1)
+     * @param buffer The data to write. Must remain valid until the batch is executed.
+     * @param size Number of bytes to write. Must not exceed SC16IS7xxInterface::writeInternalMax().
+     * @return true The operation was added
+     * @return false The batch is full
+     */
+    bool addWriteFifo(uint8_t channel, const uint8_t *buffer, size_t size);
+
+    /**
+     * @brief Remove all operations so the batch can be reused
+     */
+    void clear() { numOps = 0; overflow = false; };
+
+    /**
+     * @brief Returns true if an operation could not be added because the batch was full
+     * 
+     * SC16IS7xxInterface::execute() does not execute a batch that overflowed and returns false.
+     */
+    bool hasOverflowed() const { return overflow; };
+
+    /**
+     * @brief Returns the number of operations in the batch
+     */
+    size_t size() const { return numOps; };
+
+    static const size_t MAX_OPS = 24; //!< Maximum number of operations in a batch. begin() uses up to 23.
+
+protected:
+    static const uint8_t OP_READ_REGISTER = 0; //!< Op type for addReadRegister()
+    static const uint8_t OP_WRITE_REGISTER = 1; //!< Op type for addWriteRegister()
+    static const uint8_t OP_READ_FIFO = 2; //!< Op type for addReadFifo()
+    static const uint8_t OP_WRITE_FIFO = 3; //!< Op type for addWriteFifo()
+
+    /**
+     * @brief One operation in the batch
+     */
+    struct Op {
+        uint8_t type = 0; //!< OP_READ_REGISTER, etc.
+        uint8_t channel = 0; //!< Channel 0 or 1
+        uint8_t reg = 0; //!< Register for register operations
+        uint8_t writeValue = 0; //!< Value for OP_WRITE_REGISTER
+        uint8_t *value = nullptr; //!< Result for OP_READ_REGISTER
+        uint8_t *buffer = nullptr; //!< Buffer for FIFO operations
+        size_t size = 0; //!< Size for FIFO operations
+        uint8_t *remaining = nullptr; //!< Optional limit for OP_READ_FIFO, decremented by bytes read
+        size_t *bytesRead = nullptr; //!< Optional counter for OP_READ_FIFO, incremented by bytes read
+    };
+
+    /**
+     * @brief Add an operation. Returns nullptr if the batch is full.
+     */
+    Op *addOp(uint8_t type, uint8_t channel);
+
+    Op ops[MAX_OPS]; //!< Operations, numOps are valid
+    size_t numOps = 0; //!< Number of operations in ops
+    bool overflow = false; //!< An operation was not added because the batch was full
+
+    friend class SC16IS7xxInterface; //!< The interface executes the batch
+};
+
+/**
+ * @brief Adaptive polling statistics for a port, returned by SC16IS7xxPort::getPollingStats()
+ * 
+ * Times are in microseconds. Late times are how long after the computed deadline the
+ * worker thread actually serviced the port (service jitter).
+ */
+struct SC16IS7xxPollingStats {
+    uint32_t rxIntervalUs = 0; //!< Most recently computed interval until the next RX FIFO check
+    int32_t rxMaxLateUs = 0; //!< Maximum time the RX FIFO was serviced after its deadline
+    uint8_t rxMaxFifoLevel = 0; //!< Maximum number of bytes found in the 64-byte RX FIFO when serviced
+    uint32_t rxServiceCount = 0; //!< Number of times the RX FIFO was serviced
+    uint32_t txIntervalUs = 0; //!< Most recently computed interval until the next TX FIFO refill
+    int32_t txMaxLateUs = 0; //!< Maximum time the TX FIFO was refilled after its deadline
+    uint32_t txServiceCount = 0; //!< Number of times the TX FIFO was serviced
+};
+
+/**
+ * @brief Performance counters for a port, returned by SC16IS7xxPort::getStats()
+ * 
+ * The counters are always maintained. They wrap at 2^32.
+ */
+struct SC16IS7xxPortStats {
+    uint32_t rxBytes = 0; //!< Bytes read from the RX FIFO
+    uint32_t txBytes = 0; //!< Bytes written to the TX FIFO
+    uint32_t rxBusOps = 0; //!< Bus operations for receiving (LSR and RXLVL reads, FIFO reads)
+    uint32_t txBusOps = 0; //!< Bus operations for transmitting (TXLVL reads, FIFO writes)
+    uint8_t rxFifoHighWater = 0; //!< Maximum number of bytes found in the 64-byte RX FIFO
+    uint32_t rxBufferHighWater = 0; //!< Maximum number of bytes in the read buffer (buffered read mode)
+    uint32_t rxBufferFull = 0; //!< Number of times data was left in the RX FIFO because the read buffer was full
+    uint32_t lsrOverrun = 0; //!< Number of times LSR reported an RX FIFO overrun (data lost)
+    uint32_t lsrParity = 0; //!< Number of times LSR reported a parity error
+    uint32_t lsrFraming = 0; //!< Number of times LSR reported a framing error
+    uint32_t lsrBreak = 0; //!< Number of times LSR reported a break condition
+    uint32_t writeBlockedUs = 0; //!< Total time in microseconds write() spent waiting for space
+    uint32_t serviceCount = 0; //!< Number of times the worker thread serviced this port
+    uint32_t xoffReceived = 0; //!< Number of Xoff interrupts (software flow control with withIRQ())
+    uint32_t modbusFrames = 0; //!< Modbus RTU frames with a valid CRC passed to the withModbusRTU() handler
+    uint32_t modbusCrcErrors = 0; //!< Modbus RTU frames discarded because the CRC did not match
+    uint32_t modbusFrameErrors = 0; //!< Modbus RTU frames discarded because they were shorter than 4 or longer than 256 bytes
+};
+
+/**
+ * @brief Log-scale histogram of times in microseconds
+ * 
+ * Bucket 0 counts values of 0 or 1 microseconds, and bucket n counts values from 2^n to 2^(n+1) - 1 
+ * microseconds. The last bucket also counts anything larger. Adding a value does not allocate memory.
+ */
+struct SC16IS7xxHistogram {
+    static const size_t NUM_BUCKETS = 16; //!< Number of buckets. The last bucket is 32.768 milliseconds and up.
+
+    /**
+     * @brief Add a value to the histogram. Not thread-safe; the caller must prevent simultaneous updates.
+     * 
+     * @param valueUs Time in microseconds
+     */
+    void add(uint32_t valueUs);
+
+    /**
+     * @brief Returns an upper bound for the given percentile
+     * 
+     * @param percent Percentile (0 - 100)
+     * @return uint32_t The upper limit of the bucket containing the percentile, in microseconds, or 0 if empty
+     */
+    uint32_t percentile(uint8_t percent) const;
+
+    /**
+     * @brief Returns the mean value in microseconds, or 0 if empty
+     */
+    uint32_t mean() const { return count ? (uint32_t)(sumUs / count) : 0; };
+
+    /**
+     * @brief Log the histogram using the app.uart logger at info level
+     * 
+     * @param name Name to include in the log message
+     */
+    void log(const char *name) const;
+
+    uint32_t buckets[NUM_BUCKETS] = {0}; //!< Number of values in each bucket
+    uint32_t count = 0; //!< Total number of values
+    uint32_t maxUs = 0; //!< Largest value
+    uint64_t sumUs = 0; //!< Sum of all values, used to calculate the mean
+};
+
+/**
+ * @brief Latency histograms for a port, returned by SC16IS7xxPort::getHistograms()
+ */
+struct SC16IS7xxPortHistograms {
+    SC16IS7xxHistogram irqToDrainUs; //!< Time from the IRQ pin falling edge until the RX FIFO was read into the read buffer (withIRQ() and buffered read mode)
+    SC16IS7xxHistogram serviceIntervalUs; //!< Time between successive services of the port by the worker thread
+};
+
+/**
+ * @brief Interrupt statistics for a port, returned by SC16IS7xxPort::getIrqStats()
+ */
+struct SC16IS7xxIrqStats {
+    static const size_t MAX_CAUSES_PER_WAKEUP = 8; //!< Size of causesPerWakeup, and the value of SC16IS7xxPort::IIR_MAX_CAUSES_PER_IRQ
+
+    uint32_t wakeups = 0; //!< Number of times handleIIR found at least one pending interrupt
+    uint32_t causes = 0; //!< Total number of interrupt causes handled
+    uint8_t maxCausesPerWakeup = 0; //!< Maximum number of causes handled in a single wakeup
+    uint32_t limitReached = 0; //!< Number of wakeups that stopped at IIR_MAX_CAUSES_PER_IRQ with interrupts possibly still pending
+    uint32_t causesPerWakeup[MAX_CAUSES_PER_WAKEUP] = {0}; //!< causesPerWakeup[n] is the number of wakeups that handled n + 1 causes
+};
+
 /**
  * @brief Class for an instance of a UART. 
  * 
@@ -175,18 +624,168 @@ public:
      * @brief Enable buffered read mode
      * 
      * @param bufferSize Buffer size in bytes. The buffer is allocated on the heap.
+     * @param lockFree Use the lock-free single producer, single consumer buffer (default: true)
+     * 
+     * The buffer is only written to from the worker thread. If you only read from the port from
+     * a single thread (typically the application loop thread), the default lock-free mode
+     * avoids taking a mutex on every read. If you read from the port from more than one thread,
+     * pass false to protect the buffer with a mutex.
      */
-    SC16IS7xxPort &withBufferedRead(size_t bufferSize) { this->bufferedReadSize = bufferSize; return *this; };
+    SC16IS7xxPort &withBufferedRead(size_t bufferSize, bool lockFree = true) { this->bufferedReadSize = bufferSize; this->bufferedReadLockFree = lockFree; return *this; };
 
     /**
-     * @brief Sets the auto RTS hardware flow control levels. Call before begin() to change levels
+     * @brief Enable buffered write mode
+     * 
+     * @param bufferSize Buffer size in bytes. The buffer is allocated on the heap.
+     * @param lockFree Use the lock-free single producer, single consumer buffer (default: false)
+     * 
+     * In buffered write mode, write() copies the data into the buffer and returns immediately. The
+     * worker thread moves data from the buffer into the 64-byte hardware TX FIFO as space becomes available.
+     * write() only blocks if the buffer is full and blockOnOverrun is true (the default).
      * 
-     * @param haltLevel Number of characters in receive FIFO to halt transmission. Default: 60.
-     * @param resumeLevel Number of characters in receivee FIFO to resume transmission. Default: 30.
+     * If you only write to the port from a single thread you can pass true to avoid taking a mutex
+     * on every write. The default is false because it's common to write to a port from multiple threads.
+     */
+    SC16IS7xxPort &withBufferedWrite(size_t bufferSize, bool lockFree = false) { this->bufferedWriteSize = bufferSize; this->bufferedWriteLockFree = lockFree; return *this; };
+
+    /**
+     * @brief Sets the auto RTS and Xon/Xoff flow control levels. Call before begin() to change levels
+     * 
+     * @param haltLevel Number of characters in receive FIFO to halt transmission, 4 - 60 in steps of 4. Default: 60.
+     * @param resumeLevel Number of characters in receivee FIFO to resume transmission, 0 - 56 in steps of 4. Default: 28.
      * @return SC16IS7xxPort& 
+     * 
+     * With OPTIONS_FLOW_CONTROL_XON_XOFF_TX, Xoff is sent at the halt level and Xon at the resume level.
      */
     SC16IS7xxPort &withTransmissionControlLevels(uint8_t haltLevel, uint8_t resumeLevel);
 
+    /**
+     * @brief Sets the TX FIFO interrupt level used in buffered write mode with IRQ. Call before begin() to change.
+     * 
+     * @param level Number of spaces in the TX FIFO that trigger a THR interrupt, 4 - 60 in steps of 4. Default: 32.
+     * @return SC16IS7xxPort& 
+     * 
+     * When using withIRQ() and withBufferedWrite(), the chip interrupts when there are at least this many spaces
+     * in the TX FIFO and the worker thread writes that many bytes in a single transaction, instead of polling TXLVL.
+     * A larger value means fewer, larger transactions but more risk of the TX FIFO running empty between refills.
+     */
+    SC16IS7xxPort &withWriteFifoInterruptLevel(uint8_t level) { this->writeFifoInterruptLevel = level; return *this; };
+
+    /**
+     * @brief Sets the maximum difference between the requested baud rate and the one the chip can generate. Call before begin().
+     * 
+     * @param percent Maximum error in percent. Default: 2.0.
+     * @return SC16IS7xxPort& 
+     * 
+     * begin() returns false if the closest baud rate that can be generated from the oscillator frequency differs by more
+     * than this. The combined error of both ends of a connection should be kept below about 3%.
+     */
+    SC16IS7xxPort &withBaudRateTolerance(float percent) { this->baudRateTolerance = percent; return *this; };
+
+    /**
+     * @brief Enable RS-485 half-duplex mode with automatic direction control. Call before begin().
+     * 
+     * @param suppressEcho Disable the receiver from the first write() until flush() finds the transmitter empty (default: true)
+     * @param rtsHighDuringTx RTS is high while transmitting and low while receiving (default: true)
+     * @return SC16IS7xxPort& 
+     * 
+     * The chip drives the RTS pin during transmission (EFCR[4]), so connect RTS to the DE and /RE pins of the
+     * RS-485 transceiver instead of using a GPIO. The transceiver is switched back to receive as soon as the last
+     * stop bit is sent. Most transceivers have active high DE, so leave rtsHighDuringTx set unless there is an
+     * inverter. Do not use OPTIONS_FLOW_CONTROL_RTS with this mode.
+     * 
+     * If the transceiver receiver is always enabled, your own transmissions are echoed back. With suppressEcho
+     * the chip receiver is disabled (EFCR[1]) while transmitting, so be sure to call flush() after sending 
+     * each message, before waiting for a response.
+     * 
+     * In this mode flush() waits until the transmit shift register is empty, not just the TX FIFO, polling at 
+     * character intervals instead of every millisecond. See getTurnaroundUs().
+     */
+    SC16IS7xxPort &withRS485(bool suppressEcho = true, bool rtsHighDuringTx = true) { this->rs485 = true; this->rs485SuppressEcho = suppressEcho; this->rs485RtsHighDuringTx = rtsHighDuringTx; return *this; };
+
+    /**
+     * @brief Enable 9-bit multidrop mode with automatic address detection. Call before begin().
+     * 
+     * @param address The address of this node (0 - 255)
+     * @return SC16IS7xxPort& 
+     * 
+     * The parity bit is used as the 9th bit, which is 1 for address bytes and 0 for data bytes. The chip
+     * discards all data until an address byte matching address is received (EFCR[0], EFR[5], and XOFF2), so frames 
+     * for other nodes are not transferred over I2C or SPI. The address byte is not stored in the read buffer. 
+     * When an address byte for a different node is received, the receiver is disabled again.
+     * 
+     * Requires withBufferedRead(). The parity setting in the begin() options is ignored. Bytes sent using write()
+     * are sent as data bytes. Echo suppression in withRS485() is not used in this mode.
+     */
+    SC16IS7xxPort &withMultidrop(uint8_t address) { this->multidrop = true; this->multidropAddress = address; return *this; };
+
+    /**
+     * @brief Set the characters used for Xon/Xoff software flow control. Call before begin().
+     * 
+     * @param xon1 Xon1 character (default: 0x11, DC1)
+     * @param xoff1 Xoff1 character (default: 0x13, DC3)
+     * @param xon2 Xon2 character (default: 0x11)
+     * @param xoff2 Xoff2 character (default: 0x13). Not used in multidrop mode.
+     * @return SC16IS7xxPort& 
+     * 
+     * Only needed if the other side does not use the standard characters. The OPTIONS_FLOW_CONTROL_XON_XOFF options
+     * use Xon1 and Xoff1. Bits 11:8 of the begin() options are copied to EFR[3:0], so the other modes in the 
+     * data sheet, such as Xon2/Xoff2 or two-character sequences, can also be selected.
+     */
+    SC16IS7xxPort &withXonXoffCharacters(uint8_t xon1, uint8_t xoff1, uint8_t xon2 = 0x11, uint8_t xoff2 = 0x13) { 
+        xonXoff[0] = xon1; xonXoff[1] = xon2; xonXoff[2] = xoff1; xonXoff[3] = xoff2; return *this; };
+
+    /**
+     * @brief Set a function to call when the other side sends Xoff to pause transmission. Call before begin().
+     * 
+     * @param handler Function to call. It is called from the worker thread, so it must not block.
+     * @return SC16IS7xxPort& 
+     * 
+     * Requires SC16IS7xxInterface::withIRQ() and OPTIONS_FLOW_CONTROL_XON_XOFF or OPTIONS_FLOW_CONTROL_XON_XOFF_RX.
+     * The chip stops transmitting by itself; this is only a notification. Received Xoff characters are
+     * also counted in SC16IS7xxPortStats::xoffReceived.
+     */
+    SC16IS7xxPort &withXoffHandler(std::function<void()> handler) { this->xoffHandler = handler; return *this; };
+
+    /**
+     * @brief Read the RX FIFO as soon as a delimiter byte is received. Call before begin().
+     * 
+     * @param delimiter The byte that ends a frame or line, such as '\n'
+     * @param handler Optional function to call after data containing the delimiter has been added to the read buffer.
+     * It is called from the worker thread, so it must not block.
+     * @return SC16IS7xxPort& 
+     * 
+     * Requires withBufferedRead(). With SC16IS7xxInterface::withIRQ(), special character detect (EFR[5] and XOFF2)
+     * interrupts when the delimiter is received, instead of waiting for the RX FIFO trigger level or the 4 character 
+     * RX timeout. Without IRQ the handler is still called, after the next poll.
+     * 
+     * This uses XOFF2, so it cannot be used with withMultidrop() or software flow control modes that use Xoff2. 
+     * With IRQ, received Xoff1 characters are not reported by withXoffHandler().
+     */
+    SC16IS7xxPort &withFrameDelimiter(uint8_t delimiter, std::function<void()> handler = nullptr) { 
+        this->frameDelimiterEnabled = true; this->frameDelimiter = delimiter; this->frameHandler = handler; return *this; };
+
+    /**
+     * @brief Receive Modbus RTU frames, which are separated by 3.5 character times of silence. Call before begin().
+     * 
+     * @param handler Function to call for each received frame with a valid CRC. The frame is the address, function
+     * code, and data, and length does not include the 2-byte CRC. It is called from the worker thread, so it must 
+     * not block, and the frame is only valid during the call.
+     * @return SC16IS7xxPort& 
+     * 
+     * Requires withBufferedRead(), and the read buffer should be at least MODBUS_MAX_FRAME bytes. The worker thread
+     * removes each frame from the read buffer, so do not read from this port using read() or readLine().
+     * 
+     * With SC16IS7xxInterface::withIRQ(), the end of a frame is detected by the chip RX timeout interrupt, which
+     * occurs after 4 character times without data. Otherwise, and when a frame ends exactly when the FIFO was
+     * emptied, it's detected when the worker thread has not received data for getModbusGapUs(). In IRQ mode the
+     * worker thread drains the FIFO first, and only ends the frame if the FIFO was empty.
+     * 
+     * Frames with an invalid CRC are counted in SC16IS7xxPortStats::modbusCrcErrors. Cannot be used with withMultidrop().
+     */
+    SC16IS7xxPort &withModbusRTU(std::function<void(const uint8_t *frame, size_t length)> handler) {
+        this->modbusEnabled = true; this->modbusHandler = handler; return *this; };
+
 	/**
 	 * @brief Set up the chip. You must do this before reading or writing.
 	 *
@@ -199,6 +798,12 @@ public:
 	 *
 	 * Available baud rates depend on your oscillator, but with a 1.8432 MHz oscillator, the following are supported:
 	 * 50, 75, 110, 134.5, 150, 300, 600, 1200, 1800, 2000, 2400, 3600, 4800, 7200, 9600, 19200, 38400, 57600, 115200
+	 * 
+	 * The closest divisor and prescaler are selected for the oscillator frequency set using 
+	 * SC16IS7xxInterface::withOscillatorFrequency(). If the actual baud rate differs by more than the 
+	 * withBaudRateTolerance() (default: 2%), or is faster than MAX_BAUD_RATE, begin() returns false
+	 * without changing the chip settings. The maximum baud rate is the oscillator frequency / 16, so 460800
+	 * and 921600 baud require a 7.3728 MHz or 14.7456 MHz oscillator. See getActualBaudRate() and getBaudRateError().
 	 *
 	 * The valid options in standard number of bits; none=N, even=E, odd=O; number of stop bits format:
 	 * OPTIONS_8N1, OPTIONS_8E1, OPTIONS_8O1
@@ -213,6 +818,77 @@ public:
 	 */
 	bool begin(int baudRate, uint32_t options = OPTIONS_8N1);
 
+    /**
+     * @brief Returns the baud rate generated by the chip, which may differ slightly from the one passed to begin()
+     * 
+     * @return int Actual baud rate, rounded to the nearest integer, or 0 if begin() has not been called
+     */
+    int getActualBaudRate() const { return actualBaudRate; };
+
+    /**
+     * @brief Returns the difference between the actual and requested baud rate from the last call to begin()
+     * 
+     * @return float Error in percent. Positive values are faster than requested.
+     */
+    float getBaudRateError() const { return baudRateError; };
+
+    /**
+     * @brief Returns the turnaround time from the last flush() in RS-485 mode
+     * 
+     * @return uint32_t Maximum time in microseconds from the transmitter becoming empty until flush() returned,
+     * with the receiver enabled again
+     * 
+     * This is the earliest time a response to the message can be received. Only set when using withRS485().
+     */
+    uint32_t getTurnaroundUs() const { return turnaroundUs; };
+
+    /**
+     * @brief Returns the Modbus RTU inter-frame silence in microseconds, set from begin()
+     * 
+     * @return uint32_t 3.5 character times, or 1750 microseconds for baud rates above 19200 as in the Modbus 
+     * specification
+     */
+    uint32_t getModbusGapUs() const { return modbusGapUs; };
+
+    /**
+     * @brief Write a Modbus RTU frame, adding the CRC
+     * 
+     * @param frame The address, function code, and data. The CRC is added to the end.
+     * @param size Number of bytes in frame, 1 to MODBUS_MAX_FRAME - 2
+     * @return true if the frame was written
+     * 
+     * Blocks until the line has been silent for getModbusGapUs() after the last frame sent or received, then
+     * writes the frame and CRC with a single write(). In RS-485 mode this also calls flush(), so the receiver is 
+     * enabled for the response when this returns. Otherwise, the time the frame ends is estimated from the data
+     * queued in the write buffer and TX FIFO.
+     */
+    bool writeModbusFrame(const uint8_t *frame, size_t size);
+
+    /**
+     * @brief Calculate the Modbus CRC-16 (polynomial 0xA001 reflected, initial value 0xFFFF) 
+     * 
+     * @param data Data to calculate the CRC of
+     * @param size Number of bytes of data
+     * @param crc Initial value, or the result of a previous call to continue the calculation
+     * @return uint16_t The CRC. It is sent low byte first. The CRC of a frame including its CRC is 0.
+     * 
+     * This uses a 256-entry table, one lookup per byte.
+     */
+    static uint16_t modbusCRC16(const uint8_t *data, size_t size, uint16_t crc = 0xffff);
+
+    /**
+     * @brief Find the divisor and prescaler that produce the baud rate closest to the one requested
+     * 
+     * @param oscillatorFreqHz Oscillator frequency in Hz
+     * @param baudRate Requested baud rate
+     * @param divisor Filled in with the divisor latch value (DLH:DLL), 1 - 65535
+     * @param prescaler4 Filled in with true if the divide by 4 prescaler (MCR[7] = 1) is needed
+     * @return int The actual baud rate, rounded to the nearest integer, or 0 if the parameters are not valid
+     * 
+     * The actual baud rate is oscillatorFreqHz / (prescaler * 16 * divisor). This does not check the tolerance.
+     */
+    static int calculateDivisor(int oscillatorFreqHz, int baudRate, uint16_t &divisor, bool &prescaler4);
+
 
 
 	/**
@@ -223,9 +899,16 @@ public:
 	 * serial is overwritten by new data. Use this option for increased data integrity at the cost of slowing down realtime
 	 * code execution when lots of serial data is sent at once.
 	 *
-	 * blockOnOverrun(false) - when there is no room in the buffer for data to be written, the data is written anyway,
-	 * causing the new data to replace the old data. This option is provided when performance is more important than data
-	 * integrity.
+	 * blockOnOverrun(false) - write() never waits. Data already queued is never overwritten; the new data that does not
+	 * fit is discarded instead:
+	 * - Buffered write mode (withBufferedWrite()): write() copies what fits into the write buffer and returns the number
+	 * of bytes copied. The rest of the new data is discarded.
+	 * - Otherwise, write(buffer, size) writes what fits into the 64-byte TX FIFO and returns the number of bytes written.
+	 * write(c) writes to THR even if the TX FIFO is full, in which case the chip discards the byte.
+	 *
+	 * This option is provided when performance is more important than data integrity. It only affects writing. In
+	 * buffered read mode, when the read buffer is full, received data is left in the RX FIFO and counted in rxBufferFull
+	 * (getStats()), and is lost if the RX FIFO then overruns (lsrOverrun).
 	 */
 	inline void blockOnOverrun(bool value = true) { writeBlocksWhenFull = value; };
 
@@ -233,11 +916,17 @@ public:
 	 * @brief Returns the number of bytes available to read from the serial port
 	 *
 	 * This is a standard Arduino/Wiring method for Stream objects.
+     * 
+     * In buffered read mode, this is the number of bytes in the buffer and does not
+     * access the chip.
 	 */
     virtual int available();
 
 	/**
 	 * @brief Returns the number of bytes available to write into the TX FIFO
+     * 
+     * In buffered write mode, this is the space available in the write buffer and does not
+     * access the chip.
 	 */
     virtual int availableForWrite();
 
@@ -263,6 +952,8 @@ public:
 	 * @brief Block until all serial data is sent.
 	 *
 	 * This is a standard Arduino/Wiring method for Stream objects.
+     * 
+     * In buffered write mode, this waits until the write buffer is empty and the TX FIFO is empty.
 	 */
     virtual void flush();
 
@@ -287,6 +978,8 @@ public:
 	 * This is faster than writing a single byte at time because up to 31 bytes of data can
 	 * be sent or received in an I2C transaction, greatly reducing overhead. For SPI,
      * 64 bytes can be written at a time.
+     * 
+     * In buffered write mode the data is copied into the write buffer and sent from the worker thread.
 	 */
 	virtual size_t write(const uint8_t *buffer, size_t size);
 
@@ -305,6 +998,133 @@ public:
 	 */
 	virtual int read(uint8_t *buffer, size_t size);
 
+    /**
+     * @brief Get the adaptive polling statistics for this port
+     * 
+     * @param reset Clear the statistics after copying them
+     * 
+     * @return SC16IS7xxPollingStats 
+     * 
+     * Only updated when using SC16IS7xxInterface::withAdaptivePolling() and not using withIRQ().
+     * rxMaxFifoLevel / 64 is how close the port has come to overflowing the RX FIFO.
+     */
+    SC16IS7xxPollingStats getPollingStats(bool reset = false);
+
+    /**
+     * @brief Get the interrupt statistics for this port
+     * 
+     * @param reset Clear the statistics after copying them
+     * 
+     * @return SC16IS7xxIrqStats
+     * 
+     * Only updated when using withIRQ(). Each time the IRQ is asserted, all pending interrupt causes
+     * are handled. This reports how many causes were handled per wakeup.
+     */
+    SC16IS7xxIrqStats getIrqStats(bool reset = false);
+
+    /**
+     * @brief Get the performance counters for this port
+     * 
+     * @param reset Clear the counters after copying them
+     * 
+     * @return SC16IS7xxPortStats
+     * 
+     * The counters are copied with interrupts disabled so all of the values are from the same moment.
+     * In buffered read mode, compare rxFifoHighWater to 64 and rxBufferHighWater to the buffer size to 
+     * see how close the port has come to losing data. lsrOverrun counts data that was lost.
+     */
+    SC16IS7xxPortStats getStats(bool reset = false);
+
+    /**
+     * @brief Get the latency histograms for this port
+     * 
+     * @param reset Clear the histograms after copying them
+     * 
+     * @return SC16IS7xxPortHistograms
+     * 
+     * Histograms are only collected after calling withHistograms() on the interface.
+     */
+    SC16IS7xxPortHistograms getHistograms(bool reset = false);
+
+	/**
+	 * @brief Copy multiple bytes without removing them, so they can be read again. Buffered read mode only.
+	 *
+	 * @param buffer The buffer to copy data into. It will not be null terminated.
+	 *
+	 * @param size The maximum number of bytes to copy (buffer size)
+	 *
+	 * @return The number of bytes actually copied or -1 if there are no bytes available, or buffered
+     * read mode is not enabled.
+     * 
+     * Call consume() to remove the bytes once you have processed them.
+	 */
+	int peek(uint8_t *buffer, size_t size);
+
+    /**
+     * @brief Get a pointer to received data in the read buffer without copying it. Buffered read mode only.
+     * 
+     * @param data Filled in with a pointer into the read buffer, or nullptr if there is no data
+     * 
+     * @return The number of bytes that can be accessed at data. 0 if there is no data or buffered
+     * read mode is not enabled.
+     * 
+     * Since the read buffer is circular, this may be less than available(). Call consume() to
+     * remove bytes you have processed, then call peekContiguous() again to get the rest. This is
+     * intended for parsers that can tokenize the data directly in the buffer.
+     * 
+     * The data remains valid until you call consume() or read().
+     */
+    size_t peekContiguous(const uint8_t *&data);
+
+    /**
+     * @brief Remove bytes from the read buffer without copying them. Buffered read mode only.
+     * 
+     * @param count The number of bytes to remove, typically after peekContiguous() or peek(buffer, size)
+     * 
+     * @return The number of bytes actually removed.
+     */
+    size_t consume(size_t count);
+
+    /**
+     * @brief Read a complete line from the read buffer, if available. Buffered read mode only.
+     * 
+     * @param buffer The buffer to copy the line into. The delimiter is replaced by a null terminator.
+     * @param size The size of buffer in bytes. Lines longer than size - 1 bytes are returned in pieces of size - 1 bytes.
+     * If the read buffer fills up without a delimiter, its contents are returned as a piece.
+     * @param delimiter The end of line character (default: '\n'). A '\r' before it is not removed.
+     * @return int The length of the line, not including the delimiter, or -1 if a complete line is not available yet
+     * 
+     * The data is copied once from the read buffer. Data that has already been searched for the delimiter is not
+     * searched again on the next call, so calling this from loop() while a long line arrives is not O(n^2).
+     */
+    int readLine(char *buffer, size_t size, char delimiter = '\n');
+
+    /**
+     * @brief Set a function to call for each complete line from processLines(). Buffered read mode only.
+     * 
+     * @param handler Function to call with the line, which is null terminated, and its length not including the
+     * delimiter. The line is only valid during the call.
+     * @param maxLength Maximum line length. Longer lines are passed to the handler in pieces of maxLength bytes. If the
+     * read buffer fills up without a delimiter, its contents are passed as a piece.
+     * @param delimiter The end of line character (default: '\n')
+     * @return SC16IS7xxPort& 
+     * 
+     * This allocates maxLength + 1 bytes on the heap for lines that wrap around the end of the read buffer. 
+     * Other lines are passed to the handler directly from the read buffer without copying.
+     */
+    SC16IS7xxPort &onLine(std::function<void(const char *line, size_t length)> handler, size_t maxLength = 256, char delimiter = '\n');
+
+    /**
+     * @brief Call the onLine() handler for each complete line in the read buffer
+     * 
+     * @return size_t The number of lines processed
+     * 
+     * Call this from the thread that reads from this port, typically loop(). If you use withFrameDelimiter()
+     * to be notified when a line has been received, the notification is called from the worker thread, 
+     * so it should signal your thread to call processLines().
+     */
+    size_t processLines();
+
 
     // Mask 0x3f of options (low 6 bits) are the data bits, parity, and stop bits
 
@@ -329,35 +1149,174 @@ public:
 	static const uint32_t OPTIONS_FLOW_CONTROL_CTS     = 0b10000000; //!< CTS flow control (/CTS input indicates the other side can receive data)
 	static const uint32_t OPTIONS_FLOW_CONTROL_RTS_CTS = 0b11000000; //!< Hardware flow control in both directions
 
+	static const uint32_t OPTIONS_FLOW_CONTROL_XON_XOFF_TX = 0b1000 << 8; //!< Send Xoff1 and Xon1 when the RX FIFO reaches the withTransmissionControlLevels() levels EFR[3]
+	static const uint32_t OPTIONS_FLOW_CONTROL_XON_XOFF_RX = 0b0010 << 8; //!< Stop transmitting when Xoff1 is received, until Xon1 is received EFR[1]
+	static const uint32_t OPTIONS_FLOW_CONTROL_XON_XOFF    = 0b1010 << 8; //!< Xon/Xoff software flow control in both directions
+
+    static const size_t MODBUS_MAX_FRAME = 256; //!< Maximum Modbus RTU frame size including the CRC
+
+    static const int MAX_BAUD_RATE = 5000000; //!< Maximum baud rate from the data sheet (5 Mbit/s, requires an 80 MHz external clock)
+
+    static const size_t IIR_MAX_CAUSES_PER_IRQ = SC16IS7xxIrqStats::MAX_CAUSES_PER_WAKEUP; //!< Maximum number of interrupt causes handled by handleIIR per wakeup, change it in SC16IS7xxIrqStats so causesPerWakeup is sized to match
+
 
 protected:
     /**
-     * @brief Protected constructor; you never construct one of these directly
+     * @brief Protected constructor; you never construct one of these directly
+     */
+    SC16IS7xxPort() {};
+
+    /**
+     * @brief Protected destructor; you never delete one of these directly
+     */
+    virtual ~SC16IS7xxPort() {};
+
+    /**
+     * @brief This class is not copyable
+     */
+    SC16IS7xxPort(const SC16IS7xxPort&) = delete;
+
+    /**
+     * @brief This class is not copyable
+     */
+    SC16IS7xxPort& operator=(const SC16IS7xxPort&) = delete;
+
+    /**
+     * @brief Returns the number of bytes in the hardware RX FIFO (RXLVL)
+     * 
+     * This always queries the chip, even in buffered read mode.
+     */
+    int availableInternal();
+
+    /**
+     * @brief Returns the number of bytes of space in the hardware TX FIFO (TXLVL)
+     * 
+     * This always queries the chip, even in buffered write mode.
+     */
+    int availableForWriteInternal();
+
+    /**
+     * @brief Move data from the RX FIFO into the read buffer. Called from the worker thread in buffered read mode.
+     */
+    void readFifoToBuffer();
+
+    /**
+     * @brief Add reading RXLVL and the RX FIFO into the read buffer to a batch
+     * 
+     * After executing the batch, call completeReadFifoBatch().
+     */
+    void addReadFifoToBatch(SC16IS7xxBatch &batch);
+
+    /**
+     * @brief Commit data read by addReadFifoToBatch() to the read buffer after the batch is executed
+     */
+    void completeReadFifoBatch();
+
+    /**
+     * @brief Add reading rxRemaining bytes from the RX FIFO into the free space in the read buffer to a batch
+     */
+    void addReadFifoDataToBatch(SC16IS7xxBatch &batch);
+
+    /**
+     * @brief Returns the number of FIFO read operations used to read rxBytesRead bytes by addReadFifoDataToBatch()
+     */
+    size_t fifoReadCount() const;
+
+    /**
+     * @brief Find the next line in the read buffer, for readLine() and processLines()
+     * 
+     * @param delimiter End of line character
+     * @param maxLength Maximum line length, not including the delimiter
+     * @param length Filled in with the number of bytes to remove from the buffer, including the delimiter if found
+     * @param delimited Filled in with true if the line ends with the delimiter, false if it is a piece of maxLength bytes
+     * without one, or the contents of a full read buffer
+     * @return true if a line or a piece of a long line is available
+     */
+    bool findLine(uint8_t delimiter, size_t maxLength, size_t &length, bool &delimited);
+
+    /**
+     * @brief Check for the end of a Modbus RTU frame, from the worker thread
+     * 
+     * @param bytesRead Number of bytes just read from the FIFO into the read buffer, or 0 if the FIFO was not read
+     * 
+     * If a frame is complete, it's checked and passed to modbusHandler, then removed from the read buffer.
+     */
+    void checkModbusFrame(size_t bytesRead);
+
+    /**
+     * @brief Returns true if there is a partial Modbus RTU frame in the read buffer and no data has been read for getModbusGapUs()
+     */
+    bool isModbusGapElapsed() const;
+
+    /**
+     * @brief Used by the worker thread in IRQ mode to wake up when a partial Modbus RTU frame could be complete
+     * 
+     * @param now Value of micros()
+     * @param waitMs Updated if this port needs to check for the end of a frame sooner than waitMs milliseconds from now
+     */
+    void updateModbusWaitMs(uint32_t now, system_tick_t &waitMs) const;
+
+    /**
+     * @brief Read the RX FIFO in multidrop mode, from completeReadFifoBatch()
+     * 
+     * @return size_t Number of bus operations
+     * 
+     * Data bytes are stored in the read buffer only after this port's address byte. Address bytes are not stored.
+     */
+    size_t readFifoMultidrop();
+
+    /**
+     * @brief Move data from the write buffer into the TX FIFO. Called from the worker thread in buffered write mode.
+     */
+    void writeBufferToFifo();
+
+    /**
+     * @brief Enable or disable the THR interrupt (IER[1]). Called from the worker thread.
+     */
+    void setTHRInterrupt(bool enable);
+
+    /**
+     * @brief Returns true if an adaptive polling deadline has been reached (or is less than 1 millisecond away)
      */
-    SC16IS7xxPort() {};
+    bool isServiceDue(uint32_t deadlineUs) const;
 
     /**
-     * @brief Protected destructor; you never delete one of these directly
+     * @brief Used by the worker thread to find the earliest deadline of all ports
+     * 
+     * @param now Value of micros() 
+     * @param nextServiceUs Updated if this port needs service sooner than nextServiceUs microseconds from now
      */
-    virtual ~SC16IS7xxPort() {};
+    void updateNextServiceUs(uint32_t now, uint32_t &nextServiceUs) const;
 
     /**
-     * @brief This class is not copyable
+     * @brief Called after the worker thread services the port, to update histograms.serviceIntervalUs
      */
-    SC16IS7xxPort(const SC16IS7xxPort&) = delete;
+    void recordService();
 
     /**
-     * @brief This class is not copyable
+     * @brief Update the LSR error counters in stats from a value of LSR
      */
-    SC16IS7xxPort& operator=(const SC16IS7xxPort&) = delete;
+    void countLineStatus(uint8_t lsr);
 
     /**
      * @brief Handle reading the IIR register and dispatching to the interrupt handler
      * 
      * This is used interally and you cannot call it.
+     * 
+     * IIR is read repeatedly until no interrupts are pending, up to IIR_MAX_CAUSES_PER_IRQ times.
      */
     void handleIIR();
 
+    /**
+     * @brief Disables the receiver before transmitting in RS-485 mode with echo suppression
+     */
+    void rs485BeforeWrite();
+
+    /**
+     * @brief flush() in RS-485 mode. Waits for the transmitter to be empty and enables the receiver.
+     */
+    void flushRS485();
+
 
 	bool hasPeek = false; //!< There is a byte from the last peek() available
 	uint8_t peekByte = 0; //!< The byte that was read if hasPeek == true
@@ -367,14 +1326,71 @@ protected:
     uint8_t lcr = 0; //!< Value of the LCR register, set from begin()
     uint8_t efr = 0; //!< Value of the EFR register, set from begin()
     uint8_t mcr = 0; //!< Value of the MCR register, set from begin()
-    uint8_t tcr = (uint8_t)(30 << 4 | 60); //!< Default TCR value for hardware flow control (resume 30, halt 60)
+    uint8_t efcr = 0; //!< Value of the EFCR register, set from begin()
+    uint8_t tcr = (uint8_t)((28 / 4) << 4 | (60 / 4)); //!< Default TCR value for flow control (resume 28, halt 60)
     uint8_t tlr = 0; //!< Value of the TLR register, set from begin()
     SC16IS7xxInterface *interface = nullptr; //!< Interface object for this chip
 
     SC16IS7xxBuffer *readBuffer = nullptr; //!< Buffer object when using withReadBuffer
     size_t bufferedReadSize = 0; //!< Size of buffer for buffered read (0 = buffered read not enabled)
+    bool bufferedReadLockFree = true; //!< Use lock-free single producer, single consumer mode for the read buffer
+    SC16IS7xxBuffer *writeBuffer = nullptr; //!< Buffer object when using withBufferedWrite
+    size_t bufferedWriteSize = 0; //!< Size of buffer for buffered write (0 = buffered write not enabled)
+    bool bufferedWriteLockFree = false; //!< Use lock-free single producer, single consumer mode for the write buffer
+    bool readThreadFunctionRegistered = false; //!< The IRQ mode buffered read thread function was registered by begin()
+    bool writeThreadFunctionRegistered = false; //!< The buffered write thread function was registered by begin()
+    uint8_t writeFifoInterruptLevel = 32; //!< Interrupt when TX FIFO has 32 spaces (buffered write with IRQ)
+    bool writeSpaceAvailable = false; //!< Set from interruptTHR
+    bool thrInterruptEnabled = false; //!< IER[1] is set because there is data in the write buffer
+    bool rs485 = false; //!< RS-485 mode with automatic RTS direction control, set by withRS485()
+    bool rs485SuppressEcho = false; //!< Disable the receiver while transmitting, set by withRS485()
+    bool rs485RtsHighDuringTx = true; //!< Invert RTS (EFCR[5]) so it is high while transmitting, set by withRS485()
+    uint32_t turnaroundUs = 0; //!< RS-485 turnaround time from the last flush()
+    bool multidrop = false; //!< 9-bit multidrop mode with address detection, set by withMultidrop()
+    uint8_t multidropAddress = 0; //!< Address of this node in multidrop mode, set by withMultidrop()
+    bool multidropMatched = false; //!< The last address byte received was multidropAddress, so data is stored
+    uint8_t xonXoff[4] = { 0x11, 0x11, 0x13, 0x13 }; //!< XON1, XON2, XOFF1, XOFF2 characters, set by withXonXoffCharacters()
+    std::function<void()> xoffHandler = nullptr; //!< Function to call when Xoff is received, set by withXoffHandler()
+    size_t lineScanned = 0; //!< Bytes after the read position that are known not to contain lineScanDelimiter
+    uint8_t lineScanDelimiter = '\n'; //!< Delimiter that lineScanned applies to
+    std::function<void(const char *line, size_t length)> lineHandler = nullptr; //!< Function to call for each line, set by onLine()
+    char *lineBuffer = nullptr; //!< Buffer for lines that wrap around the end of the read buffer, allocated by onLine()
+    size_t lineMaxLength = 0; //!< Maximum line length, set by onLine()
+    char lineDelimiter = '\n'; //!< End of line character, set by onLine()
+    bool frameDelimiterEnabled = false; //!< Check received data for frameDelimiter, set by withFrameDelimiter()
+    uint8_t frameDelimiter = 0; //!< Delimiter byte, set by withFrameDelimiter()
+    std::function<void()> frameHandler = nullptr; //!< Function to call when the delimiter is received, set by withFrameDelimiter()
+    bool modbusEnabled = false; //!< Modbus RTU framing, set by withModbusRTU()
+    std::function<void(const uint8_t *frame, size_t length)> modbusHandler = nullptr; //!< Function to call for each frame, set by withModbusRTU()
+    uint8_t *modbusFrame = nullptr; //!< Buffer for frames that wrap around the end of the read buffer, allocated by begin()
+    uint32_t modbusGapUs = 0; //!< Modbus RTU inter-frame silence, set from begin()
+    volatile uint32_t modbusLastRxUs = 0; //!< micros() value of the last FIFO read that returned data in Modbus RTU mode
+    uint32_t modbusTxEndUs = 0; //!< micros() value when the last frame from writeModbusFrame() was sent
+    bool modbusRxTimeout = false; //!< Set from interruptRxTimeout in Modbus RTU mode
+    float baudRateTolerance = 2.0f; //!< Maximum baud rate error in percent, set by withBaudRateTolerance()
+    int actualBaudRate = 0; //!< Baud rate generated by the chip, set from begin()
+    float baudRateError = 0.0f; //!< Difference between the actual and requested baud rate in percent, set from begin()
+    uint32_t charTimeUs = 0; //!< Time to transmit one character at the current baud rate and options, set from begin()
+    uint32_t rxDeadlineUs = 0; //!< Adaptive polling: micros() value when the RX FIFO should be read next
+    uint32_t txDeadlineUs = 0; //!< Adaptive polling: micros() value when the TX FIFO should be refilled next
+    bool txDeadlineValid = false; //!< Adaptive polling: txDeadlineUs is set because the write buffer has data
+    SC16IS7xxPollingStats pollingStats; //!< Adaptive polling statistics
+    SC16IS7xxIrqStats irqStats; //!< Interrupt statistics
+    uint8_t lineStatus = 0; //!< Value of LSR read in handleIIR for a line status interrupt
+    SC16IS7xxPortStats stats; //!< Performance counters, only modified with interrupts disabled
+    SC16IS7xxPortHistograms histograms; //!< Latency histograms, only modified with interrupts disabled
+    uint32_t lastServiceUs = 0; //!< micros() value of the last service, for histograms.serviceIntervalUs
+    bool lastServiceValid = false; //!< lastServiceUs has been set
+    uint32_t lastIrqSequence = 0; //!< Value of interface->irqSequence when irqToDrainUs was last recorded
+    uint8_t rxLineStatus = 0; //!< LSR, read in the same batch as RXLVL by addReadFifoToBatch()
+    size_t rxFirstRegionSize = 0; //!< Size of the first read buffer region in the batch, used to count bus operations
+    uint8_t *rxRegion[2] = { nullptr, nullptr }; //!< Read buffer regions the batch reads the FIFO into, used to find the delimiter
     uint8_t readFifoInterruptLevel = 30; //!< Interrupt when FIFO has 30 characters (or timeout)
     bool readDataAvailable = false; //!< Set from interruptRxTimeout and interruptRHR
+    uint8_t rxLevel = 0; //!< RXLVL from the last read of the FIFO into the read buffer
+    uint8_t rxRemaining = 0; //!< Bytes left to read from the FIFO during a batch read
+    size_t rxBytesRead = 0; //!< Bytes read from the FIFO into the read buffer during a batch read
+    bool rxBatched = false; //!< This port was added to the worker's batch by serviceReadBuffers()
 
     std::function<void()> interruptLineStatus = nullptr; //!< Function to call for a line status interrupt
     std::function<void()> interruptRxTimeout = nullptr; //!< Function to call for stale data in RX FIFO
@@ -437,6 +1453,20 @@ public:
      */
     SC16IS7xxInterface &withI2C(TwoWire *wire = &Wire, uint8_t addr = 0);
 
+    /**
+     * @brief Sets the size of the I2C buffers, if enlarged using acquireWireBuffer(). Default: 32.
+     * 
+     * @param bufferSize The size of the I2C transmit and receive buffers in bytes
+     * @return SC16IS7xxInterface& 
+     * 
+     * With the default 32 byte buffers, reading a full 64 byte FIFO takes two I2C transactions and writing takes
+     * three, since one byte of the transmit buffer is used for the register address. If you define 
+     * acquireWireBuffer() in your application to allocate buffers of at least 65 bytes, pass the size here so 
+     * an entire FIFO is transferred in a single transaction. Device OS does not provide a way to find the 
+     * buffer size, so it must be specified.
+     */
+    SC16IS7xxInterface &withI2CBufferSize(size_t bufferSize);
+
     /**
      * @brief Chip is connected by SPI
      * 
@@ -452,7 +1482,8 @@ public:
     /**
      * @brief Set the oscillator frequency for the chip
      * 
-     * @param freqHz Typically 1843200 (default, 1.8432 MHz), or 3072000 (3.072 MHz).
+     * @param freqHz Typically 1843200 (default, 1.8432 MHz), or 3072000 (3.072 MHz). Use 7372800 or 14745600
+     * for 460800 or 921600 baud. Crystals can be up to 24 MHz and an external clock up to 80 MHz.
      * @return * SC16IS7xxInterface& 
      * 
      * This call must be make before any begin() calls. It will have no effect after begin().
@@ -475,9 +1506,137 @@ public:
      * @return SC16IS7xxInterface& 
      * 
      * This call must be make before any begin() calls. It will have no effect after begin().
+     * 
+     * The pin is attached to a falling edge interrupt handler which wakes the worker thread. When 
+     * the IRQ is not asserted, the worker thread sleeps instead of checking the chip every millisecond.
      */
     SC16IS7xxInterface &withIRQ(pin_t irqPin, PinMode mode = INPUT_PULLUP);
 
+    /**
+     * @brief Use adaptive, baud rate aware polling in the worker thread instead of polling every millisecond
+     * 
+     * @param fifoLevel The RX FIFO level (1 - 63) the port should be serviced at, assuming data arrives continuously
+     * at the full baud rate. Default: 48 (75% full). The TX FIFO is refilled when it drains to 64 - fifoLevel bytes.
+     * @param maxIntervalMs The maximum time between checks of a port, which limits latency at low baud rates. Default: 100.
+     * @return SC16IS7xxInterface& 
+     * 
+     * This only affects buffered read and buffered write mode when not using withIRQ(). After each service, the worker
+     * thread computes when each port's FIFO could reach fifoLevel from its baud rate, word length, and the current
+     * FIFO level, and sleeps until the earliest deadline. A 1200 baud port is checked a few times per second instead
+     * of 1000 times per second.
+     * 
+     * The worker thread can only sleep in 1 millisecond increments, so at very high baud rates a 64-byte FIFO can 
+     * still fill faster than it's checked. Use SC16IS7xxPort::getPollingStats() to verify the margin.
+     * 
+     * This call must be make before any begin() calls.
+     */
+    SC16IS7xxInterface &withAdaptivePolling(uint8_t fifoLevel = 48, system_tick_t maxIntervalMs = 100);
+
+    /**
+     * @brief Use asynchronous SPI DMA for reading the RX FIFO
+     *
+     * @param minSize Only use DMA for FIFO reads of at least this many bytes. Default: 16.
+     * @return SC16IS7xxInterface&
+     *
+     * Must be called after withSPI(). Has no effect with I2C.
+     *
+     * Normally SPI FIFO reads use the blocking form of SPI.transfer(), which busy-waits for the transfer to
+     * complete. With this option the transfer is started with a completion callback and the calling thread
+     * (normally the worker thread) blocks on a semaphore until it completes, so other threads can run during 
+     * the transfer. With multiple chips, each on their own SPI bus, the worker thread for each chip runs
+     * while the others wait for their DMA transfers. In buffered read mode the data is transferred directly 
+     * into the read buffer and committed when the transfer completes.
+     * 
+     * Small reads are faster without DMA because of the setup and context switch overhead.
+     *
+     * Since the SPI DMA completion callback has no context parameter, at most SPI_DMA_MAX_BUSES different
+     * SPI buses can use this option.
+     */
+    SC16IS7xxInterface &withSpiDma(size_t minSize = 16);
+
+    /**
+     * @brief Enable or disable the shadow register cache. Default: disabled.
+     *
+     * @param enable true to enable (the default for this call), false to always access the chip
+     * @return SC16IS7xxInterface&
+     *
+     * The interface keeps a per-channel copy of the configuration registers (IER, LCR, MCR, TCR, TLR, SPR,
+     * DLL, DLH, EFR, XON1, XON2, XOFF1, XOFF2, IODIR, IOINTENA, EFCR). Writes of the value the register already
+     * contains are skipped, and reads of a known configuration register are returned from memory. Status
+     * registers such as LSR, IIR, RXLVL, and TXLVL are always read from the chip.
+     *
+     * If the chip is reset by its hardware reset pin or loses power, call invalidateShadowRegisters().
+     * softwareReset(), powerOnCheck(), and SC16IS7xxPort::begin() do this automatically. A reset that is not 
+     * detected, such as a brown-out of the chip only, is not visible in the cache, and later read-modify-write 
+     * operations use the old register values. Enable withShadowVerify() to detect this.
+     */
+    SC16IS7xxInterface &withShadowRegisters(bool enable = true);
+
+    /**
+     * @brief Periodically compare the shadow registers with the chip from the worker thread
+     *
+     * @param intervalMs How often to compare, in milliseconds, or 0 to disable. The default is 0, or 10000
+     * in debug builds (DEBUG_BUILD defined).
+     * @return SC16IS7xxInterface&
+     *
+     * This is intended for debugging. See verifyShadowRegisters().
+     */
+    SC16IS7xxInterface &withShadowVerify(system_tick_t intervalMs);
+
+    /**
+     * @brief Collect latency histograms and bus utilization
+     * 
+     * @param enable true to enable (default), false to disable
+     * @return SC16IS7xxInterface& 
+     * 
+     * This adds two micros() calls to each bus operation. See getBusOpHistogram(), getBusUtilization(),
+     * and SC16IS7xxPort::getHistograms().
+     */
+    SC16IS7xxInterface &withHistograms(bool enable = true);
+
+    /**
+     * @brief Get the histogram of FIFO read and write durations
+     * 
+     * @param reset Clear the histogram after copying it
+     * @return SC16IS7xxHistogram 
+     * 
+     * Each readInternal() and writeInternal() operation, including those in batches, is one value. 
+     * Only collected after calling withHistograms().
+     */
+    SC16IS7xxHistogram getBusOpHistogram(bool reset = false);
+
+    /**
+     * @brief Get the percentage of time the bus was in use by this chip
+     * 
+     * @param reset Start a new measurement period
+     * @return float Percentage (0 - 100) of the time since withHistograms() or the last reset that a
+     * SPI or I2C transfer for this chip was in progress. Register reads and writes handled by the shadow
+     * register cache (withShadowRegisters()) are not counted.
+     * 
+     * If this is high on I2C, consider using SPI, a higher I2C clock speed, withAdaptivePolling(), or
+     * withIRQ(). Only collected after calling withHistograms().
+     * 
+     * The period is measured using micros(), so reset at least every 70 minutes.
+     */
+    float getBusUtilization(bool reset = false);
+
+    /**
+     * @brief Discard the shadow register cache so all registers are read from the chip again
+     */
+    void invalidateShadowRegisters();
+
+    /**
+     * @brief Compare the shadow register cache to the actual register values on the chip
+     *
+     * @return true All cached registers match
+     * @return false One or more registers did not match. These are logged and removed from the cache.
+     *
+     * Reading the DLL, DLH, EFR, and Xon/Xoff registers requires temporarily changing LCR, which
+     * can affect the format of a character being sent or received at that moment. This is intended
+     * for debugging.
+     */
+    bool verifyShadowRegisters();
+
     /**
      * @brief Do a software reset of the device
      */
@@ -496,7 +1655,7 @@ public:
      * 
      * @param reg The register number to read. Note that this should be the register 0 - 16, before shifting for channel.
      */
-	uint8_t readRegister(uint8_t channel, uint8_t reg);
+	virtual uint8_t readRegister(uint8_t channel, uint8_t reg);
 
 	/**
      * @brief Write a register
@@ -507,7 +1666,16 @@ public:
      *
      * @param value The value to write
      */
-	bool writeRegister(uint8_t channel, uint8_t reg, uint8_t value);
+	virtual bool writeRegister(uint8_t channel, uint8_t reg, uint8_t value);
+
+    /**
+     * @brief Execute a batch of register and FIFO operations in a single bus transaction
+     * 
+     * @param batch The batch to execute. Results of reads are stored in the locations passed when adding them.
+     * @return true All operations succeeded
+     * @return false One or more operations failed
+     */
+    virtual bool execute(SC16IS7xxBatch &batch);
 
 
     /**
@@ -551,6 +1719,33 @@ public:
 	static const uint8_t XOFF1_REG = 0x06; //!< Xoff1 word
 	static const uint8_t XOFF2_REG = 0x07; //!< Xoff2 word
 
+    static const size_t IRQ_MAX_IMMEDIATE_RETRIES = 4; //!< Times to immediately re-service a still-asserted IRQ before waiting
+
+    // Shadow register cache indexes
+    static const uint8_t SHADOW_IER = 0; //!< Shadow index of IER
+    static const uint8_t SHADOW_LCR = 1; //!< Shadow index of LCR
+    static const uint8_t SHADOW_MCR = 2; //!< Shadow index of MCR
+    static const uint8_t SHADOW_TCR = 3; //!< Shadow index of TCR (MCR[2] = 1 and EFR[4] = 1)
+    static const uint8_t SHADOW_TLR = 4; //!< Shadow index of TLR (MCR[2] = 1 and EFR[4] = 1)
+    static const uint8_t SHADOW_SPR = 5; //!< Shadow index of SPR
+    static const uint8_t SHADOW_IODIR = 6; //!< Shadow index of IODIR
+    static const uint8_t SHADOW_IOINTENA = 7; //!< Shadow index of IOINTENA
+    static const uint8_t SHADOW_EFCR = 8; //!< Shadow index of EFCR
+    static const uint8_t SHADOW_DLL = 9; //!< Shadow index of DLL (special register set)
+    static const uint8_t SHADOW_DLH = 10; //!< Shadow index of DLH (special register set)
+    static const uint8_t SHADOW_EFR = 11; //!< Shadow index of EFR (enhanced register set)
+    static const uint8_t SHADOW_XON1 = 12; //!< Shadow index of XON1 (enhanced register set)
+    static const uint8_t SHADOW_XON2 = 13; //!< Shadow index of XON2 (enhanced register set)
+    static const uint8_t SHADOW_XOFF1 = 14; //!< Shadow index of XOFF1 (enhanced register set)
+    static const uint8_t SHADOW_XOFF2 = 15; //!< Shadow index of XOFF2 (enhanced register set)
+    static const uint8_t SHADOW_NUM_REGS = 16; //!< Number of registers in the shadow register cache
+    static const uint8_t SHADOW_NOT_CACHED = 0xff; //!< Register is a status or data register that is never cached
+    static const uint8_t SHADOW_UNKNOWN = 0xfe; //!< Register can't be identified because LCR, MCR, or EFR is not known
+    static const size_t SHADOW_MAX_CHANNELS = 2; //!< Number of channels in the shadow register cache
+
+    static const size_t SPI_DMA_MAX_BUSES = 2; //!< Maximum number of SPI buses that can use withSpiDma()
+    static const system_tick_t SPI_DMA_TIMEOUT_MS = 100; //!< Maximum time to wait for a SPI DMA transfer to complete
+
 protected:
     SC16IS7xxInterface() {}; //!< You cannot instantiate this directly
     virtual ~SC16IS7xxInterface() {}; //!< You cannot delete this directly
@@ -570,6 +1765,9 @@ protected:
      * 
      * A transaction is a group of related calls. Within the transaction other devices are prohibited
      * from accessing the bus, but thread swapping is still enabled.
+     * 
+     * For SPI, this sets the bus settings but does not assert CS. Each register or FIFO operation
+     * asserts CS separately.
      */
     void beginTransaction();
 
@@ -582,45 +1780,188 @@ protected:
     void endTransaction();
 
 
+    /**
+     * @brief Read a register. Must be called between beginTransaction() and endTransaction().
+     *
+     * @tparam Transport SC16IS7xxSpiTransport or SC16IS7xxI2CTransport
+     *
+     * @param busyUs If histograms are enabled, the time on the bus is added to this. A read answered from the shadow
+     * register cache adds nothing.
+     */
+    template<class Transport>
+    uint8_t readRegisterInTransactionT(uint8_t channel, uint8_t reg, uint32_t &busyUs);
+
+    /**
+     * @brief Write a register. Must be called between beginTransaction() and endTransaction().
+     *
+     * @tparam Transport SC16IS7xxSpiTransport or SC16IS7xxI2CTransport
+     *
+     * @param busyUs If histograms are enabled, the time on the bus is added to this. A write skipped because of the
+     * shadow register cache adds nothing.
+     */
+    template<class Transport>
+    bool writeRegisterInTransactionT(uint8_t channel, uint8_t reg, uint8_t value, uint32_t &busyUs);
+
+    /**
+     * @brief Implementation of readRegister() for a specific transport
+     */
+    template<class Transport>
+    uint8_t readRegisterT(uint8_t channel, uint8_t reg);
+
+    /**
+     * @brief Implementation of writeRegister() for a specific transport
+     */
+    template<class Transport>
+    bool writeRegisterT(uint8_t channel, uint8_t reg, uint8_t value);
+
+    /**
+     * @brief Implementation of readInternal() for a specific transport
+     */
+    template<class Transport>
+    bool readInternalT(uint8_t channel, uint8_t *buffer, size_t size);
+
+    /**
+     * @brief Implementation of writeInternal() for a specific transport
+     */
+    template<class Transport>
+    bool writeInternalT(uint8_t channel, const uint8_t *buffer, size_t size);
+
+    /**
+     * @brief Implementation of execute() for a specific transport
+     */
+    template<class Transport>
+    bool executeT(SC16IS7xxBatch &batch);
+
+    /**
+     * @brief Add a FIFO operation duration to busOpHistogram
+     */
+    void recordBusOp(uint32_t durationUs);
+
+    /**
+     * @brief Add the duration of a bus transaction to the bus utilization
+     */
+    void recordBusBusy(uint32_t durationUs);
+
+    /**
+     * @brief Read a register from the chip, bypassing the shadow register cache. Must be called between
+     * beginTransaction() and endTransaction().
+     *
+     * @return true if the value was read, false if the I2C transaction failed
+     */
+    bool readRegisterUncached(uint8_t channel, uint8_t reg, uint8_t &value);
+
+    /**
+     * @brief Write a register to the chip, bypassing the shadow register cache. Must be called between
+     * beginTransaction() and endTransaction().
+     */
+    bool writeRegisterUncached(uint8_t channel, uint8_t reg, uint8_t value);
+
+    /**
+     * @brief Returns the shadow register cache index for a register, based on the cached LCR, MCR, and EFR
+     *
+     * @return uint8_t The index (0 to SHADOW_NUM_REGS - 1), SHADOW_NOT_CACHED, or SHADOW_UNKNOWN
+     */
+    uint8_t shadowIndex(uint8_t channel, uint8_t reg) const;
+
+    /**
+     * @brief Returns true if the shadow register cache has a value for the index
+     */
+    bool isShadowValid(uint8_t channel, uint8_t index) const {
+        return (channel < SHADOW_MAX_CHANNELS) && (index < SHADOW_NUM_REGS) && (shadowValid[channel] & (1 << index)) != 0;
+    };
+
+    /**
+     * @brief Read from the RX FIFO using SPI DMA with a completion callback. Must be called between
+     * beginTransaction() and endTransaction(). Only used when withSpiDma() is enabled.
+     */
+    bool readFifoSpiDma(uint8_t channel, uint8_t *buffer, size_t size);
+
+    /**
+     * @brief Look up a register in the shadow register cache before reading it
+     *
+     * @param value Filled in with the cached value if true is returned
+     * @param index Filled in with the shadow index, to pass to shadowStore() after reading from the chip
+     * @return true if the value came from the cache
+     */
+    bool shadowLookup(uint8_t channel, uint8_t reg, uint8_t &value, uint8_t &index) const;
+
+    /**
+     * @brief Store a value read from the chip in the shadow register cache. Does nothing if index is not cacheable.
+     */
+    void shadowStore(uint8_t channel, uint8_t index, uint8_t value);
+
+    /**
+     * @brief Returns true if a register write can be skipped because the register already contains value
+     *
+     * @param index Filled in with the shadow index, to pass to shadowAfterWrite()
+     */
+    bool shadowSkipWrite(uint8_t channel, uint8_t reg, uint8_t value, uint8_t &index) const;
+
+    /**
+     * @brief Update the shadow register cache after writing a register to the chip
+     */
+    void shadowAfterWrite(uint8_t channel, uint8_t reg, uint8_t index, uint8_t value, bool result);
+
 	/**
 	 * @brief Internal function to read data
 	 *
-	 * It can only read 32 bytes at a time, the maximum that will fit in a 32 byte I2C transaction with
-	 * the register address in the first byte.
+	 * With I2C, it can only read readInternalMax() bytes at a time, which depends on the I2C buffer size 
+	 * (32 bytes by default).
 	 */
-	bool readInternal(uint8_t channel, uint8_t *buffer, size_t size);
-
+	virtual bool readInternal(uint8_t channel, uint8_t *buffer, size_t size);
 
 	/**
 	 * @brief Internal function to write data
 	 *
-	 * It can only write 31 bytes at a time, the maximum that will fit in a 32 byte I2C transaction with
-	 * the register address in the first byte.
+	 * With I2C, it can only write writeInternalMax() bytes at a time, one less than the I2C buffer size 
+	 * (31 bytes by default) because the register address is in the first byte.
 	 */
 	virtual bool writeInternal(uint8_t channel, const uint8_t *buffer, size_t size);
 
 	/**
 	 * @brief Maximum number of bytes that can be read by readInternal
 	 */
-	size_t readInternalMax() const;
+	virtual size_t readInternalMax() const;
 
 	/**
 	 * @brief Maximum number of bytes that can be written by writeInternal
 	 */
-	size_t writeInternalMax() const;
+	virtual size_t writeInternalMax() const;
 
     /**
      * @brief Adds a new function to be called from the worker thread
      * 
-     * @param fn The function or lambda to call
+     * @param fn The function or lambda to call. If nullptr, only creates the worker thread.
      */
     void registerThreadFunction(std::function<void()> fn);
 
+    /**
+     * @brief Called from the worker thread to read the RX FIFO of all ports in buffered read mode in one batch
+     * 
+     * Only used when not using withIRQ(). In IRQ mode, each port is read when it interrupts.
+     */
+    void serviceReadBuffers();
+
     /**
      * @brief Thread function called from FreeRTOS. Never returns!
      */
     void threadFunction();
 
+    /**
+     * @brief Wake the worker thread if it's waiting for an interrupt
+     * 
+     * This is used when there is new work for the worker thread that the chip won't interrupt for,
+     * such as data added to the write buffer. Does nothing if not using withIRQ() or withAdaptivePolling().
+     */
+    void wakeWorker();
+
+    /**
+     * @brief Interrupt service routine for irqPin. Called at interrupt time!
+     * 
+     * This only gives workerSemaphore to wake the worker thread.
+     */
+    void irqHandler();
+
     /**
      * @brief Static thread function, called from FreeRTOS
      *
@@ -632,6 +1973,7 @@ protected:
 
     TwoWire *wire = nullptr; //!< When using I2C, the Wire object, typically Wire, but could be Wire1.
     uint8_t i2cAddr = 0; //!< When using I2C, the I2C address of the SC16IS7xx chip.
+    size_t i2cBufferSize = 32; //!< When using I2C, the size of the Wire transmit and receive buffers, set by withI2CBufferSize()
     SPIClass *spi = nullptr; //!< When using SPI, the SPI object (typically SPI or SPI1).
     pin_t csPin = PIN_INVALID; //!< When using SPI, the CS pin (required for SPI)
     pin_t irqPin = PIN_INVALID; //!< Hardware IRQ from SC16IS7xx, optional.
@@ -640,12 +1982,451 @@ protected:
     bool enableGPIO; //!< Enable GPIO mode
     int oscillatorFreqHz = 1843200; //!< Oscillator frequency. Default is 1.8432 MHz, can also be 3072000 (3.072 MHz).
     Thread *workerThread = nullptr; //!< Worker thread, created if registerThreadFunction() is called.
+    os_semaphore_t workerSemaphore = nullptr; //!< Given to wake the worker thread, created by withIRQ() or withAdaptivePolling()
+    system_tick_t irqIdleTimeoutMs = 100; //!< In IRQ mode, maximum time the worker thread waits for an interrupt
+    bool adaptivePolling = false; //!< Use adaptive polling, set by withAdaptivePolling()
+    uint8_t adaptivePollingFifoLevel = 48; //!< Adaptive polling: RX FIFO level to service the port at
+    system_tick_t adaptivePollingMaxIntervalMs = 100; //!< Adaptive polling: maximum time between checks
     std::vector<std::function<void()>> threadFunctions; //!< Functions to call from the worker thread, added using registerThreadFunction()
+    RecursiveMutex workerMutex; //!< Held by the worker thread while servicing ports, and by begin() while replacing the buffers
+    bool histogramsEnabled = false; //!< Collect histograms, set by withHistograms()
+    SC16IS7xxHistogram busOpHistogram; //!< Durations of FIFO reads and writes, only modified with interrupts disabled
+    uint64_t busBusyUs = 0; //!< Time spent in bus transactions since busWindowStartUs
+    uint32_t busWindowStartUs = 0; //!< micros() value at the start of the bus utilization measurement period
+    volatile uint32_t irqTimeUs = 0; //!< micros() value of the last IRQ falling edge, set by irqHandler()
+    volatile uint32_t irqSequence = 0; //!< Incremented by irqHandler() for each falling edge
+    SC16IS7xxBatch workerBatch; //!< Batch used from the worker thread (stored here instead of on the worker thread stack)
+    bool shadowEnabled = false; //!< Use the shadow register cache, set by withShadowRegisters()
+    uint8_t shadowValues[SHADOW_MAX_CHANNELS][SHADOW_NUM_REGS] = {}; //!< Shadow register cache values, by channel and SHADOW_ index
+    uint16_t shadowValid[SHADOW_MAX_CHANNELS] = {}; //!< Bit mask of the shadowValues that are known, by channel
+#ifdef DEBUG_BUILD
+    system_tick_t shadowVerifyIntervalMs = 10000; //!< How often the worker thread calls verifyShadowRegisters(), 0 = never
+#else
+    system_tick_t shadowVerifyIntervalMs = 0; //!< How often the worker thread calls verifyShadowRegisters(), 0 = never
+#endif
+    int spiDmaSlot = -1; //!< Index into the SPI DMA completion callback table, or -1 if not using withSpiDma()
+    size_t spiDmaMinSize = 0; //!< Minimum FIFO read size to use SPI DMA, set by withSpiDma()
+    system_tick_t shadowVerifyLastMs = 0; //!< millis() value when verifyShadowRegisters() was last called from the worker thread
 
 
     friend class SC16IS7xxPort; //!< The port object calls the interface object and uses the register contents
+    friend class SC16IS7xxSpiTransport; //!< The SPI transport uses spi, csPin, and spiSettings
+    friend class SC16IS7xxI2CTransport; //!< The I2C transport uses wire and i2cAddr
+};
+
+/**
+ * @brief SPI bus primitives, used as the Transport template parameter
+ * 
+ * All of the functions are inline so when used from SC16IS7x0T or SC16IS7x2T the bus operations compile 
+ * to direct SPI calls. The runtime-selected SC16IS7x0 and SC16IS7x2 also use this class, after checking 
+ * whether SPI or I2C was configured.
+ */
+class SC16IS7xxSpiTransport {
+public:
+    /**
+     * @brief Sets the SPI bus settings and locks the bus. CS is asserted separately for each operation.
+     */
+    static inline void beginTransaction(SC16IS7xxInterface &iface) {
+        iface.spi->beginTransaction(iface.spiSettings);
+    }
+
+    /**
+     * @brief Unlocks the SPI bus
+     */
+    static inline void endTransaction(SC16IS7xxInterface &iface) {
+        iface.spi->endTransaction();
+    }
+
+    /**
+     * @brief Read a register. Must be called between beginTransaction() and endTransaction().
+     */
+    static inline bool readRegister(SC16IS7xxInterface &iface, uint8_t channel, uint8_t reg, uint8_t &value) {
+        // bit 7 (0x80) = read
+        pinResetFast(iface.csPin);
+        iface.spi->transfer(0x80 | reg << 3 | channel << 1);
+        value = (uint8_t) iface.spi->transfer(0);
+        pinSetFast(iface.csPin);
+
+        if (reg != SC16IS7xxInterface::RXLVL_REG && reg != SC16IS7xxInterface::TXLVL_REG) {
+            // Don't log RXLVL and TXLVL because they're called continuously
+            SC16IS7XX_TRACE_BUS(SC16IS7xxEventRing::EVENT_READ_REGISTER, channel, reg, value,
+                "readRegister chan=%d reg=%d value=%d", channel, reg, value);
+        }
+        return true;
+    }
+
+    /**
+     * @brief Write a register. Must be called between beginTransaction() and endTransaction().
+     */
+    static inline bool writeRegister(SC16IS7xxInterface &iface, uint8_t channel, uint8_t reg, uint8_t value) {
+        pinResetFast(iface.csPin);
+        iface.spi->transfer(reg << 3 | channel << 1);
+        iface.spi->transfer(value);
+        pinSetFast(iface.csPin);
+
+        SC16IS7XX_TRACE_BUS(SC16IS7xxEventRing::EVENT_WRITE_REGISTER, channel, reg, value,
+            "writeRegister chan=%d reg=%d value=%d", channel, reg, value);
+        return true;
+    }
+
+    /**
+     * @brief Read from the RX FIFO. Must be called between beginTransaction() and endTransaction().
+     */
+    static inline bool readFifo(SC16IS7xxInterface &iface, uint8_t channel, uint8_t *buffer, size_t size) {
+        if (iface.spiDmaSlot >= 0 && size >= iface.spiDmaMinSize) {
+            return iface.readFifoSpiDma(channel, buffer, size);
+        }
+
+        pinResetFast(iface.csPin);
+        iface.spi->transfer(0x80 | SC16IS7xxInterface::RHR_THR_REG << 3 | channel << 1);
+        iface.spi->transfer(NULL, buffer, size, NULL);
+        pinSetFast(iface.csPin);
+
+        SC16IS7XX_TRACE_BUS(SC16IS7xxEventRing::EVENT_READ_FIFO, channel, 0, size, "readInternal %d bytes", size);
+        return true;
+    }
+
+    /**
+     * @brief Write to the TX FIFO. Must be called between beginTransaction() and endTransaction().
+     */
+    static inline bool writeFifo(SC16IS7xxInterface &iface, uint8_t channel, const uint8_t *buffer, size_t size) {
+        pinResetFast(iface.csPin);
+        iface.spi->transfer(SC16IS7xxInterface::RHR_THR_REG << 3 | channel << 1);
+        iface.spi->transfer(const_cast<uint8_t *>(buffer), NULL, size, NULL);
+        pinSetFast(iface.csPin);
+
+        SC16IS7XX_TRACE_BUS(SC16IS7xxEventRing::EVENT_WRITE_FIFO, channel, 0, size, "writeInternal size=%d", size);
+        return true;
+    }
+
+    /**
+     * @brief Maximum number of bytes in one FIFO read
+     */
+    static inline size_t readInternalMax(const SC16IS7xxInterface &iface) {
+        // SPI does allow a large value here, but the FIFO is limited to this size.
+        return 64;
+    }
+
+    /**
+     * @brief Maximum number of bytes in one FIFO write
+     */
+    static inline size_t writeInternalMax(const SC16IS7xxInterface &iface) {
+        // SPI does allow a large value here, but the FIFO is limited to this size.
+        return 64;
+    }
+};
+
+/**
+ * @brief I2C bus primitives, used as the Transport template parameter
+ * 
+ * All of the functions are inline so when used from SC16IS7x0T or SC16IS7x2T the bus operations compile 
+ * to direct Wire calls.
+ */
+class SC16IS7xxI2CTransport {
+public:
+    /**
+     * @brief Locks the I2C bus
+     */
+    static inline void beginTransaction(SC16IS7xxInterface &iface) {
+        iface.wire->lock();
+    }
+
+    /**
+     * @brief Unlocks the I2C bus
+     */
+    static inline void endTransaction(SC16IS7xxInterface &iface) {
+        iface.wire->unlock();
+    }
+
+    /**
+     * @brief Read a register. Must be called between beginTransaction() and endTransaction().
+     */
+    static inline bool readRegister(SC16IS7xxInterface &iface, uint8_t channel, uint8_t reg, uint8_t &value) {
+        bool result = false;
+
+        iface.wire->beginTransmission(iface.i2cAddr);
+        iface.wire->write(reg << 3 | channel << 1);
+        iface.wire->endTransmission(false);
+
+        value = 0;
+        if (iface.wire->requestFrom(iface.i2cAddr, 1, true) == 1) {
+            value = (uint8_t) iface.wire->read();
+            result = true;
+        }
+
+        if (reg != SC16IS7xxInterface::RXLVL_REG && reg != SC16IS7xxInterface::TXLVL_REG) {
+            // Don't log RXLVL and TXLVL because they're called continuously
+            SC16IS7XX_TRACE_BUS(SC16IS7xxEventRing::EVENT_READ_REGISTER, channel, reg, value,
+                "readRegister chan=%d reg=%d value=%d", channel, reg, value);
+        }
+        return result;
+    }
+
+    /**
+     * @brief Write a register. Must be called between beginTransaction() and endTransaction().
+     */
+    static inline bool writeRegister(SC16IS7xxInterface &iface, uint8_t channel, uint8_t reg, uint8_t value) {
+        iface.wire->beginTransmission(iface.i2cAddr);
+        iface.wire->write(reg << 3 | channel << 1);
+        iface.wire->write(value);
+
+        int stat = iface.wire->endTransmission(true);
+
+        // stat:
+        // 0: success
+        // 1: busy timeout upon entering endTransmission()
+        // 2: START bit generation timeout
+        // 3: end of address transmission timeout
+        // 4: data byte transfer timeout
+        // 5: data byte transfer succeeded, busy timeout immediately after
+
+        if (stat == 0) {
+            SC16IS7XX_TRACE_BUS(SC16IS7xxEventRing::EVENT_WRITE_REGISTER, channel, reg, value,
+                "writeRegister chan=%d reg=%d value=%d stat=%d", channel, reg, value, stat);
+        }
+        else {
+            SC16IS7XX_TRACE_BUS(SC16IS7xxEventRing::EVENT_ERROR, channel, reg, value,
+                "writeRegister chan=%d reg=%d value=%d stat=%d", channel, reg, value, stat);
+        }
+
+        return (stat == 0);
+    }
+
+    /**
+     * @brief Read from the RX FIFO. Must be called between beginTransaction() and endTransaction().
+     */
+    static inline bool readFifo(SC16IS7xxInterface &iface, uint8_t channel, uint8_t *buffer, size_t size) {
+        bool result = false;
+
+        iface.wire->beginTransmission(iface.i2cAddr);
+        iface.wire->write(SC16IS7xxInterface::RHR_THR_REG << 3 | channel << 1);
+        iface.wire->endTransmission(false);
+
+        size_t numRcvd = iface.wire->requestFrom(iface.i2cAddr, size, (uint8_t)true);
+        if (numRcvd == size) {
+            // The data is already in the Wire receive buffer, so readBytes() copies it without waiting
+            result = (iface.wire->readBytes((char *)buffer, size) == size);
+
+            SC16IS7XX_TRACE_BUS(SC16IS7xxEventRing::EVENT_READ_FIFO, channel, 0, size, "readInternal %d bytes", size);
+        }
+        if (numRcvd < size) {
+            _uartLogger.info("readInternal failed numRcvd=%u size=%u", numRcvd, size);
+        }
+        return result;
+    }
+
+    /**
+     * @brief Write to the TX FIFO. Must be called between beginTransaction() and endTransaction().
+     */
+    static inline bool writeFifo(SC16IS7xxInterface &iface, uint8_t channel, const uint8_t *buffer, size_t size) {
+        iface.wire->beginTransmission(iface.i2cAddr);
+        iface.wire->write(SC16IS7xxInterface::RHR_THR_REG << 3 | channel << 1);
+        iface.wire->write(buffer, size);
+
+        int stat = iface.wire->endTransmission(true);
+
+        SC16IS7XX_TRACE_BUS((stat == 0) ? SC16IS7xxEventRing::EVENT_WRITE_FIFO : SC16IS7xxEventRing::EVENT_ERROR, 
+            channel, SC16IS7xxInterface::RHR_THR_REG, size, "writeInternal size=%d stat=%d", size, stat);
+
+        return (stat == 0);
+    }
+
+    /**
+     * @brief Maximum number of bytes in one FIFO read
+     */
+    static inline size_t readInternalMax(const SC16IS7xxInterface &iface) {
+        // Limited by the I2C receive buffer, which can be enlarged using acquireWireBuffer(), and
+        // the FIFO size.
+        return (iface.i2cBufferSize < 64) ? iface.i2cBufferSize : 64;
+    }
+
+    /**
+     * @brief Maximum number of bytes in one FIFO write
+     */
+    static inline size_t writeInternalMax(const SC16IS7xxInterface &iface) {
+        // The first byte of the I2C transmit buffer is the register address, so this is one less than
+        // the buffer size (31 with the default 32 byte buffer).
+        return (iface.i2cBufferSize - 1 < 64) ? iface.i2cBufferSize - 1 : 64;
+    }
 };
 
+#ifndef DOXYGEN_DO_NOT_DOCUMENT
+template<class Transport>
+uint8_t SC16IS7xxInterface::readRegisterInTransactionT(uint8_t channel, uint8_t reg, uint32_t &busyUs) {
+    uint8_t value = 0;
+    uint8_t index;
+
+    if (shadowLookup(channel, reg, value, index)) {
+        return value;
+    }
+    uint32_t startUs = histogramsEnabled ? micros() : 0;
+    bool result = Transport::readRegister(*this, channel, reg, value);
+    if (histogramsEnabled) {
+        busyUs += micros() - startUs;
+    }
+    if (result) {
+        shadowStore(channel, index, value);
+    }
+    return value;
+}
+
+template<class Transport>
+bool SC16IS7xxInterface::writeRegisterInTransactionT(uint8_t channel, uint8_t reg, uint8_t value, uint32_t &busyUs) {
+    uint8_t index;
+
+    if (shadowSkipWrite(channel, reg, value, index)) {
+        return true;
+    }
+    uint32_t startUs = histogramsEnabled ? micros() : 0;
+    bool result = Transport::writeRegister(*this, channel, reg, value);
+    if (histogramsEnabled) {
+        busyUs += micros() - startUs;
+    }
+    shadowAfterWrite(channel, reg, index, value, result);
+    return result;
+}
+
+template<class Transport>
+uint8_t SC16IS7xxInterface::readRegisterT(uint8_t channel, uint8_t reg) {
+    Transport::beginTransaction(*this);
+    uint32_t busyUs = 0;
+    uint8_t value = readRegisterInTransactionT<Transport>(channel, reg, busyUs);
+    if (busyUs) {
+        recordBusBusy(busyUs);
+    }
+    Transport::endTransaction(*this);
+    return value;
+}
+
+template<class Transport>
+bool SC16IS7xxInterface::writeRegisterT(uint8_t channel, uint8_t reg, uint8_t value) {
+    Transport::beginTransaction(*this);
+    uint32_t busyUs = 0;
+    bool result = writeRegisterInTransactionT<Transport>(channel, reg, value, busyUs);
+    if (busyUs) {
+        recordBusBusy(busyUs);
+    }
+    Transport::endTransaction(*this);
+    return result;
+}
+
+template<class Transport>
+bool SC16IS7xxInterface::readInternalT(uint8_t channel, uint8_t *buffer, size_t size) {
+    Transport::beginTransaction(*this);
+    uint32_t startUs = histogramsEnabled ? micros() : 0;
+    bool result = Transport::readFifo(*this, channel, buffer, size);
+    if (histogramsEnabled) {
+        uint32_t durationUs = micros() - startUs;
+        recordBusOp(durationUs);
+        recordBusBusy(durationUs);
+    }
+    Transport::endTransaction(*this);
+    return result;
+}
+
+template<class Transport>
+bool SC16IS7xxInterface::writeInternalT(uint8_t channel, const uint8_t *buffer, size_t size) {
+    Transport::beginTransaction(*this);
+    uint32_t startUs = histogramsEnabled ? micros() : 0;
+    bool result = Transport::writeFifo(*this, channel, buffer, size);
+    if (histogramsEnabled) {
+        uint32_t durationUs = micros() - startUs;
+        recordBusOp(durationUs);
+        recordBusBusy(durationUs);
+    }
+    Transport::endTransaction(*this);
+    return result;
+}
+
+template<class Transport>
+bool SC16IS7xxInterface::executeT(SC16IS7xxBatch &batch) {
+    bool result = true;
+
+    if (batch.overflow) {
+        // Executing only the operations that fit could leave the chip partially configured
+        _uartLogger.error("SC16IS7xxBatch overflowed, not executed");
+        return false;
+    }
+
+    // The SPI settings are only set, or the I2C lock obtained, once for the whole batch
+    Transport::beginTransaction(*this);
+
+    // Only operations that go to the chip are timed, not register reads and writes handled by the shadow
+    // register cache
+    uint32_t busyUs = 0;
+
+    for(size_t ii = 0; ii < batch.numOps; ii++) {
+        SC16IS7xxBatch::Op &op = batch.ops[ii];
+
+        switch(op.type) {
+            case SC16IS7xxBatch::OP_READ_REGISTER:
+                *op.value = readRegisterInTransactionT<Transport>(op.channel, op.reg, busyUs);
+                break;
+
+            case SC16IS7xxBatch::OP_WRITE_REGISTER:
+                if (!writeRegisterInTransactionT<Transport>(op.channel, op.reg, op.writeValue, busyUs)) {
+                    result = false;
+                }
+                break;
+
+            case SC16IS7xxBatch::OP_READ_FIFO: {
+                size_t size = op.size;
+                if (op.remaining) {
+                    // Size comes from the result of an earlier read in this batch, typically RXLVL
+                    if (size > *op.remaining) {
+                        size = *op.remaining;
+                    }
+                    *op.remaining -= (uint8_t) size;
+                }
+                if (size > 0) {
+                    uint32_t startUs = histogramsEnabled ? micros() : 0;
+                    bool readResult = Transport::readFifo(*this, op.channel, op.buffer, size);
+                    if (histogramsEnabled) {
+                        uint32_t durationUs = micros() - startUs;
+                        recordBusOp(durationUs);
+                        busyUs += durationUs;
+                    }
+                    if (readResult) {
+                        if (op.bytesRead) {
+                            *op.bytesRead += size;
+                        }
+                    }
+                    else {
+                        // Don't read any more into this buffer, since the following reads would
+                        // leave a gap where this data should have been
+                        if (op.remaining) {
+                            *op.remaining = 0;
+                        }
+                        result = false;
+                    }
+                }
+                break;
+            }
+
+            case SC16IS7xxBatch::OP_WRITE_FIFO: {
+                uint32_t startUs = histogramsEnabled ? micros() : 0;
+                if (!Transport::writeFifo(*this, op.channel, op.buffer, op.size)) {
+                    result = false;
+                }
+                if (histogramsEnabled) {
+                    uint32_t durationUs = micros() - startUs;
+                    recordBusOp(durationUs);
+                    busyUs += durationUs;
+                }
+                break;
+            }
+        }
+    }
+
+    if (busyUs) {
+        recordBusBusy(busyUs);
+    }
+    Transport::endTransaction(*this);
+
+    return result;
+}
+#endif // DOXYGEN_DO_NOT_DOCUMENT
+
 /**
  * @brief Class for SC16IS740, SC16IS750, SC16IS760 single I2C or SPI UART
  * 
@@ -872,4 +2653,78 @@ protected:
 };
 
 
+/**
+ * @brief SC16IS740, SC16IS750, SC16IS760 with the SPI or I2C transport selected at compile time
+ * 
+ * @tparam Transport SC16IS7xxSpiTransport or SC16IS7xxI2CTransport
+ * 
+ * This works like SC16IS7x0, and you still call withSPI() or withI2C() to configure the bus, which
+ * must match Transport. The bus operations used by the port and the worker thread go directly to 
+ * the transport instead of checking whether SPI or I2C is in use for every register access.
+ * 
+ * ```
+ * SC16IS7x0T<SC16IS7xxSpiTransport> extSerial;
+ * ```
+ */
+template<class Transport>
+class SC16IS7x0T : public SC16IS7x0 {
+public:
+    /**
+     * @brief Default constructor
+     */
+    SC16IS7x0T() {};
+
+    /**
+     * @brief Destructor. This object is typically instantiated as a global variable and never deleted.
+     */
+    virtual ~SC16IS7x0T() {};
+
+	virtual uint8_t readRegister(uint8_t channel, uint8_t reg) override { return readRegisterT<Transport>(channel, reg); }; //!< Read a register using Transport
+	virtual bool writeRegister(uint8_t channel, uint8_t reg, uint8_t value) override { return writeRegisterT<Transport>(channel, reg, value); }; //!< Write a register using Transport
+    virtual bool execute(SC16IS7xxBatch &batch) override { return executeT<Transport>(batch); }; //!< Execute a batch using Transport
+
+protected:
+	virtual bool readInternal(uint8_t channel, uint8_t *buffer, size_t size) override { return readInternalT<Transport>(channel, buffer, size); }; //!< Read the RX FIFO using Transport
+	virtual bool writeInternal(uint8_t channel, const uint8_t *buffer, size_t size) override { return writeInternalT<Transport>(channel, buffer, size); }; //!< Write the TX FIFO using Transport
+	virtual size_t readInternalMax() const override { return Transport::readInternalMax(*this); }; //!< Maximum FIFO read for Transport
+	virtual size_t writeInternalMax() const override { return Transport::writeInternalMax(*this); }; //!< Maximum FIFO write for Transport
+};
+
+/**
+ * @brief SC16IS752, SC16IS762 with the SPI or I2C transport selected at compile time
+ * 
+ * @tparam Transport SC16IS7xxSpiTransport or SC16IS7xxI2CTransport
+ * 
+ * This works like SC16IS7x2, and you still call withSPI() or withI2C() to configure the bus, which
+ * must match Transport.
+ * 
+ * ```
+ * SC16IS7x2T<SC16IS7xxI2CTransport> extSerial;
+ * ```
+ */
+template<class Transport>
+class SC16IS7x2T : public SC16IS7x2 {
+public:
+    /**
+     * @brief Default constructor
+     */
+    SC16IS7x2T() {};
+
+    /**
+     * @brief Destructor. This object is typically instantiated as a global variable and never deleted.
+     */
+    virtual ~SC16IS7x2T() {};
+
+	virtual uint8_t readRegister(uint8_t channel, uint8_t reg) override { return readRegisterT<Transport>(channel, reg); }; //!< Read a register using Transport
+	virtual bool writeRegister(uint8_t channel, uint8_t reg, uint8_t value) override { return writeRegisterT<Transport>(channel, reg, value); }; //!< Write a register using Transport
+    virtual bool execute(SC16IS7xxBatch &batch) override { return executeT<Transport>(batch); }; //!< Execute a batch using Transport
+
+protected:
+	virtual bool readInternal(uint8_t channel, uint8_t *buffer, size_t size) override { return readInternalT<Transport>(channel, buffer, size); }; //!< Read the RX FIFO using Transport
+	virtual bool writeInternal(uint8_t channel, const uint8_t *buffer, size_t size) override { return writeInternalT<Transport>(channel, buffer, size); }; //!< Write the TX FIFO using Transport
+	virtual size_t readInternalMax() const override { return Transport::readInternalMax(*this); }; //!< Maximum FIFO read for Transport
+	virtual size_t writeInternalMax() const override { return Transport::writeInternalMax(*this); }; //!< Maximum FIFO write for Transport
+};
+
+
 #endif // __SC16IS7XXRK
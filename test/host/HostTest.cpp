@@ -0,0 +1,86 @@
+#include "HostTest.h"
+
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// Tests that do not finish in this time fail
+static const unsigned TEST_TIMEOUT_SEC = 60;
+
+struct HostTestCase {
+    const char *name;
+    void (*fn)();
+};
+
+static std::vector<HostTestCase> &hostTests() {
+    static std::vector<HostTestCase> tests;
+    return tests;
+}
+
+HostTestRegistrar::HostTestRegistrar(const char *name, void (*fn)()) {
+    hostTests().push_back(HostTestCase{ name, fn });
+}
+
+void hostTestFail(const char *file, int line, const char *msg) {
+    fprintf(stderr, "%s:%d: check failed: %s\n", file, line, msg);
+    fflush(stderr);
+    mockExit(1);
+}
+
+bool hostTestWaitFor(std::function<bool()> condition, system_tick_t timeoutMs) {
+    system_tick_t start = millis();
+    while(!condition()) {
+        if (millis() - start >= timeoutMs) {
+            return condition();
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+// Usage: hosttest [name-substring]
+int main(int argc, char *argv[]) {
+    const char *filter = (argc > 1) ? argv[1] : nullptr;
+    int passed = 0;
+    int failed = 0;
+
+    for(const HostTestCase &test : hostTests()) {
+        if (filter && !strstr(test.name, filter)) {
+            continue;
+        }
+        fflush(stdout);
+
+        auto start = std::chrono::steady_clock::now();
+        pid_t pid = fork();
+        if (pid == 0) {
+            alarm(TEST_TIMEOUT_SEC);
+            test.fn();
+            fflush(stdout);
+            mockExit(0);
+        }
+
+        int status = 0;
+        waitpid(pid, &status, 0);
+        double elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+            printf("PASS %s (%.0f ms)\n", test.name, elapsedMs);
+            passed++;
+        }
+        else {
+            if (WIFSIGNALED(status)) {
+                printf("FAIL %s (signal %d%s)\n", test.name, WTERMSIG(status), (WTERMSIG(status) == SIGALRM) ? ", timeout" : "");
+            }
+            else {
+                printf("FAIL %s\n", test.name);
+            }
+            failed++;
+        }
+    }
+    printf("%d passed, %d failed\n", passed, failed);
+    return (failed == 0) ? 0 : 1;
+}
@@ -0,0 +1,46 @@
+#ifndef __HOSTTEST_H
+#define __HOSTTEST_H
+
+// Minimal test framework for the host tests. Each TEST() is run in its own child process so
+// the detached worker threads of the library and the simulator cannot affect the next test.
+
+#include "Particle.h"
+
+#include <functional>
+
+/**
+ * @brief Register a test. Used by the TEST() macro.
+ */
+struct HostTestRegistrar {
+    HostTestRegistrar(const char *name, void (*fn)());
+};
+
+/**
+ * @brief Report a failed check and end the test
+ */
+void hostTestFail(const char *file, int line, const char *msg) __attribute__((noreturn));
+
+/**
+ * @brief Wait until condition returns true or timeoutMs elapses. Returns the final value of condition.
+ */
+bool hostTestWaitFor(std::function<bool()> condition, system_tick_t timeoutMs);
+
+#define TEST(name) \
+    static void hostTest_##name(); \
+    static HostTestRegistrar hostTestRegistrar_##name(#name, hostTest_##name); \
+    static void hostTest_##name()
+
+#define EXPECT(cond) \
+    do { if (!(cond)) { hostTestFail(__FILE__, __LINE__, #cond); } } while(0)
+
+#define EXPECT_EQ(a, b) \
+    do { \
+        long long __a = (long long)(a), __b = (long long)(b); \
+        if (__a != __b) { \
+            char __msg[256]; \
+            snprintf(__msg, sizeof(__msg), "%s == %s (%lld != %lld)", #a, #b, __a, __b); \
+            hostTestFail(__FILE__, __LINE__, __msg); \
+        } \
+    } while(0)
+
+#endif /* __HOSTTEST_H */
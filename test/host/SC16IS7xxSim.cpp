@@ -0,0 +1,796 @@
+#include "SC16IS7xxSim.h"
+
+#include <chrono>
+
+// Register numbers
+static const uint8_t REG_RHR_THR = 0x00;
+static const uint8_t REG_IER = 0x01;
+static const uint8_t REG_IIR_FCR = 0x02;
+static const uint8_t REG_LCR = 0x03;
+static const uint8_t REG_MCR = 0x04;
+static const uint8_t REG_LSR = 0x05;
+static const uint8_t REG_MSR_TCR = 0x06;
+static const uint8_t REG_SPR_TLR = 0x07;
+static const uint8_t REG_TXLVL = 0x08;
+static const uint8_t REG_RXLVL = 0x09;
+static const uint8_t REG_IODIR = 0x0a;
+static const uint8_t REG_IOSTATE = 0x0b;
+static const uint8_t REG_IOINTENA = 0x0c;
+static const uint8_t REG_IOCONTROL = 0x0e;
+static const uint8_t REG_EFCR = 0x0f;
+
+// Enhanced register set (LCR = 0xBF) and special register set (LCR[7] = 1)
+static const uint8_t REG_EFR = 0x02;
+static const uint8_t REG_XON1 = 0x04;
+static const uint8_t REG_DLL = 0x00;
+static const uint8_t REG_DLH = 0x01;
+
+// The RX timeout interrupt occurs after 4 character times without receiving or reading data
+static const double RX_TIMEOUT_CHARS = 4.0;
+
+// How often the background thread advances the line and updates the IRQ pin
+static const auto THREAD_INTERVAL = std::chrono::microseconds(20);
+
+// A longer gap between advances means the host was not running the simulator
+static const double HOST_STALL_US = 250.0;
+
+static const auto simStartTime = std::chrono::steady_clock::now();
+
+SC16IS7xxSim::SC16IS7xxSim(Model model, uint32_t oscillatorFreqHz) : model(model), oscillatorFreqHz(oscillatorFreqHz), stop(false) {
+    numChannels = (model == Model::SC16IS752 || model == Model::SC16IS762) ? 2 : 1;
+    resetChip();
+    thread = std::thread([this]() { threadFunction(); });
+}
+
+SC16IS7xxSim::~SC16IS7xxSim() {
+    stop = true;
+    if (thread.joinable()) {
+        thread.join();
+    }
+}
+
+SC16IS7xxSim &SC16IS7xxSim::attachI2C(TwoWire &wire, uint8_t addr) {
+    i2cAddr = addr;
+    wire.mockAttach(this);
+    return *this;
+}
+
+SC16IS7xxSim &SC16IS7xxSim::attachSPI(SPIClass &spi, pin_t csPin) {
+    spi.mockAttach(csPin, this);
+    return *this;
+}
+
+SC16IS7xxSim &SC16IS7xxSim::attachIRQ(pin_t irqPin) {
+    this->irqPin = irqPin;
+    mockSetPin(irqPin, HIGH);
+    mockSetPinReader(irqPin, [this]() {
+        std::lock_guard<std::recursive_mutex> lock(mutex);
+        advance();
+        return irqAsserted(nowUs()) ? LOW : HIGH;
+    });
+    return *this;
+}
+
+double SC16IS7xxSim::nowUs() const {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - simStartTime).count();
+}
+
+void SC16IS7xxSim::resetChip() {
+    double now = nowUs();
+    for(int ii = 0; ii < MAX_CHANNELS; ii++) {
+        Channel &chan = channels[ii];
+
+        // Hardware reset clears the registers and FIFOs but not the other end of the line
+        std::deque<uint16_t> peerTx;
+        std::deque<uint8_t> peerRx;
+        peerTx.swap(chan.peerTx);
+        peerRx.swap(chan.peerRx);
+        uint64_t peerSequenceRemaining = chan.peerSequenceRemaining;
+        uint8_t peerSequenceNext = chan.peerSequenceNext;
+        int loopbackTo = chan.loopbackTo;
+        ChannelStats stats = chan.stats;
+
+        chan = Channel();
+
+        chan.peerTx.swap(peerTx);
+        chan.peerRx.swap(peerRx);
+        chan.peerSequenceRemaining = peerSequenceRemaining;
+        chan.peerSequenceNext = peerSequenceNext;
+        chan.loopbackTo = loopbackTo;
+        chan.stats = stats;
+        chan.rxNextUs = chan.rxLastCharUs = chan.rxLastReadUs = now;
+    }
+    iodir = iostate = iointena = iocontrol = 0;
+}
+
+double SC16IS7xxSim::charTimeUs(const Channel &chan) const {
+    uint32_t divisor = ((uint32_t)chan.dlh << 8) | chan.dll;
+    if (divisor == 0) {
+        return 0;
+    }
+    double baud = (double)oscillatorFreqHz / (((chan.mcr & 0x80) ? 4.0 : 1.0) * 16.0 * divisor);
+
+    // Start bit, 5 - 8 data bits, optional parity, and 1, 1.5, or 2 stop bits
+    double bits = 1.0 + 5.0 + (chan.lcr & 0x03);
+    if (chan.lcr & 0x08) {
+        bits += 1.0;
+    }
+    if (chan.lcr & 0x04) {
+        bits += ((chan.lcr & 0x03) == 0) ? 1.5 : 2.0;
+    }
+    else {
+        bits += 1.0;
+    }
+    return bits * 1000000.0 / baud;
+}
+
+double SC16IS7xxSim::getBaudRate(int channel) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    const Channel &chan = channels[channel];
+    uint32_t divisor = ((uint32_t)chan.dlh << 8) | chan.dll;
+    if (divisor == 0) {
+        return 0;
+    }
+    return (double)oscillatorFreqHz / (((chan.mcr & 0x80) ? 4.0 : 1.0) * 16.0 * divisor);
+}
+
+double SC16IS7xxSim::getCharTimeUs(int channel) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    return charTimeUs(channels[channel]);
+}
+
+size_t SC16IS7xxSim::rxTriggerLevel(const Channel &chan) const {
+    if ((chan.tlr & 0xf0) != 0) {
+        return (size_t)(chan.tlr >> 4) * 4;
+    }
+    static const size_t levels[4] = { 8, 16, 56, 60 };
+    return levels[chan.fcr >> 6];
+}
+
+size_t SC16IS7xxSim::txTriggerLevel(const Channel &chan) const {
+    if ((chan.tlr & 0x0f) != 0) {
+        return (size_t)(chan.tlr & 0x0f) * 4;
+    }
+    static const size_t levels[4] = { 8, 16, 32, 56 };
+    return levels[(chan.fcr >> 4) & 0x03];
+}
+
+void SC16IS7xxSim::updateThrInterrupt(Channel &chan) {
+    // The THR interrupt is set when the number of spaces in the TX FIFO reaches the trigger level, and
+    // cleared by reading IIR or writing THR
+    bool reached = (FIFO_SIZE - chan.txFifo.size()) >= txTriggerLevel(chan);
+    if (reached && !chan.thrLevelReached) {
+        chan.thrInterrupt = true;
+    }
+    chan.thrLevelReached = reached;
+}
+
+bool SC16IS7xxSim::peerHasData(const Channel &chan) const {
+    return !chan.peerTx.empty() || chan.peerSequenceRemaining > 0;
+}
+
+uint16_t SC16IS7xxSim::peerNextChar(Channel &chan) {
+    if (!chan.peerTx.empty()) {
+        uint16_t c = chan.peerTx.front();
+        chan.peerTx.pop_front();
+        return c;
+    }
+    chan.peerSequenceRemaining--;
+    return chan.peerSequenceNext++;
+}
+
+void SC16IS7xxSim::receiveChar(int channel, uint16_t value, double atUs) {
+    Channel &chan = channels[channel];
+    if ((chan.efcr & 0x01) != 0 && (chan.efr & 0x20) != 0 && (value & PEER_ADDRESS) != 0 && (uint8_t)value == chan.xonXoff[3]) {
+        // 9-bit mode EFCR[0] with address detect EFR[5]: an address byte that matches XOFF2 enables the receiver
+        chan.efcr &= ~0x02;
+    }
+    if ((chan.efcr & 0x02) != 0) {
+        // Receiver disabled EFCR[1]
+        return;
+    }
+    chan.rxLastCharUs = atUs;
+    uint8_t c = (uint8_t)value;
+    if ((chan.efr & 0x03) != 0 && (chan.efcr & 0x01) == 0 && (value & 0x700) == 0) {
+        // Software flow control EFR[1:0]: Xoff pauses the transmitter after the current character and Xon resumes it.
+        // EFR[1] compares Xon1 and Xoff1, EFR[0] Xon2 and Xoff2. Both bits are treated as either character, not the
+        // two-character sequences in the data sheet. Flow control characters are not stored in the RX FIFO.
+        bool use1 = (chan.efr & 0x02) != 0;
+        bool use2 = (chan.efr & 0x01) != 0;
+        if ((use1 && c == chan.xonXoff[2]) || (use2 && c == chan.xonXoff[3])) {
+            chan.txPaused = true;
+            chan.xoffInterrupt = true;
+            return;
+        }
+        if ((use1 && c == chan.xonXoff[0]) || (use2 && c == chan.xonXoff[1])) {
+            chan.txPaused = false;
+            if (!chan.txShifting && !chan.txFifo.empty() && (chan.efcr & 0x04) == 0) {
+                chan.txShiftChar = chan.txFifo.front();
+                chan.txFifo.pop_front();
+                chan.txShifting = true;
+                chan.txDoneUs = atUs + charTimeUs(chan);
+                updateThrInterrupt(chan);
+            }
+            return;
+        }
+    }
+    if (chan.rxFifo.size() >= FIFO_SIZE) {
+        // Overrun LSR[1]. The character in the shift register is lost.
+        chan.lsrErrors |= 0x02;
+        chan.stats.rxOverruns++;
+        return;
+    }
+    chan.rxFifo.push_back(value);
+    chan.stats.rxChars++;
+    if ((chan.efr & 0x20) != 0 && (chan.efcr & 0x01) == 0 && c == chan.xonXoff[3]) {
+        // Special character detect EFR[5]: XOFF2 is stored in the RX FIFO and interrupts like Xoff
+        chan.xoffInterrupt = true;
+    }
+}
+
+void SC16IS7xxSim::advanceChannel(int channel, double now) {
+    Channel &chan = channels[channel];
+    double ct = charTimeUs(chan);
+    if (ct <= 0) {
+        // No baud rate set, the line does not move
+        chan.rxNextUs = now;
+        if (chan.txShifting) {
+            chan.txDoneUs = now;
+        }
+        return;
+    }
+
+    // Transmitter: send characters from the shift register, then the TX FIFO
+    while(chan.txShifting && chan.txDoneUs <= now) {
+        double doneUs = chan.txDoneUs;
+        chan.stats.txChars++;
+        if (chan.loopbackTo >= 0) {
+            receiveChar(chan.loopbackTo, chan.txShiftChar, doneUs);
+        }
+        else {
+            chan.peerRx.push_back(chan.txShiftChar);
+        }
+        if (!chan.txFifo.empty() && (chan.efcr & 0x04) == 0 && !chan.txPaused) {
+            chan.txShiftChar = chan.txFifo.front();
+            chan.txFifo.pop_front();
+            chan.txDoneUs = doneUs + ct;
+            updateThrInterrupt(chan);
+        }
+        else {
+            chan.txShifting = false;
+        }
+    }
+
+    // Receiver: characters from the peer. With auto RTS EFR[6], RTS is deasserted at the TCR halt
+    // level, and asserted again at the resume level.
+    if (!peerHasData(chan)) {
+        // The peer is idle. peerWrite() advances first, so new data starts from when it was written.
+        chan.rxNextUs = now;
+        return;
+    }
+    if (chan.rxNextUs < now - ct - HOST_STALL_US) {
+        // The background thread did not run, so the host did not run the driver either. Pause the
+        // peer instead of overrunning the FIFO with data a device would have had time to read.
+        chan.rxNextUs = now - ct - HOST_STALL_US;
+    }
+    while(peerHasData(chan) && chan.rxNextUs + ct <= now) {
+        if ((chan.efr & 0x40) != 0) {
+            size_t halt = (size_t)(chan.tcr & 0x0f) * 4;
+            size_t resume = (size_t)(chan.tcr >> 4) * 4;
+            if (!chan.rxHalted && halt > 0 && chan.rxFifo.size() >= halt) {
+                chan.rxHalted = true;
+            }
+            else
+            if (chan.rxHalted && chan.rxFifo.size() <= resume) {
+                chan.rxHalted = false;
+            }
+            if (chan.rxHalted) {
+                chan.rxNextUs = now - ct;
+                break;
+            }
+        }
+        chan.rxNextUs += ct;
+        uint16_t value = peerNextChar(chan);
+        if ((value & PEER_IDLE) == 0) {
+            receiveChar(channel, value, chan.rxNextUs);
+        }
+    }
+}
+
+void SC16IS7xxSim::advance() {
+    double now = nowUs();
+    for(int ii = 0; ii < numChannels; ii++) {
+        advanceChannel(ii, now);
+    }
+}
+
+uint8_t SC16IS7xxSim::interruptId(int channel, double now) {
+    Channel &chan = channels[channel];
+
+    uint8_t fifoBits = (chan.fcr & 0x01) ? 0xc0 : 0x00;
+
+    // Priority 1: receiver line status
+    if ((chan.ier & 0x04) != 0 && chan.lsrErrors != 0) {
+        return fifoBits | 0x06;
+    }
+    if ((chan.ier & 0x01) != 0 && !chan.rxFifo.empty()) {
+        // Priority 2: RX timeout, stale data in the RX FIFO
+        double ct = charTimeUs(chan);
+        double lastUs = (chan.rxLastCharUs > chan.rxLastReadUs) ? chan.rxLastCharUs : chan.rxLastReadUs;
+        if (ct > 0 && now - lastUs >= RX_TIMEOUT_CHARS * ct && chan.rxFifo.size() < rxTriggerLevel(chan)) {
+            return fifoBits | 0x0c;
+        }
+        // Priority 2: RHR, RX FIFO above the trigger level
+        if (chan.rxFifo.size() >= rxTriggerLevel(chan)) {
+            return fifoBits | 0x04;
+        }
+    }
+    // Priority 3: THR, TX FIFO below the trigger level
+    if ((chan.ier & 0x02) != 0 && chan.thrInterrupt) {
+        return fifoBits | 0x02;
+    }
+    // Priority 6: Xoff or special character received
+    if ((chan.ier & 0x20) != 0 && chan.xoffInterrupt) {
+        return fifoBits | 0x10;
+    }
+    return fifoBits | 0x01;
+}
+
+bool SC16IS7xxSim::irqAsserted(double now) {
+    for(int ii = 0; ii < numChannels; ii++) {
+        if ((interruptId(ii, now) & 0x01) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void SC16IS7xxSim::hardwareReset() {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    advance();
+    resetChip();
+}
+
+bool SC16IS7xxSim::isIrqAsserted() {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    advance();
+    return irqAsserted(nowUs());
+}
+
+uint8_t SC16IS7xxSim::readRegister(int channel, uint8_t reg, bool sideEffects) {
+    Channel &chan = channels[channel];
+
+    if (sideEffects && reg != REG_RHR_THR) {
+        chan.stats.registerReads++;
+    }
+    if (chan.lcr == 0xbf) {
+        // Enhanced register set
+        if (reg == REG_EFR) {
+            return chan.efr;
+        }
+        if (reg >= REG_XON1 && reg <= REG_XON1 + 3) {
+            return chan.xonXoff[reg - REG_XON1];
+        }
+    }
+    if ((chan.lcr & 0x80) != 0) {
+        // Special register set
+        if (reg == REG_DLL) {
+            return chan.dll;
+        }
+        if (reg == REG_DLH) {
+            return chan.dlh;
+        }
+    }
+
+    switch(reg) {
+        case REG_RHR_THR: {
+            if (!sideEffects) {
+                return chan.rxFifo.empty() ? 0 : (uint8_t)chan.rxFifo.front();
+            }
+            chan.rxLastReadUs = nowUs();
+            if (chan.rxFifo.empty()) {
+                return 0;
+            }
+            uint8_t value = (uint8_t)chan.rxFifo.front();
+            chan.rxFifo.pop_front();
+            chan.stats.rhrReads++;
+            return value;
+        }
+
+        case REG_IER:
+            return chan.ier;
+
+        case REG_IIR_FCR: {
+            uint8_t iir = interruptId(channel, nowUs());
+            if (sideEffects && (iir & 0x3f) == 0x02) {
+                // Reading IIR clears the THR interrupt
+                chan.thrInterrupt = false;
+            }
+            if (sideEffects && (iir & 0x3f) == 0x10) {
+                // And the Xoff or special character interrupt
+                chan.xoffInterrupt = false;
+            }
+            return iir;
+        }
+
+        case REG_LCR:
+            return chan.lcr;
+
+        case REG_MCR:
+            return chan.mcr;
+
+        case REG_LSR: {
+            uint8_t lsr = chan.lsrErrors;
+            if (!chan.rxFifo.empty()) {
+                lsr |= 0x01;
+                // Parity, framing, and break errors are for the character at the top of the FIFO
+                lsr |= (uint8_t)((chan.rxFifo.front() >> 6) & 0x1c);
+                for(uint16_t value : chan.rxFifo) {
+                    if ((value & 0x700) != 0) {
+                        lsr |= 0x80;
+                    }
+                }
+            }
+            if (chan.txFifo.empty()) {
+                lsr |= 0x20;
+                if (!chan.txShifting) {
+                    lsr |= 0x40;
+                }
+            }
+            if (sideEffects) {
+                chan.lsrErrors = 0;
+            }
+            return lsr;
+        }
+
+        case REG_MSR_TCR:
+            // MSR: the modem inputs are not modelled, CTS and DSR are inactive
+            return tcrTlrEnabled(chan) ? chan.tcr : 0x00;
+
+        case REG_SPR_TLR:
+            return tcrTlrEnabled(chan) ? chan.tlr : chan.spr;
+
+        case REG_TXLVL:
+            return (uint8_t)(FIFO_SIZE - chan.txFifo.size());
+
+        case REG_RXLVL:
+            return (uint8_t)chan.rxFifo.size();
+
+        case REG_IODIR:
+            return (model == Model::SC16IS740) ? 0 : iodir;
+
+        case REG_IOSTATE:
+            return (model == Model::SC16IS740) ? 0 : iostate;
+
+        case REG_IOINTENA:
+            return (model == Model::SC16IS740) ? 0 : iointena;
+
+        case REG_IOCONTROL:
+            return iocontrol & 0x07;
+
+        case REG_EFCR:
+            return chan.efcr;
+
+        default:
+            return 0;
+    }
+}
+
+void SC16IS7xxSim::writeRegister(int channel, uint8_t reg, uint8_t value) {
+    Channel &chan = channels[channel];
+
+    if (reg != REG_RHR_THR) {
+        chan.stats.registerWrites++;
+    }
+    if (reg == REG_LCR) {
+        chan.lcr = value;
+        return;
+    }
+    if (chan.lcr == 0xbf) {
+        // Enhanced register set
+        if (reg == REG_EFR) {
+            chan.efr = value;
+            return;
+        }
+        if (reg >= REG_XON1 && reg <= REG_XON1 + 3) {
+            chan.xonXoff[reg - REG_XON1] = value;
+            return;
+        }
+    }
+    if ((chan.lcr & 0x80) != 0) {
+        // Special register set
+        if (reg == REG_DLL) {
+            chan.dll = value;
+            return;
+        }
+        if (reg == REG_DLH) {
+            chan.dlh = value;
+            return;
+        }
+    }
+
+    bool enhanced = (chan.efr & 0x10) != 0;
+
+    switch(reg) {
+        case REG_RHR_THR:
+            chan.thrInterrupt = false;
+            if (chan.txFifo.size() >= FIFO_SIZE) {
+                chan.stats.txFifoFull++;
+                break;
+            }
+            if (!chan.txShifting && (chan.efcr & 0x04) == 0 && !chan.txPaused) {
+                // The transmitter is idle, so the character goes directly to the shift register
+                chan.txShifting = true;
+                chan.txShiftChar = value;
+                chan.txDoneUs = nowUs() + charTimeUs(chan);
+            }
+            else {
+                chan.txFifo.push_back(value);
+            }
+            updateThrInterrupt(chan);
+            break;
+
+        case REG_IER:
+            // IER[7:4] can only be modified when EFR[4] = 1
+            if (!enhanced) {
+                value = (value & 0x0f) | (chan.ier & 0xf0);
+            }
+            if ((value & 0x02) != 0 && (chan.ier & 0x02) == 0 && chan.thrLevelReached) {
+                // Enabling the THR interrupt with space in the TX FIFO interrupts immediately
+                chan.thrInterrupt = true;
+            }
+            chan.ier = value;
+            break;
+
+        case REG_IIR_FCR:
+            if (value & 0x02) {
+                chan.rxFifo.clear();
+            }
+            if (value & 0x04) {
+                chan.txFifo.clear();
+            }
+            // FCR[5:4] can only be modified when EFR[4] = 1
+            if (!enhanced) {
+                value = (value & ~0x30) | (chan.fcr & 0x30);
+            }
+            chan.fcr = value & 0xf1;
+            updateThrInterrupt(chan);
+            break;
+
+        case REG_MCR:
+            // MCR[7:5] and MCR[2] can only be modified when EFR[4] = 1
+            if (!enhanced) {
+                value = (value & 0x1b) | (chan.mcr & 0xe4);
+            }
+            chan.mcr = value;
+            break;
+
+        case REG_MSR_TCR:
+            if (tcrTlrEnabled(chan)) {
+                chan.tcr = value;
+            }
+            break;
+
+        case REG_SPR_TLR:
+            if (tcrTlrEnabled(chan)) {
+                chan.tlr = value;
+                updateThrInterrupt(chan);
+            }
+            else {
+                chan.spr = value;
+            }
+            break;
+
+        case REG_IODIR:
+            iodir = value;
+            break;
+
+        case REG_IOSTATE:
+            iostate = value;
+            break;
+
+        case REG_IOINTENA:
+            iointena = value;
+            break;
+
+        case REG_IOCONTROL:
+            if (value & 0x08) {
+                // Software reset, the bit clears itself
+                resetChip();
+            }
+            else {
+                iocontrol = value & 0x07;
+            }
+            break;
+
+        case REG_EFCR:
+            chan.efcr = value;
+            break;
+
+        default:
+            break;
+    }
+}
+
+void SC16IS7xxSim::afterBusAccess() {
+    if (irqPin != PIN_INVALID && !irqAsserted(nowUs())) {
+        // Remember that IRQ was deasserted, so a new interrupt before the thread checks again is
+        // still a falling edge
+        irqWentHigh = true;
+    }
+}
+
+bool SC16IS7xxSim::i2cWrite(uint8_t addr, const uint8_t *data, size_t size) {
+    if (addr != i2cAddr) {
+        return false;
+    }
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    advance();
+    if (size > 0) {
+        subaddress = data[0];
+        int channel = (subaddress >> 1) & 0x03;
+        for(size_t ii = 1; ii < size && channel < numChannels; ii++) {
+            writeRegister(channel, (subaddress >> 3) & 0x0f, data[ii]);
+        }
+    }
+    afterBusAccess();
+    return true;
+}
+
+bool SC16IS7xxSim::i2cRead(uint8_t addr, uint8_t *data, size_t size) {
+    if (addr != i2cAddr) {
+        return false;
+    }
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    advance();
+    int channel = (subaddress >> 1) & 0x03;
+    for(size_t ii = 0; ii < size; ii++) {
+        data[ii] = (channel < numChannels) ? readRegister(channel, (subaddress >> 3) & 0x0f) : 0xff;
+    }
+    afterBusAccess();
+    return true;
+}
+
+void SC16IS7xxSim::spiSelect(bool selected) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    spiSelected = selected;
+    spiByteIndex = 0;
+    if (!selected) {
+        afterBusAccess();
+    }
+}
+
+uint8_t SC16IS7xxSim::spiTransfer(uint8_t value) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    if (!spiSelected) {
+        return 0xff;
+    }
+    if (spiByteIndex++ == 0) {
+        // Command byte: bit 7 = read, bits 6:3 = register, bits 2:1 = channel
+        subaddress = value;
+        return 0xff;
+    }
+    advance();
+    int channel = (subaddress >> 1) & 0x03;
+    if (channel >= numChannels) {
+        return 0xff;
+    }
+    if ((subaddress & 0x80) != 0) {
+        return readRegister(channel, (subaddress >> 3) & 0x0f);
+    }
+    writeRegister(channel, (subaddress >> 3) & 0x0f, value);
+    return 0xff;
+}
+
+void SC16IS7xxSim::peerWrite(int channel, const uint8_t *data, size_t size) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    advance();
+    channels[channel].peerTx.insert(channels[channel].peerTx.end(), data, data + size);
+}
+
+void SC16IS7xxSim::peerWriteIdle(int channel, unsigned chars) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    advance();
+    channels[channel].peerTx.insert(channels[channel].peerTx.end(), chars, PEER_IDLE);
+}
+
+void SC16IS7xxSim::peerWriteAddress(int channel, uint8_t address) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    advance();
+    channels[channel].peerTx.push_back(PEER_ADDRESS | address);
+}
+
+void SC16IS7xxSim::peerWriteFramingError(int channel, uint8_t value) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    advance();
+    channels[channel].peerTx.push_back(PEER_FRAMING_ERROR | value);
+}
+
+void SC16IS7xxSim::peerWriteSequence(int channel, uint64_t count) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    advance();
+    channels[channel].peerSequenceRemaining += count;
+}
+
+bool SC16IS7xxSim::peerWriteDone(int channel) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    advance();
+    return !peerHasData(channels[channel]);
+}
+
+size_t SC16IS7xxSim::peerRead(int channel, uint8_t *data, size_t size) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    advance();
+    Channel &chan = channels[channel];
+    size_t count = 0;
+    while(count < size && !chan.peerRx.empty()) {
+        data[count++] = chan.peerRx.front();
+        chan.peerRx.pop_front();
+    }
+    return count;
+}
+
+size_t SC16IS7xxSim::peerAvailable(int channel) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    advance();
+    return channels[channel].peerRx.size();
+}
+
+void SC16IS7xxSim::loopback(int fromChannel, int toChannel) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    channels[fromChannel].loopbackTo = toChannel;
+}
+
+uint8_t SC16IS7xxSim::inspectRegister(int channel, uint8_t reg) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    advance();
+    return readRegister(channel, reg, false);
+}
+
+uint8_t SC16IS7xxSim::inspectEnhancedRegister(int channel, uint8_t reg) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    const Channel &chan = channels[channel];
+    if (reg == REG_EFR) {
+        return chan.efr;
+    }
+    if (reg >= REG_XON1 && reg <= REG_XON1 + 3) {
+        return chan.xonXoff[reg - REG_XON1];
+    }
+    return 0;
+}
+
+SC16IS7xxSim::ChannelStats SC16IS7xxSim::getStats(int channel) {
+    std::lock_guard<std::recursive_mutex> lock(mutex);
+    advance();
+    return channels[channel].stats;
+}
+
+void SC16IS7xxSim::threadFunction() {
+    bool irqLow = false;
+
+    while(!stop) {
+        std::this_thread::sleep_for(THREAD_INTERVAL);
+
+        bool asserted;
+        bool wentHigh;
+        {
+            std::lock_guard<std::recursive_mutex> lock(mutex);
+            advance();
+            asserted = irqAsserted(nowUs());
+            wentHigh = irqWentHigh;
+            irqWentHigh = false;
+        }
+
+        if (irqPin != PIN_INVALID) {
+            if (irqLow && (wentHigh || !asserted)) {
+                mockSetPin(irqPin, HIGH);
+                irqLow = false;
+            }
+            if (asserted && !irqLow) {
+                // Falling edge calls the interrupt handler
+                mockSetPin(irqPin, LOW);
+                irqLow = true;
+            }
+        }
+    }
+}
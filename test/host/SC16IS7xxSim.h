@@ -0,0 +1,260 @@
+#ifndef __SC16IS7XXSIM_H
+#define __SC16IS7XXSIM_H
+
+#include "Particle.h"
+
+#include <deque>
+#include <thread>
+
+/**
+ * @brief Behavioral model of the SC16IS740/750/760/752/762 for host tests and benchmarks
+ *
+ * The model implements the register file of each channel with the LCR and EFR access gating
+ * (general, special, and enhanced register sets, and TCR/TLR when MCR[2] = 1 and EFR[4] = 1),
+ * 64-byte RX and TX FIFOs, RXLVL and TXLVL, LSR, and IIR with the data sheet priorities for
+ * the line status, RX timeout, RHR, and THR interrupts. Trigger levels come from TLR, or FCR
+ * when TLR is 0, and auto RTS holds off the peer using the TCR halt and resume levels.
+ *
+ * Characters are clocked in and out at the baud rate set by DLL, DLH, and the MCR[7] prescaler,
+ * with the character length from LCR. The other end of each UART (the "peer") is driven by
+ * the test using peerWrite() and peerRead(), or the TX of one channel can be looped back to
+ * the RX of another.
+ *
+ * It's connected to the mock TwoWire or SPIClass, where each transaction takes the time it would
+ * take on the bus at the configured clock speed. A background thread advances the line and drives
+ * the IRQ pin, calling the interrupt handler on falling edges.
+ */
+class SC16IS7xxSim : public MockBusDevice {
+public:
+    /**
+     * @brief Chip models. The SC16IS740 has no GPIO, the SC16IS752 and SC16IS762 have two channels.
+     */
+    enum class Model {
+        SC16IS740,
+        SC16IS750,
+        SC16IS760,
+        SC16IS752,
+        SC16IS762
+    };
+
+    /**
+     * @brief Counters for one channel
+     */
+    struct ChannelStats {
+        uint64_t rxChars = 0; //!< Characters received from the line into the RX FIFO
+        uint64_t rxOverruns = 0; //!< Characters lost because the RX FIFO was full
+        uint64_t txChars = 0; //!< Characters sent from the TX FIFO to the line
+        uint64_t txFifoFull = 0; //!< THR writes discarded because the TX FIFO was full
+        uint64_t rhrReads = 0; //!< Bytes read from RHR
+        uint64_t registerReads = 0; //!< Register reads other than RHR
+        uint64_t registerWrites = 0; //!< Register writes other than THR
+    };
+
+    static const size_t FIFO_SIZE = 64; //!< Size of the RX and TX FIFOs
+
+    /**
+     * @brief Construct a chip model
+     *
+     * @param model Chip model, which sets the number of channels
+     * @param oscillatorFreqHz Crystal or clock frequency, used with the divisor to find the baud rate
+     */
+    SC16IS7xxSim(Model model = Model::SC16IS752, uint32_t oscillatorFreqHz = 1843200);
+    virtual ~SC16IS7xxSim();
+
+    /**
+     * @brief Connect to an I2C bus at a 7-bit address (0x48 - 0x57)
+     */
+    SC16IS7xxSim &attachI2C(TwoWire &wire, uint8_t addr = 0x48);
+
+    /**
+     * @brief Connect to a SPI bus with the given CS pin
+     */
+    SC16IS7xxSim &attachSPI(SPIClass &spi, pin_t csPin);
+
+    /**
+     * @brief Drive the given pin as the active low IRQ output
+     */
+    SC16IS7xxSim &attachIRQ(pin_t irqPin);
+
+    /**
+     * @brief Queue data to be sent to the chip RX on a channel at the line rate
+     */
+    void peerWrite(int channel, const uint8_t *data, size_t size);
+
+    /**
+     * @brief Leave the line to the chip RX idle for a number of character times after the data already queued
+     */
+    void peerWriteIdle(int channel, unsigned chars);
+
+    /**
+     * @brief Queue a 9-bit address byte (parity bit set) to be sent to the chip RX, for multidrop mode
+     */
+    void peerWriteAddress(int channel, uint8_t address);
+
+    /**
+     * @brief Queue a character that is received with a framing error LSR[3]
+     */
+    void peerWriteFramingError(int channel, uint8_t value);
+
+    /**
+     * @brief Send count bytes of 0, 1, 2, ... 255, 0, ... to the chip RX with no gaps between characters
+     */
+    void peerWriteSequence(int channel, uint64_t count);
+
+    /**
+     * @brief Returns true if the peer has nothing left to send to a channel
+     */
+    bool peerWriteDone(int channel);
+
+    /**
+     * @brief Read the data the chip sent on a channel TX
+     */
+    size_t peerRead(int channel, uint8_t *data, size_t size);
+
+    /**
+     * @brief Number of bytes the chip sent on a channel TX that have not been read using peerRead()
+     */
+    size_t peerAvailable(int channel);
+
+    /**
+     * @brief Connect the TX of fromChannel to the RX of toChannel, like example 08-dual-loop
+     */
+    void loopback(int fromChannel, int toChannel);
+
+    /**
+     * @brief Baud rate of a channel from the divisor and prescaler, or 0 if the divisor is not set
+     */
+    double getBaudRate(int channel);
+
+    /**
+     * @brief Time to send one character in microseconds with the current baud rate and LCR
+     */
+    double getCharTimeUs(int channel);
+
+    /**
+     * @brief Read a register without side effects, using the current LCR to select the register set
+     */
+    uint8_t inspectRegister(int channel, uint8_t reg);
+
+    /**
+     * @brief Read EFR, XON1, XON2, XOFF1, or XOFF2 without side effects, as if LCR = 0xBF
+     */
+    uint8_t inspectEnhancedRegister(int channel, uint8_t reg);
+
+    /**
+     * @brief Returns the counters for a channel
+     */
+    ChannelStats getStats(int channel);
+
+    /**
+     * @brief Returns true if the IRQ output is asserted (low)
+     */
+    bool isIrqAsserted();
+
+    /**
+     * @brief Reset the registers and FIFOs without the library knowing, like the RESET pin or a brown-out
+     */
+    void hardwareReset();
+
+    /**
+     * @brief Number of channels for this model (1 or 2)
+     */
+    int getNumChannels() const { return numChannels; };
+
+    // MockBusDevice
+    virtual bool i2cWrite(uint8_t addr, const uint8_t *data, size_t size);
+    virtual bool i2cRead(uint8_t addr, uint8_t *data, size_t size);
+    virtual void spiSelect(bool selected);
+    virtual uint8_t spiTransfer(uint8_t value);
+
+    static const int MAX_CHANNELS = 2; //!< Maximum number of channels
+    static constexpr uint16_t PEER_IDLE = 0x8000; //!< Entry in peerTx for one character time with no data
+    static constexpr uint16_t PEER_ADDRESS = 0x100; //!< Flag in peerTx and rxFifo for a 9-bit address byte, reported in LSR[2]
+    static constexpr uint16_t PEER_FRAMING_ERROR = 0x200; //!< Flag in peerTx and rxFifo for a framing error, reported in LSR[3]
+
+protected:
+    struct Channel {
+        // Registers
+        uint8_t ier = 0;
+        uint8_t fcr = 0;
+        uint8_t lcr = 0x1d;
+        uint8_t mcr = 0;
+        uint8_t spr = 0xff;
+        uint8_t tcr = 0;
+        uint8_t tlr = 0;
+        uint8_t efr = 0;
+        uint8_t xonXoff[4] = { 0, 0, 0, 0 };
+        uint8_t dll = 0;
+        uint8_t dlh = 0;
+        uint8_t efcr = 0;
+
+        // FIFOs. Bits 8 - 10 of RX entries are the parity error, framing error, and break flags.
+        std::deque<uint16_t> rxFifo;
+        std::deque<uint8_t> txFifo;
+        uint8_t lsrErrors = 0;
+        bool thrInterrupt = false;
+        bool thrLevelReached = true;
+        bool xoffInterrupt = false;
+
+        // Line
+        bool txShifting = false;
+        double txDoneUs = 0;
+        uint8_t txShiftChar = 0;
+        double rxNextUs = 0;
+        double rxLastCharUs = 0;
+        double rxLastReadUs = 0;
+        bool rxHalted = false;
+        bool txPaused = false;
+
+        // Peer
+        std::deque<uint16_t> peerTx; // Characters, or PEER_IDLE for one character time of silence
+        uint64_t peerSequenceRemaining = 0;
+        uint8_t peerSequenceNext = 0;
+        std::deque<uint8_t> peerRx;
+        int loopbackTo = -1;
+
+        ChannelStats stats;
+    };
+
+    double nowUs() const;
+    void resetChip();
+    void advance();
+    void advanceChannel(int channel, double now);
+    void receiveChar(int channel, uint16_t value, double atUs);
+    bool peerHasData(const Channel &chan) const;
+    uint16_t peerNextChar(Channel &chan);
+    double charTimeUs(const Channel &chan) const;
+    size_t rxTriggerLevel(const Channel &chan) const;
+    size_t txTriggerLevel(const Channel &chan) const;
+    void updateThrInterrupt(Channel &chan);
+    uint8_t interruptId(int channel, double now);
+    bool irqAsserted(double now);
+    bool tcrTlrEnabled(const Channel &chan) const { return (chan.mcr & 0x04) != 0 && (chan.efr & 0x10) != 0; };
+    uint8_t readRegister(int channel, uint8_t reg, bool sideEffects = true);
+    void writeRegister(int channel, uint8_t reg, uint8_t value);
+    void afterBusAccess();
+    void threadFunction();
+
+    Model model;
+    int numChannels;
+    uint32_t oscillatorFreqHz;
+    Channel channels[MAX_CHANNELS];
+    uint8_t iodir = 0;
+    uint8_t iostate = 0;
+    uint8_t iointena = 0;
+    uint8_t iocontrol = 0;
+
+    std::recursive_mutex mutex;
+    std::thread thread;
+    std::atomic<bool> stop;
+
+    uint8_t i2cAddr = 0x48;
+    uint8_t subaddress = 0;
+    bool spiSelected = false;
+    size_t spiByteIndex = 0;
+
+    pin_t irqPin = PIN_INVALID;
+    bool irqWentHigh = false;
+};
+
+#endif /* __SC16IS7XXSIM_H */
@@ -0,0 +1,66 @@
+#ifndef __TESTSETUP_H
+#define __TESTSETUP_H
+
+// Helpers shared by the host tests and benchmarks for connecting the library to the simulator
+
+#include "SC16IS7xxRK.h"
+#include "SC16IS7xxSim.h"
+
+const pin_t TEST_CS_PIN = D4; //!< SPI CS pin used by the tests, like the examples
+const pin_t TEST_IRQ_PIN = D3; //!< IRQ pin used by the tests, like the examples
+
+/**
+ * @brief Bus configuration for a test
+ */
+struct TestBus {
+    bool spi; //!< true for SPI, false for I2C
+    uint32_t speed; //!< I2C clock in Hz, or SPI clock in MHz
+    const char *name; //!< Name for logging, like "i2c400k" or "spi4m"
+};
+
+/**
+ * @brief Connect the simulator and the library to the bus, and optionally the IRQ pin
+ */
+template <typename T>
+void testConnect(SC16IS7xxSim &sim, T &uart, const TestBus &bus, bool irq = false) {
+    if (bus.spi) {
+        sim.attachSPI(SPI, TEST_CS_PIN);
+        uart.withSPI(&SPI, TEST_CS_PIN, bus.speed);
+    }
+    else {
+        sim.attachI2C(Wire, 0x48);
+        uart.withI2C(&Wire, 0);
+        Wire.setSpeed(bus.speed);
+    }
+    if (irq) {
+        sim.attachIRQ(TEST_IRQ_PIN);
+        uart.withIRQ(TEST_IRQ_PIN);
+    }
+}
+
+/**
+ * @brief A simulated chip and the library object connected to it
+ */
+template <typename T>
+struct TestDevice {
+    TestDevice(SC16IS7xxSim::Model model, const TestBus &bus, bool irq, uint32_t oscillatorFreqHz) : sim(model, oscillatorFreqHz) {
+        testConnect(sim, uart, bus, irq);
+        uart.withOscillatorFrequency((int)oscillatorFreqHz);
+    }
+    SC16IS7xxSim sim;
+    T uart;
+};
+
+/**
+ * @brief Create a simulated chip and library object. They are never deleted, like the global
+ * objects in a device app, because the worker thread keeps running until the test process exits.
+ */
+template <typename T>
+TestDevice<T> &testDevice(SC16IS7xxSim::Model model, const TestBus &bus, bool irq = false, uint32_t oscillatorFreqHz = 1843200) {
+    return *new TestDevice<T>(model, bus, irq, oscillatorFreqHz);
+}
+
+const TestBus TEST_BUS_I2C_400K = { false, CLOCK_SPEED_400KHZ, "i2c400k" };
+const TestBus TEST_BUS_SPI_4M = { true, 4, "spi4m" };
+
+#endif /* __TESTSETUP_H */
@@ -0,0 +1,116 @@
+// Microbenchmark for the SC16IS7xxBuffer copy paths
+//
+// Compares bytes/sec through the ring buffer for:
+// - modulo: the original 0.0.2 implementation, one byte at a time with % bufSize per byte
+// - mask: the same loop with a power-of-two capacity, so indexing is & (bufSize - 1)
+// - memcpy: SC16IS7xxBuffer, which copies in at most two contiguous segments
+// - memcpy-lockfree: SC16IS7xxBuffer in single producer, single consumer mode
+//
+// Each pass writes a chunk and reads it back, so the offsets move through the whole ring and
+// wrap. Run using make bench in test/host.
+
+#include "SC16IS7xxRK.h"
+
+#include <chrono>
+
+// The 0.0.2 SC16IS7xxBuffer read and write paths. The offsets increase without bound and every
+// byte is indexed using offset % bufSize, or offset & (bufSize - 1) when mask is true.
+class PerByteBuffer {
+public:
+    PerByteBuffer(size_t bufSize, bool mask) : bufSize(bufSize), mask(mask) { buf = new uint8_t[bufSize]; };
+    ~PerByteBuffer() { delete[] buf; };
+
+    size_t index(size_t offset) const { return mask ? (offset & (bufSize - 1)) : (offset % bufSize); };
+
+    int read(uint8_t *buffer, size_t size) {
+        int result = -1;
+        WITH_LOCK(mutex) {
+            if (readOffset < writeOffset) {
+                result = (int)(writeOffset - readOffset);
+                if (result > (int)size) {
+                    result = (int)size;
+                }
+                for(int ii = 0; ii < result; ii++) {
+                    buffer[ii] = buf[index(readOffset++)];
+                }
+                if (readOffset == writeOffset) {
+                    readOffset = writeOffset = 0;
+                }
+            }
+        }
+        return result;
+    }
+
+    size_t write(const uint8_t *buffer, size_t size) {
+        WITH_LOCK(mutex) {
+            size_t avail = bufSize - (writeOffset - readOffset) - 1;
+            if (size > avail) {
+                size = avail;
+            }
+            for(size_t ii = 0; ii < size; ii++) {
+                buf[index(writeOffset++)] = buffer[ii];
+            }
+        }
+        return size;
+    }
+
+protected:
+    uint8_t *buf;
+    size_t bufSize;
+    bool mask;
+    size_t readOffset = 0;
+    size_t writeOffset = 0;
+    RecursiveMutex mutex;
+};
+
+// Moves totalBytes through the buffer in chunks of chunkSize, returns bytes/sec
+template <typename T>
+static double measure(T &buffer, size_t chunkSize, size_t totalBytes) {
+    uint8_t in[1024];
+    uint8_t out[1024];
+    for(size_t ii = 0; ii < sizeof(in); ii++) {
+        in[ii] = (uint8_t)ii;
+    }
+
+    // Start with the offsets part way through the ring so the chunks do not line up with the end
+    buffer.write(in, 100);
+    buffer.read(out, 100);
+
+    auto start = std::chrono::steady_clock::now();
+    size_t moved = 0;
+    volatile uint8_t sink = 0;
+    while(moved < totalBytes) {
+        size_t written = buffer.write(in, chunkSize);
+        int count = buffer.read(out, written);
+        sink = sink + out[0];
+        moved += (count > 0) ? (size_t)count : 0;
+    }
+    double sec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return (double)moved / sec;
+}
+
+int main(int argc, char *argv[]) {
+    const size_t bufSize = 4096;
+    const size_t totalBytes = 64 * 1024 * 1024;
+    const size_t chunkSizes[] = { 1, 16, 64, 512 };
+
+    printf("%-8s %14s %14s %14s %16s\n", "chunk", "modulo MB/s", "mask MB/s", "memcpy MB/s", "lockfree MB/s");
+    for(size_t chunkSize : chunkSizes) {
+        PerByteBuffer modulo(bufSize, false);
+        PerByteBuffer mask(bufSize, true);
+        SC16IS7xxBuffer locked;
+        locked.init(bufSize, false);
+        SC16IS7xxBuffer lockFree;
+        lockFree.init(bufSize, true);
+
+        // Fewer bytes for 1-byte chunks, where the per-call overhead dominates
+        size_t total = (chunkSize == 1) ? totalBytes / 16 : totalBytes;
+
+        printf("%-8u %14.1f %14.1f %14.1f %16.1f\n", (unsigned)chunkSize,
+            measure(modulo, chunkSize, total) / 1e6,
+            measure(mask, chunkSize, total) / 1e6,
+            measure(locked, chunkSize, total) / 1e6,
+            measure(lockFree, chunkSize, total) / 1e6);
+    }
+    mockExit(0);
+}
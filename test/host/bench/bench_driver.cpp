@@ -0,0 +1,551 @@
+// Throughput and latency benchmark for the driver, using the simulated chip
+//
+// Runs the same scenarios as examples/13-benchmark on the host over a matrix of settings, and
+// prints one line per run starting with "BENCH " followed by JSON, with the fields of the device
+// example plus cpuUsPerByte, chipOverruns, and lineBytesPerSec. Each run is a separate child
+// process, so the worker threads of one run do not affect the next.
+//
+// Scenarios:
+// - read: SC16IS7x0 receiving continuous data (06-continuous-read, 07-buffered-read)
+// - dual-loop: SC16IS7x2 port A TX to port B RX, received on port B (08-dual-loop)
+// - write: SC16IS7x0 sending continuous data, unbuffered or withBufferedWrite()
+// - modbus: SC16IS7x0 in RS-485 mode as a Modbus RTU client sending a request with writeModbusFrame()
+//   and receiving a 69-byte response frame, which is longer than the FIFO
+//
+// Matrix: baud rates 9600 to 921600 (with a 14.7456 MHz oscillator), I2C 100 kHz, 400 kHz, 1 MHz and
+// SPI 4 MHz, 15 MHz, polled or IRQ, and buffered or unbuffered. Modbus always uses buffered read.
+//
+// Usage: bench_driver [--duration ms (default 250)] [--scenario name] [--bus name] [--baud n] [--irq 0|1] [--buffered 0|1]
+//
+// Fields (see also examples/13-benchmark):
+// - bytesPerSec: bytes received (read, dual-loop), received by the peer (write), or both directions (modbus)
+// - busOpsPerByte: rxBusOps or txBusOps from getStats() per byte
+// - busTimeUsPerByte: microseconds of SPI or I2C transfers per byte, from getBusUtilization()
+// - cpuUsPerByte: host CPU time of the application and worker threads per byte. The mock SPI and I2C
+//   transfers sleep for the bus time, so this does not include waiting for the bus.
+// - latP50Us, latP99Us: read: IRQ to read buffer drained (IRQ and buffered) or the interval between
+//   services of the port; write: time for each write() call; modbus: request to response round trip
+// - sequenceGaps, lsrOverrun, rxBufferFull: data loss counters, reported separately
+// - chipOverruns: characters the simulated chip lost because its RX FIFO was full. Unbuffered read()
+//   does not read LSR, so these do not show up in lsrOverrun.
+// - lineBytesPerSec (read, dual-loop): characters the peer sent. The simulator pauses the line when
+//   the host does not run it for a while, so on a busy host this can be below lineRate.
+//
+// When there's no data, the reader waits 1 millisecond before reading again instead of spinning,
+// so cpuUsPerByte does not include busy waiting in the benchmark itself.
+
+#include "TestSetup.h"
+
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+static const int OSCILLATOR_FREQ_HZ = 14745600;
+
+static const int baudRates[] = { 9600, 19200, 38400, 57600, 115200, 230400, 460800, 921600 };
+
+static const TestBus buses[] = {
+    { false, CLOCK_SPEED_100KHZ, "i2c100k" },
+    { false, CLOCK_SPEED_400KHZ, "i2c400k" },
+    { false, CLOCK_SPEED_1MHZ, "i2c1m" },
+    { true, 4, "spi4m" },
+    { true, 15, "spi15m" },
+};
+
+static const char * const scenarios[] = { "read", "dual-loop", "write", "modbus" };
+
+// Modbus read holding registers request, and the response with 32 registers
+static const size_t MODBUS_REQUEST_SIZE = 6;
+static const size_t MODBUS_RESPONSE_REGISTERS = 32;
+static const size_t MODBUS_RESPONSE_SIZE = 3 + 2 * MODBUS_RESPONSE_REGISTERS;
+
+struct BenchConfig {
+    const char *scenario;
+    const TestBus *bus;
+    bool irq;
+    bool buffered;
+    int baud;
+    system_tick_t durationMs;
+};
+
+/**
+ * @brief Measurements common to all scenarios, taken over the measurement period
+ */
+struct BenchResult {
+    double elapsedUs = 0;
+    double bytes = 0;
+    double busOps = 0;
+    double cpuUs = 0;
+    float busUtilization = 0;
+    uint32_t latP50Us = 0;
+    uint32_t latP99Us = 0;
+    uint32_t sequenceGaps = 0;
+    uint32_t lsrOverrun = 0;
+    uint32_t rxBufferFull = 0;
+    uint64_t chipOverruns = 0;
+    std::string extra;
+};
+
+static double threadCpuUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (double)ts.tv_sec * 1000000.0 + (double)ts.tv_nsec / 1000.0;
+}
+
+static double nowUs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000000.0 + (double)ts.tv_nsec / 1000.0;
+}
+
+/**
+ * @brief Measures CPU time of the calling (application) thread and all Thread objects
+ */
+class CpuTimer {
+public:
+    CpuTimer() { start(); };
+    void start() { startUs = threadCpuUs() + mockThreadCpuUs(); };
+    double elapsedUs() const { return threadCpuUs() + mockThreadCpuUs() - startUs; };
+protected:
+    double startUs = 0;
+};
+
+template <typename T>
+static T &newConnected(SC16IS7xxSim &sim, const BenchConfig &config) {
+    T &uart = *new T();
+    testConnect(sim, uart, *config.bus, config.irq);
+    uart.withOscillatorFrequency(OSCILLATOR_FREQ_HZ);
+    uart.withHistograms();
+    uart.softwareReset();
+    return uart;
+}
+
+// Reads the peerWriteSequence() pattern from rxPort, like loop() in the device example
+static void readScenario(SC16IS7xxInterface &chip, SC16IS7xxPort &rxPort, SC16IS7xxSim &sim, int rxChannel,
+    const BenchConfig &config, BenchResult &result) {
+    uint8_t readBuf[64];
+    size_t readIndex = 0;
+    bool started = false;
+    double startUs = nowUs();
+    SC16IS7xxSim::ChannelStats startLine = sim.getStats(rxChannel);
+    CpuTimer cpu;
+
+    while(nowUs() - startUs < config.durationMs * 1000.0) {
+        int count = rxPort.read(readBuf, sizeof(readBuf));
+        if (count <= 0) {
+            // Like the tests, poll every millisecond when there's no data instead of spinning,
+            // so cpuUsPerByte is the cost of the driver and not of the loop
+            delay(1);
+            continue;
+        }
+        if (!started) {
+            // Start measuring from the first byte so startup time is not included
+            started = true;
+            startUs = nowUs();
+            chip.getBusUtilization(true);
+            rxPort.getStats(true);
+            rxPort.getHistograms(true);
+            startLine = sim.getStats(rxChannel);
+            cpu.start();
+            readIndex = readBuf[0];
+        }
+        for(int ii = 0; ii < count; ii++, readIndex++) {
+            if (readBuf[ii] != (readIndex & 0xff)) {
+                // Resynchronize to the received data so one drop is only counted once
+                result.sequenceGaps++;
+                readIndex = readBuf[ii];
+            }
+        }
+    }
+    result.elapsedUs = nowUs() - startUs;
+    result.cpuUs = cpu.elapsedUs();
+    result.busUtilization = chip.getBusUtilization();
+
+    SC16IS7xxPortStats stats = rxPort.getStats();
+    SC16IS7xxPortHistograms hist = rxPort.getHistograms();
+    const SC16IS7xxHistogram &latency = (config.irq && config.buffered) ? hist.irqToDrainUs : hist.serviceIntervalUs;
+
+    result.bytes = stats.rxBytes;
+    result.busOps = stats.rxBusOps;
+    result.latP50Us = latency.percentile(50);
+    result.latP99Us = latency.percentile(99);
+    result.lsrOverrun = stats.lsrOverrun;
+    result.rxBufferFull = stats.rxBufferFull;
+    SC16IS7xxSim::ChannelStats line = sim.getStats(rxChannel);
+    result.chipOverruns = line.rxOverruns - startLine.rxOverruns;
+
+    // What the peer actually sent. On a busy host this can be below the line rate, because the
+    // simulator pauses the line when it was not run for a while.
+    uint64_t lineChars = (line.rxChars + line.rxOverruns) - (startLine.rxChars + startLine.rxOverruns);
+    result.extra = ",\"lineBytesPerSec\":" + std::to_string((uint64_t)(lineChars * 1000000.0 / result.elapsedUs));
+}
+
+static void runRead(const BenchConfig &config, BenchResult &result) {
+    SC16IS7xxSim &sim = *new SC16IS7xxSim(SC16IS7xxSim::Model::SC16IS750, OSCILLATOR_FREQ_HZ);
+    SC16IS7x0 &uart = newConnected<SC16IS7x0>(sim, config);
+    if (config.buffered) {
+        uart.withBufferedRead(20000);
+    }
+    uart.begin(config.baud);
+
+    // The peer sends continuously, like Serial1 in the device example
+    sim.peerWriteSequence(0, (uint64_t)-1 / 2);
+
+    readScenario(uart, uart, sim, 0, config, result);
+}
+
+static void runDualLoop(const BenchConfig &config, BenchResult &result) {
+    SC16IS7xxSim &sim = *new SC16IS7xxSim(SC16IS7xxSim::Model::SC16IS752, OSCILLATOR_FREQ_HZ);
+    sim.loopback(0, 1);
+    SC16IS7x2 &uart = newConnected<SC16IS7x2>(sim, config);
+    if (config.buffered) {
+        uart.b().withBufferedRead(20000);
+    }
+    uart.a().begin(config.baud);
+    uart.b().begin(config.baud);
+
+    // Sending thread, like the device example. Its CPU time is included, as on a device.
+    static SC16IS7xxPort *txPort;
+    txPort = &uart.a();
+    new Thread("sending", [](void *) {
+        size_t writeIndex = 0;
+        while(true) {
+            uint8_t writeBuf[64];
+            int avail = txPort->availableForWrite();
+            if (avail > (int)sizeof(writeBuf)) {
+                avail = (int)sizeof(writeBuf);
+            }
+            for(int ii = 0; ii < avail; ii++) {
+                writeBuf[ii] = (uint8_t)(writeIndex++ & 0xff);
+            }
+            if (avail > 0) {
+                txPort->write(writeBuf, avail);
+            }
+            delay(1);
+        }
+    });
+
+    readScenario(uart, uart.b(), sim, 1, config, result);
+}
+
+static void runWrite(const BenchConfig &config, BenchResult &result) {
+    SC16IS7xxSim &sim = *new SC16IS7xxSim(SC16IS7xxSim::Model::SC16IS750, OSCILLATOR_FREQ_HZ);
+    SC16IS7x0 &uart = newConnected<SC16IS7x0>(sim, config);
+    if (config.buffered) {
+        uart.withBufferedWrite(4096);
+    }
+    uart.begin(config.baud);
+
+    // The peer reads and checks the data in a thread that is not included in the CPU time
+    std::atomic<uint64_t> peerBytes(0);
+    std::atomic<uint32_t> peerGaps(0);
+    std::atomic<bool> stop(false);
+    std::thread peer([&]() {
+        size_t readIndex = 0;
+        while(!stop) {
+            uint8_t buf[256];
+            size_t n = sim.peerRead(0, buf, sizeof(buf));
+            for(size_t ii = 0; ii < n; ii++, readIndex++) {
+                if (buf[ii] != (readIndex & 0xff)) {
+                    peerGaps++;
+                    readIndex = buf[ii];
+                }
+            }
+            peerBytes += n;
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    });
+
+    // Wait until the first data reaches the peer
+    uint8_t writeBuf[64];
+    size_t writeIndex = 0;
+    while(peerBytes == 0) {
+        for(size_t ii = 0; ii < sizeof(writeBuf); ii++) {
+            writeBuf[ii] = (uint8_t)(writeIndex++ & 0xff);
+        }
+        uart.write(writeBuf, sizeof(writeBuf));
+    }
+
+    SC16IS7xxHistogram writeTime;
+    uart.getBusUtilization(true);
+    uart.getStats(true);
+    uint64_t startBytes = peerBytes;
+    CpuTimer cpu;
+    cpu.start();
+    double startUs = nowUs();
+
+    while(nowUs() - startUs < config.durationMs * 1000.0) {
+        for(size_t ii = 0; ii < sizeof(writeBuf); ii++) {
+            writeBuf[ii] = (uint8_t)(writeIndex++ & 0xff);
+        }
+        uint32_t callStartUs = micros();
+        uart.write(writeBuf, sizeof(writeBuf));
+        writeTime.add(micros() - callStartUs);
+    }
+
+    result.elapsedUs = nowUs() - startUs;
+    result.cpuUs = cpu.elapsedUs();
+    result.busUtilization = uart.getBusUtilization();
+    result.bytes = (double)(peerBytes - startBytes);
+
+    stop = true;
+    peer.join();
+
+    SC16IS7xxPortStats stats = uart.getStats();
+    result.busOps = stats.txBusOps;
+    result.latP50Us = writeTime.percentile(50);
+    result.latP99Us = writeTime.percentile(99);
+    result.sequenceGaps = peerGaps;
+    result.extra = ",\"txFifoFull\":" + std::to_string(sim.getStats(0).txFifoFull) +
+        ",\"writeBlockedUs\":" + std::to_string(stats.writeBlockedUs);
+}
+
+static void runModbus(const BenchConfig &config, BenchResult &result) {
+    SC16IS7xxSim &sim = *new SC16IS7xxSim(SC16IS7xxSim::Model::SC16IS750, OSCILLATOR_FREQ_HZ);
+    SC16IS7x0 &uart = newConnected<SC16IS7x0>(sim, config);
+
+    static std::atomic<uint32_t> responses;
+    static std::atomic<uint32_t> badResponses;
+    responses = 0;
+    badResponses = 0;
+
+    uart.withBufferedRead(1024);
+    uart.withRS485();
+    uart.withModbusRTU([](const uint8_t *frame, size_t length) {
+        if (length != MODBUS_RESPONSE_SIZE || frame[0] != 0x11 || frame[1] != 0x03) {
+            badResponses++;
+        }
+        responses++;
+    });
+    uart.begin(config.baud);
+
+    // Response from the server (the peer), with the CRC
+    uint8_t response[MODBUS_RESPONSE_SIZE + 2];
+    response[0] = 0x11;
+    response[1] = 0x03;
+    response[2] = (uint8_t)(2 * MODBUS_RESPONSE_REGISTERS);
+    for(size_t ii = 3; ii < MODBUS_RESPONSE_SIZE; ii++) {
+        response[ii] = (uint8_t)ii;
+    }
+    uint16_t crc = SC16IS7xxPort::modbusCRC16(response, MODBUS_RESPONSE_SIZE);
+    response[MODBUS_RESPONSE_SIZE] = (uint8_t)crc;
+    response[MODBUS_RESPONSE_SIZE + 1] = (uint8_t)(crc >> 8);
+
+    // The server responds after the 3.5 character silence that ends the request
+    std::atomic<bool> stop(false);
+    std::atomic<uint32_t> badRequests(0);
+    std::thread peer([&]() {
+        std::vector<uint8_t> request;
+        while(!stop) {
+            uint8_t buf[64];
+            size_t n = sim.peerRead(0, buf, sizeof(buf));
+            request.insert(request.end(), buf, buf + n);
+            if (request.size() >= MODBUS_REQUEST_SIZE + 2) {
+                if (SC16IS7xxPort::modbusCRC16(request.data(), MODBUS_REQUEST_SIZE + 2) != 0) {
+                    badRequests++;
+                }
+                request.clear();
+                sim.peerWriteIdle(0, 4);
+                sim.peerWrite(0, response, sizeof(response));
+                sim.peerWriteIdle(0, 4);
+            }
+            std::this_thread::sleep_for(std::chrono::microseconds(20));
+        }
+    });
+
+    uint8_t request[MODBUS_REQUEST_SIZE] = { 0x11, 0x03, 0x00, 0x6b, 0x00, (uint8_t)MODBUS_RESPONSE_REGISTERS };
+
+    // Request and response time on the line, and a timeout with plenty of margin
+    double charUs = 10.0 * 1000000.0 / config.baud;
+    double lineUs = (MODBUS_REQUEST_SIZE + 2 + sizeof(response)) * charUs;
+    double timeoutUs = 4 * lineUs + 50000;
+
+    SC16IS7xxHistogram roundTrip;
+    uint32_t framesLost = 0;
+    uint32_t transactions = 0;
+    uint64_t startOverruns = 0;
+    bool started = false;
+    double startUs = nowUs();
+    CpuTimer cpu;
+
+    while(nowUs() - startUs < config.durationMs * 1000.0) {
+        uint32_t expected = responses + 1;
+        double requestUs = nowUs();
+        uart.writeModbusFrame(request, sizeof(request));
+        while(responses < expected && nowUs() - requestUs < timeoutUs) {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+        if (responses < expected) {
+            framesLost++;
+            continue;
+        }
+        if (!started) {
+            // The first transaction is not measured
+            started = true;
+            uart.getBusUtilization(true);
+            uart.getStats(true);
+            startOverruns = sim.getStats(0).rxOverruns;
+            cpu.start();
+            startUs = nowUs();
+            continue;
+        }
+        roundTrip.add((uint32_t)(nowUs() - requestUs));
+        transactions++;
+    }
+    result.elapsedUs = nowUs() - startUs;
+    result.cpuUs = cpu.elapsedUs();
+    result.busUtilization = uart.getBusUtilization();
+
+    stop = true;
+    peer.join();
+
+    SC16IS7xxPortStats stats = uart.getStats();
+    result.bytes = (double)transactions * (MODBUS_REQUEST_SIZE + 2 + sizeof(response));
+    result.busOps = stats.rxBusOps + stats.txBusOps;
+    result.latP50Us = roundTrip.percentile(50);
+    result.latP99Us = roundTrip.percentile(99);
+    result.lsrOverrun = stats.lsrOverrun;
+    result.rxBufferFull = stats.rxBufferFull;
+    result.chipOverruns = sim.getStats(0).rxOverruns - startOverruns;
+
+    char buf[256];
+    snprintf(buf, sizeof(buf), ",\"framesPerSec\":%.1f,\"lineUs\":%.0f,\"turnaroundUs\":%lu,\"framesLost\":%lu,"
+        "\"modbusFrames\":%lu,\"modbusCrcErrors\":%lu,\"modbusFrameErrors\":%lu,\"badResponses\":%lu,\"badRequests\":%lu",
+        (double)transactions * 1000000.0 / result.elapsedUs, lineUs, (unsigned long)uart.getTurnaroundUs(),
+        (unsigned long)framesLost, (unsigned long)stats.modbusFrames, (unsigned long)stats.modbusCrcErrors,
+        (unsigned long)stats.modbusFrameErrors, (unsigned long)badResponses.load(), (unsigned long)badRequests.load());
+    result.extra = buf;
+}
+
+static void runOne(const BenchConfig &config) {
+    BenchResult result;
+    std::string scenario = config.scenario;
+    const char *chip = "SC16IS7x0";
+
+    if (scenario == "read") {
+        runRead(config, result);
+    }
+    else
+    if (scenario == "dual-loop") {
+        chip = "SC16IS7x2";
+        runDualLoop(config, result);
+    }
+    else
+    if (scenario == "write") {
+        runWrite(config, result);
+    }
+    else {
+        runModbus(config, result);
+    }
+
+    double bytes = (result.bytes != 0) ? result.bytes : 1;
+    double busUs = (double)result.busUtilization / 100.0 * result.elapsedUs;
+
+    printf("BENCH {\"scenario\":\"%s\",\"chip\":\"%s\",\"bus\":\"%s\",\"busSpeed\":%lu,\"irq\":%s,\"buffered\":%s,"
+        "\"baud\":%d,\"lineRate\":%d,\"bytesPerSec\":%.0f,\"busOpsPerByte\":%.3f,\"busTimeUsPerByte\":%.1f,"
+        "\"cpuUsPerByte\":%.1f,\"busUtilization\":%.1f,\"latP50Us\":%lu,\"latP99Us\":%lu,"
+        "\"sequenceGaps\":%lu,\"lsrOverrun\":%lu,\"rxBufferFull\":%lu,\"chipOverruns\":%llu%s}\n",
+        config.scenario, chip, config.bus->spi ? "spi" : "i2c",
+        (unsigned long)(config.bus->spi ? config.bus->speed * 1000000 : config.bus->speed),
+        config.irq ? "true" : "false", config.buffered ? "true" : "false",
+        config.baud, config.baud / 10,
+        result.bytes * 1000000.0 / result.elapsedUs,
+        result.busOps / bytes,
+        busUs / bytes,
+        result.cpuUs / bytes,
+        result.busUtilization,
+        (unsigned long)result.latP50Us, (unsigned long)result.latP99Us,
+        (unsigned long)result.sequenceGaps, (unsigned long)result.lsrOverrun, (unsigned long)result.rxBufferFull,
+        (unsigned long long)result.chipOverruns, result.extra.c_str());
+}
+
+int main(int argc, char *argv[]) {
+    system_tick_t durationMs = 250;
+    const char *scenarioFilter = nullptr;
+    const char *busFilter = nullptr;
+    int baudFilter = 0;
+    int irqFilter = -1;
+    int bufferedFilter = -1;
+
+    for(int ii = 1; ii + 1 < argc; ii += 2) {
+        std::string arg = argv[ii];
+        if (arg == "--duration") {
+            durationMs = (system_tick_t)atoi(argv[ii + 1]);
+        }
+        else
+        if (arg == "--scenario") {
+            scenarioFilter = argv[ii + 1];
+        }
+        else
+        if (arg == "--bus") {
+            busFilter = argv[ii + 1];
+        }
+        else
+        if (arg == "--baud") {
+            baudFilter = atoi(argv[ii + 1]);
+        }
+        else
+        if (arg == "--irq") {
+            irqFilter = atoi(argv[ii + 1]);
+        }
+        else
+        if (arg == "--buffered") {
+            bufferedFilter = atoi(argv[ii + 1]);
+        }
+        else {
+            fprintf(stderr, "unknown option %s\n", argv[ii]);
+            return 1;
+        }
+    }
+
+    int failed = 0;
+    for(const char *scenario : scenarios) {
+        if (scenarioFilter && strcmp(scenarioFilter, scenario) != 0) {
+            continue;
+        }
+        for(const TestBus &bus : buses) {
+            if (busFilter && strcmp(busFilter, bus.name) != 0) {
+                continue;
+            }
+            for(int irq = 0; irq < 2; irq++) {
+                if (irqFilter >= 0 && irq != irqFilter) {
+                    continue;
+                }
+                for(int buffered = 0; buffered < 2; buffered++) {
+                    if ((bufferedFilter >= 0 && buffered != bufferedFilter) || (strcmp(scenario, "modbus") == 0 && !buffered)) {
+                        // Modbus RTU requires buffered read
+                        continue;
+                    }
+                    for(int baud : baudRates) {
+                        if (baudFilter && baud != baudFilter) {
+                            continue;
+                        }
+                        BenchConfig config = { scenario, &bus, irq != 0, buffered != 0, baud, durationMs };
+
+                        fflush(stdout);
+                        pid_t pid = fork();
+                        if (pid == 0) {
+                            alarm(30 + durationMs / 1000 * 2);
+                            runOne(config);
+                            mockExit(0);
+                        }
+                        int status = 0;
+                        waitpid(pid, &status, 0);
+                        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+                            printf("BENCH {\"scenario\":\"%s\",\"bus\":\"%s\",\"irq\":%s,\"buffered\":%s,\"baud\":%d,\"error\":\"run failed\"}\n",
+                                scenario, bus.name, irq ? "true" : "false", buffered ? "true" : "false", baud);
+                            failed++;
+                        }
+                    }
+                }
+            }
+        }
+    }
+    printf("BENCH done\n");
+    mockExit((failed == 0) ? 0 : 1);
+}
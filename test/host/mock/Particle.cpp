@@ -0,0 +1,528 @@
+#include "Particle.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+TwoWire Wire;
+TwoWire Wire1;
+SPIClass SPI;
+SPIClass SPI1;
+Logger Log("app");
+
+static const auto startTime = std::chrono::steady_clock::now();
+
+static uint64_t elapsedUs() {
+    return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+system_tick_t millis() {
+    return (system_tick_t)(elapsedUs() / 1000);
+}
+
+uint32_t micros() {
+    return (uint32_t)elapsedUs();
+}
+
+void delay(unsigned long ms) {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+void delayMicroseconds(unsigned int us) {
+    // Sleeping is not accurate for short delays
+    if (us < 100) {
+        mockBusyWaitUs(us);
+    }
+    else {
+        std::this_thread::sleep_for(std::chrono::microseconds(us));
+    }
+}
+
+void mockBusyWaitUs(double us) {
+    auto end = std::chrono::steady_clock::now() + std::chrono::nanoseconds((int64_t)(us * 1000.0));
+    while(std::chrono::steady_clock::now() < end) {
+    }
+}
+
+void mockExit(int code) {
+    fflush(stdout);
+    fflush(stderr);
+    _exit(code);
+}
+
+std::recursive_mutex &mockInterruptLock() {
+    static std::recursive_mutex lock;
+    return lock;
+}
+
+//
+// Pins
+//
+typedef struct {
+    uint8_t level = HIGH;
+    PinMode mode = INPUT;
+    InterruptMode interruptMode = FALLING;
+    std::function<void()> handler;
+    std::function<int32_t()> reader;
+    SPIClass *spi = nullptr;
+    MockBusDevice *spiDevice = nullptr;
+} MockPin;
+
+static MockPin pins[MOCK_NUM_PINS];
+static std::mutex pinsMutex;
+
+void pinMode(pin_t pin, PinMode mode) {
+    if (pin < MOCK_NUM_PINS) {
+        pins[pin].mode = mode;
+    }
+}
+
+void digitalWrite(pin_t pin, uint8_t value) {
+    if (pin >= MOCK_NUM_PINS) {
+        return;
+    }
+    MockBusDevice *device = nullptr;
+    SPIClass *spi = nullptr;
+    bool changed;
+    {
+        std::lock_guard<std::mutex> lock(pinsMutex);
+        changed = (pins[pin].level != value);
+        pins[pin].level = value;
+        device = pins[pin].spiDevice;
+        spi = pins[pin].spi;
+    }
+    if (device && changed) {
+        // Chip select is active low
+        if (value == LOW && spi) {
+            spi->stats.transactions++;
+        }
+        device->spiSelect(value == LOW);
+    }
+}
+
+int32_t digitalRead(pin_t pin) {
+    if (pin >= MOCK_NUM_PINS) {
+        return LOW;
+    }
+    std::function<int32_t()> reader;
+    {
+        std::lock_guard<std::mutex> lock(pinsMutex);
+        reader = pins[pin].reader;
+        if (!reader) {
+            return pins[pin].level;
+        }
+    }
+    return reader();
+}
+
+void pinSetFast(pin_t pin) {
+    digitalWrite(pin, HIGH);
+}
+
+void pinResetFast(pin_t pin) {
+    digitalWrite(pin, LOW);
+}
+
+int32_t pinReadFast(pin_t pin) {
+    return digitalRead(pin);
+}
+
+bool attachInterrupt(pin_t pin, std::function<void()> handler, InterruptMode mode, int8_t priority, uint8_t subpriority) {
+    if (pin >= MOCK_NUM_PINS) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(pinsMutex);
+    pins[pin].handler = handler;
+    pins[pin].interruptMode = mode;
+    return true;
+}
+
+void detachInterrupt(pin_t pin) {
+    if (pin < MOCK_NUM_PINS) {
+        std::lock_guard<std::mutex> lock(pinsMutex);
+        pins[pin].handler = nullptr;
+    }
+}
+
+void mockSetPin(pin_t pin, uint8_t level) {
+    if (pin >= MOCK_NUM_PINS) {
+        return;
+    }
+    std::function<void()> handler;
+    {
+        std::lock_guard<std::mutex> lock(pinsMutex);
+        uint8_t oldLevel = pins[pin].level;
+        pins[pin].level = level;
+        if (oldLevel != level && pins[pin].handler) {
+            InterruptMode mode = pins[pin].interruptMode;
+            if (mode == CHANGE || (mode == FALLING && level == LOW) || (mode == RISING && level == HIGH)) {
+                handler = pins[pin].handler;
+            }
+        }
+    }
+    if (handler) {
+        std::lock_guard<std::recursive_mutex> lock(mockInterruptLock());
+        handler();
+    }
+}
+
+void mockSetPinReader(pin_t pin, std::function<int32_t()> reader) {
+    if (pin < MOCK_NUM_PINS) {
+        std::lock_guard<std::mutex> lock(pinsMutex);
+        pins[pin].reader = reader;
+    }
+}
+
+//
+// Semaphores and threads
+//
+typedef struct {
+    std::mutex mutex;
+    std::condition_variable cv;
+    unsigned count;
+    unsigned max;
+} MockSemaphore;
+
+int os_semaphore_create(os_semaphore_t *semaphore, unsigned max, unsigned initial) {
+    MockSemaphore *sem = new MockSemaphore();
+    sem->count = initial;
+    sem->max = max;
+    *semaphore = sem;
+    return 0;
+}
+
+int os_semaphore_destroy(os_semaphore_t semaphore) {
+    delete (MockSemaphore *)semaphore;
+    return 0;
+}
+
+int os_semaphore_take(os_semaphore_t semaphore, system_tick_t timeout, bool reserved) {
+    MockSemaphore *sem = (MockSemaphore *)semaphore;
+    std::unique_lock<std::mutex> lock(sem->mutex);
+    if (timeout == CONCURRENT_WAIT_FOREVER) {
+        sem->cv.wait(lock, [sem]() { return sem->count > 0; });
+    }
+    else
+    if (!sem->cv.wait_for(lock, std::chrono::milliseconds(timeout), [sem]() { return sem->count > 0; })) {
+        return 1;
+    }
+    sem->count--;
+    return 0;
+}
+
+int os_semaphore_give(os_semaphore_t semaphore, bool reserved) {
+    MockSemaphore *sem = (MockSemaphore *)semaphore;
+    {
+        std::lock_guard<std::mutex> lock(sem->mutex);
+        if (sem->count < sem->max) {
+            sem->count++;
+        }
+    }
+    sem->cv.notify_one();
+    return 0;
+}
+
+static std::mutex threadsMutex;
+static std::vector<pthread_t> threads;
+
+Thread::Thread(const char *name, os_thread_fn_t function, void *functionParam, os_thread_prio_t priority, size_t stackSize) {
+    std::thread thread(function, functionParam);
+    {
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        threads.push_back(thread.native_handle());
+    }
+    thread.detach();
+}
+
+double mockThreadCpuUs() {
+    std::lock_guard<std::mutex> lock(threadsMutex);
+    double us = 0;
+    for(pthread_t thread : threads) {
+        clockid_t clockId;
+        struct timespec ts;
+        if (pthread_getcpuclockid(thread, &clockId) == 0 && clock_gettime(clockId, &ts) == 0) {
+            us += (double)ts.tv_sec * 1000000.0 + (double)ts.tv_nsec / 1000.0;
+        }
+    }
+    return us;
+}
+
+//
+// Logging
+//
+static LogLevel mockLogLevel() {
+    static LogLevel level = []() {
+        const char *env = getenv("SC16IS7XX_LOG");
+        if (env) {
+            if (strcmp(env, "trace") == 0) return LOG_LEVEL_TRACE;
+            if (strcmp(env, "info") == 0) return LOG_LEVEL_INFO;
+            if (strcmp(env, "warn") == 0) return LOG_LEVEL_WARN;
+            if (strcmp(env, "none") == 0) return LOG_LEVEL_NONE;
+        }
+        return LOG_LEVEL_ERROR;
+    }();
+    return level;
+}
+
+static std::atomic<int> logLevelOverride(0);
+
+void mockSetLogLevel(LogLevel level) {
+    logLevelOverride = (int)level;
+}
+
+static bool logEnabled(LogLevel level) {
+    int minLevel = (logLevelOverride != 0) ? logLevelOverride.load() : (int)mockLogLevel();
+    return (int)level >= minLevel;
+}
+
+void Logger::log(LogLevel level, const char *fmt, va_list ap) const {
+    if (!logEnabled(level)) {
+        return;
+    }
+    static const char *names[] = { "TRACE", "INFO", "WARN", "ERROR" };
+    const char *levelName = names[(level >= LOG_LEVEL_ERROR) ? 3 : (level >= LOG_LEVEL_WARN) ? 2 : (level >= LOG_LEVEL_INFO) ? 1 : 0];
+
+    char buf[512];
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    fprintf(stderr, "%010u [%s] %s: %s\n", (unsigned)millis(), name, levelName, buf);
+}
+
+void Logger::trace(const char *fmt, ...) const {
+    va_list ap;
+    va_start(ap, fmt);
+    log(LOG_LEVEL_TRACE, fmt, ap);
+    va_end(ap);
+}
+
+void Logger::info(const char *fmt, ...) const {
+    va_list ap;
+    va_start(ap, fmt);
+    log(LOG_LEVEL_INFO, fmt, ap);
+    va_end(ap);
+}
+
+void Logger::warn(const char *fmt, ...) const {
+    va_list ap;
+    va_start(ap, fmt);
+    log(LOG_LEVEL_WARN, fmt, ap);
+    va_end(ap);
+}
+
+void Logger::error(const char *fmt, ...) const {
+    va_list ap;
+    va_start(ap, fmt);
+    log(LOG_LEVEL_ERROR, fmt, ap);
+    va_end(ap);
+}
+
+bool Logger::isTraceEnabled() const {
+    return logEnabled(LOG_LEVEL_TRACE);
+}
+
+bool Logger::isInfoEnabled() const {
+    return logEnabled(LOG_LEVEL_INFO);
+}
+
+//
+// Print and Stream
+//
+size_t Print::write(const uint8_t *buffer, size_t size) {
+    size_t count = 0;
+    for(size_t ii = 0; ii < size; ii++) {
+        count += write(buffer[ii]);
+    }
+    return count;
+}
+
+size_t Print::vprintf(bool newline, const char *fmt, va_list ap) {
+    char buf[512];
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    size_t count = write(buf);
+    if (newline) {
+        count += write("\r\n");
+    }
+    return count;
+}
+
+size_t Print::printf(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    size_t count = vprintf(false, fmt, ap);
+    va_end(ap);
+    return count;
+}
+
+size_t Print::printlnf(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    size_t count = vprintf(true, fmt, ap);
+    va_end(ap);
+    return count;
+}
+
+size_t Stream::readBytes(char *buffer, size_t length) {
+    size_t count = 0;
+    system_tick_t start = millis();
+    while(count < length && millis() - start < timeout) {
+        int c = read();
+        if (c < 0) {
+            delay(1);
+            continue;
+        }
+        buffer[count++] = (char)c;
+    }
+    return count;
+}
+
+//
+// I2C
+//
+void TwoWire::busTime(size_t bytes, bool start) {
+    // Each byte is 8 data bits and an ACK bit, plus a start (or repeated start) and stop condition
+    double bits = 9.0 * (double)bytes + (start ? 1.0 : 0.0) + 1.0;
+    double us = bits * 1000000.0 / (double)clockHz;
+    stats.transactions++;
+    stats.bytes += (uint32_t)bytes;
+    stats.busyUs += us;
+    mockBusyWaitUs(us);
+}
+
+void TwoWire::beginTransmission(uint8_t address) {
+    txAddress = address;
+    txLen = 0;
+    txOverflow = false;
+}
+
+size_t TwoWire::write(uint8_t data) {
+    if (txLen >= bufferSize) {
+        txOverflow = true;
+        return 0;
+    }
+    txBuf[txLen++] = data;
+    return 1;
+}
+
+size_t TwoWire::write(const uint8_t *data, size_t size) {
+    size_t count = 0;
+    for(size_t ii = 0; ii < size; ii++) {
+        count += write(data[ii]);
+    }
+    return count;
+}
+
+uint8_t TwoWire::endTransmission(bool stop) {
+    if (!enabled) {
+        return 1;
+    }
+    // Address byte plus the data
+    busTime(1 + txLen, !repeatedStart);
+    repeatedStart = !stop;
+
+    if (!device || !device->i2cWrite(txAddress, txBuf, txLen)) {
+        // NACK of the address
+        return 3;
+    }
+    return 0;
+}
+
+size_t TwoWire::requestFrom(uint8_t address, size_t quantity, uint8_t stop) {
+    rxLen = rxOff = 0;
+    if (!enabled) {
+        return 0;
+    }
+    if (quantity > bufferSize) {
+        quantity = bufferSize;
+    }
+    busTime(1 + quantity, true);
+    repeatedStart = !stop;
+
+    if (!device || !device->i2cRead(address, rxBuf, quantity)) {
+        return 0;
+    }
+    rxLen = quantity;
+    return quantity;
+}
+
+int TwoWire::available() {
+    return (int)(rxLen - rxOff);
+}
+
+int TwoWire::read() {
+    return (rxOff < rxLen) ? rxBuf[rxOff++] : -1;
+}
+
+int TwoWire::peek() {
+    return (rxOff < rxLen) ? rxBuf[rxOff] : -1;
+}
+
+//
+// SPI
+//
+void SPIClass::busTime(size_t bytes) {
+    double us = 8.0 * (double)bytes * 1000000.0 / (double)clockHz;
+    stats.bytes += (uint32_t)bytes;
+    stats.busyUs += us;
+    mockBusyWaitUs(us);
+}
+
+void SPIClass::beginTransaction(const SPISettings &settings) {
+    mutex.lock();
+    clockHz = settings.clock;
+}
+
+void SPIClass::endTransaction() {
+    mutex.unlock();
+}
+
+void SPIClass::mockAttach(pin_t csPin, MockBusDevice *device) {
+    if (csPin < MOCK_NUM_PINS) {
+        std::lock_guard<std::mutex> lock(pinsMutex);
+        pins[csPin].spi = this;
+        pins[csPin].spiDevice = device;
+    }
+}
+
+// Returns the device on this bus whose CS pin is low
+static MockBusDevice *selectedDevice(SPIClass *spi) {
+    std::lock_guard<std::mutex> lock(pinsMutex);
+    for(pin_t pin = 0; pin < MOCK_NUM_PINS; pin++) {
+        if (pins[pin].spi == spi && pins[pin].spiDevice && pins[pin].level == LOW) {
+            return pins[pin].spiDevice;
+        }
+    }
+    return nullptr;
+}
+
+uint8_t SPIClass::transfer(uint8_t data) {
+    busTime(1);
+    MockBusDevice *device = selectedDevice(this);
+    return device ? device->spiTransfer(data) : 0xff;
+}
+
+void SPIClass::transfer(const void *txBuffer, void *rxBuffer, size_t length, wiring_spi_dma_transfercomplete_callback_t callback) {
+    MockBusDevice *device = selectedDevice(this);
+    for(size_t ii = 0; ii < length; ii++) {
+        uint8_t value = device ? device->spiTransfer(txBuffer ? ((const uint8_t *)txBuffer)[ii] : 0) : 0xff;
+        if (rxBuffer) {
+            ((uint8_t *)rxBuffer)[ii] = value;
+        }
+    }
+
+    if (callback) {
+        // DMA: other threads can run during the transfer, then the callback is called
+        double us = 8.0 * (double)length * 1000000.0 / (double)clockHz;
+        stats.bytes += (uint32_t)length;
+        stats.busyUs += us;
+        std::this_thread::sleep_for(std::chrono::nanoseconds((int64_t)(us * 1000.0)));
+        callback();
+    }
+    else {
+        busTime(length);
+    }
+}
@@ -0,0 +1,361 @@
+#ifndef __MOCK_PARTICLE_H
+#define __MOCK_PARTICLE_H
+
+// Minimal host (Linux) implementation of the Device OS APIs used by SC16IS7xxRK, so the library
+// can be built and tested off-device with the simulator in test/host. Only the parts of the
+// Device OS API that the library uses are implemented.
+//
+// I2C and SPI transactions are passed to a MockBusDevice (typically SC16IS7xxSim) and take the
+// time they would take on the bus at the configured clock speed. Interrupt handlers attached
+// using attachInterrupt() are called from the device's thread with the ATOMIC_BLOCK lock held.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#include <atomic>
+#include <functional>
+#include <mutex>
+
+typedef uint16_t pin_t;
+typedef uint32_t system_tick_t;
+
+const pin_t PIN_INVALID = 0xff;
+
+const pin_t D0 = 0;
+const pin_t D1 = 1;
+const pin_t D2 = 2;
+const pin_t D3 = 3;
+const pin_t D4 = 4;
+const pin_t D5 = 5;
+const pin_t D6 = 6;
+const pin_t D7 = 7;
+const pin_t D8 = 8;
+const pin_t A0 = 19;
+const pin_t A1 = 18;
+const pin_t A2 = 17;
+const pin_t A3 = 16;
+const pin_t A4 = 15;
+const pin_t A5 = 14;
+const pin_t MOCK_NUM_PINS = 32;
+
+#define HIGH 1
+#define LOW 0
+
+typedef enum { INPUT, OUTPUT, INPUT_PULLUP, INPUT_PULLDOWN } PinMode;
+typedef enum { CHANGE, RISING, FALLING } InterruptMode;
+
+#define MHZ 1000000
+#define MSBFIRST 1
+#define LSBFIRST 0
+#define SPI_MODE0 0x00
+#define SPI_MODE1 0x01
+#define SPI_MODE2 0x02
+#define SPI_MODE3 0x03
+
+const uint32_t CLOCK_SPEED_100KHZ = 100000;
+const uint32_t CLOCK_SPEED_400KHZ = 400000;
+const uint32_t CLOCK_SPEED_1MHZ = 1000000;
+
+system_tick_t millis();
+uint32_t micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(pin_t pin, PinMode mode);
+void digitalWrite(pin_t pin, uint8_t value);
+int32_t digitalRead(pin_t pin);
+void pinSetFast(pin_t pin);
+void pinResetFast(pin_t pin);
+int32_t pinReadFast(pin_t pin);
+
+bool attachInterrupt(pin_t pin, std::function<void()> handler, InterruptMode mode, int8_t priority = -1, uint8_t subpriority = 0);
+void detachInterrupt(pin_t pin);
+
+template <typename T>
+bool attachInterrupt(pin_t pin, void (T::*handler)(), T *instance, InterruptMode mode, int8_t priority = -1, uint8_t subpriority = 0) {
+    return attachInterrupt(pin, std::function<void()>([handler, instance]() { (instance->*handler)(); }), mode, priority, subpriority);
+}
+
+/**
+ * @brief Lock that stands in for disabling interrupts. Held while an interrupt handler runs.
+ */
+std::recursive_mutex &mockInterruptLock();
+
+#ifndef DOXYGEN_DO_NOT_DOCUMENT
+class MockAtomicBlock {
+public:
+    MockAtomicBlock() { mockInterruptLock().lock(); }
+    ~MockAtomicBlock() { mockInterruptLock().unlock(); }
+    bool done = false;
+};
+
+template <typename T>
+class MockLockGuard {
+public:
+    MockLockGuard(T &lock) : lock(lock) { lock.lock(); }
+    ~MockLockGuard() { lock.unlock(); }
+    T &lock;
+    bool done = false;
+};
+#endif // DOXYGEN_DO_NOT_DOCUMENT
+
+#define ATOMIC_BLOCK() for(MockAtomicBlock __atomicBlock; !__atomicBlock.done; __atomicBlock.done = true)
+#define SINGLE_THREADED_BLOCK() ATOMIC_BLOCK()
+#define WITH_LOCK(lock) for(MockLockGuard<decltype(lock)> __lockGuard(lock); !__lockGuard.done; __lockGuard.done = true)
+
+// Semaphores and threads
+typedef void *os_semaphore_t;
+typedef void (*os_thread_fn_t)(void *param);
+typedef uint8_t os_thread_prio_t;
+
+const system_tick_t CONCURRENT_WAIT_FOREVER = (system_tick_t)-1;
+const os_thread_prio_t OS_THREAD_PRIORITY_DEFAULT = 2;
+const size_t OS_THREAD_STACK_SIZE_DEFAULT = 3 * 1024;
+
+int os_semaphore_create(os_semaphore_t *semaphore, unsigned max, unsigned initial);
+int os_semaphore_destroy(os_semaphore_t semaphore);
+int os_semaphore_take(os_semaphore_t semaphore, system_tick_t timeout, bool reserved);
+int os_semaphore_give(os_semaphore_t semaphore, bool reserved);
+
+/**
+ * @brief Runs the thread function on a detached std::thread. Threads are never stopped, so
+ * host programs should end using mockExit().
+ */
+class Thread {
+public:
+    Thread(const char *name, os_thread_fn_t function, void *functionParam = nullptr,
+        os_thread_prio_t priority = OS_THREAD_PRIORITY_DEFAULT, size_t stackSize = OS_THREAD_STACK_SIZE_DEFAULT);
+};
+
+/**
+ * @brief CPU time in microseconds used by all threads started using Thread, for benchmarks
+ */
+double mockThreadCpuUs();
+
+class RecursiveMutex {
+public:
+    void lock() { mutex.lock(); }
+    void unlock() { mutex.unlock(); }
+    bool trylock() { return mutex.try_lock(); }
+    bool try_lock() { return mutex.try_lock(); }
+
+protected:
+    std::recursive_mutex mutex;
+};
+
+typedef enum {
+    LOG_LEVEL_ALL = 1, LOG_LEVEL_TRACE = 1, LOG_LEVEL_INFO = 30, LOG_LEVEL_WARN = 40,
+    LOG_LEVEL_ERROR = 50, LOG_LEVEL_NONE = 70
+} LogLevel;
+
+/**
+ * @brief Logs to stderr. The level is set by mockSetLogLevel() or the SC16IS7XX_LOG environment
+ * variable (trace, info, warn, error, or none). The default is error.
+ */
+class Logger {
+public:
+    explicit Logger(const char *name) : name(name) {};
+
+    void trace(const char *fmt, ...) const __attribute__((format(printf, 2, 3)));
+    void info(const char *fmt, ...) const __attribute__((format(printf, 2, 3)));
+    void warn(const char *fmt, ...) const __attribute__((format(printf, 2, 3)));
+    void error(const char *fmt, ...) const __attribute__((format(printf, 2, 3)));
+
+    bool isTraceEnabled() const;
+    bool isInfoEnabled() const;
+
+protected:
+    void log(LogLevel level, const char *fmt, va_list ap) const;
+
+    const char *name;
+};
+
+extern Logger Log;
+
+void mockSetLogLevel(LogLevel level);
+
+class Print {
+public:
+    virtual ~Print() {};
+
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size);
+    size_t write(const char *str) { return write((const uint8_t *)str, strlen(str)); };
+
+    size_t print(const char *str) { return write(str); };
+    size_t println(const char *str) { return write(str) + write("\r\n"); };
+    size_t printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+    size_t printlnf(const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+
+protected:
+    size_t vprintf(bool newline, const char *fmt, va_list ap);
+};
+
+class Stream : public Print {
+public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual void flush() = 0;
+
+    void setTimeout(system_tick_t timeout) { this->timeout = timeout; };
+    size_t readBytes(char *buffer, size_t length);
+
+protected:
+    system_tick_t timeout = 1000;
+};
+
+/**
+ * @brief A simulated device on a mock I2C or SPI bus
+ */
+class MockBusDevice {
+public:
+    virtual ~MockBusDevice() {};
+
+    /**
+     * @brief I2C write transaction. The first byte is the register address. Return false to NACK.
+     */
+    virtual bool i2cWrite(uint8_t addr, const uint8_t *data, size_t size) { return false; };
+
+    /**
+     * @brief I2C read transaction, from the register address of the last write. Return false to NACK.
+     */
+    virtual bool i2cRead(uint8_t addr, uint8_t *data, size_t size) { return false; };
+
+    /**
+     * @brief SPI chip select changed
+     */
+    virtual void spiSelect(bool selected) {};
+
+    /**
+     * @brief One byte SPI transfer while selected
+     */
+    virtual uint8_t spiTransfer(uint8_t value) { return 0; };
+};
+
+/**
+ * @brief Time spent on the bus, for checking the bus timing model
+ */
+struct MockBusStats {
+    uint32_t transactions = 0; //!< I2C transactions or SPI chip selects
+    uint32_t bytes = 0; //!< Bytes transferred, including I2C address and register bytes
+    double busyUs = 0; //!< Modelled time on the bus in microseconds
+};
+
+class TwoWire : public Stream {
+public:
+    void begin() { enabled = true; };
+    void end() { enabled = false; };
+    bool isEnabled() { return enabled; };
+    void setSpeed(uint32_t clockHz) { this->clockHz = clockHz; };
+    bool lock() { mutex.lock(); return true; };
+    bool unlock() { mutex.unlock(); return true; };
+
+    void beginTransmission(uint8_t address);
+    virtual size_t write(uint8_t data) override;
+    virtual size_t write(const uint8_t *data, size_t size) override;
+    uint8_t endTransmission(bool stop = true);
+    size_t requestFrom(uint8_t address, size_t quantity, uint8_t stop = true);
+    virtual int available() override;
+    virtual int read() override;
+    virtual int peek() override;
+    virtual void flush() override {};
+
+    /**
+     * @brief Add a device to this bus. A device can respond to any number of addresses.
+     */
+    void mockAttach(MockBusDevice *device) { this->device = device; };
+
+    /**
+     * @brief Set the size of the transmit and receive buffers, like acquireWireBuffer(). Default: 32.
+     */
+    void mockSetBufferSize(size_t size) { bufferSize = (size <= sizeof(txBuf)) ? size : sizeof(txBuf); };
+
+    uint32_t clockHz = CLOCK_SPEED_100KHZ; //!< Bus speed, set using setSpeed()
+    MockBusStats stats; //!< Bus timing statistics
+
+protected:
+    void busTime(size_t bytes, bool start);
+
+    bool enabled = false;
+    std::recursive_mutex mutex;
+    MockBusDevice *device = nullptr;
+    size_t bufferSize = 32;
+    uint8_t txAddress = 0;
+    uint8_t txBuf[256];
+    size_t txLen = 0;
+    bool txOverflow = false;
+    uint8_t rxBuf[256];
+    size_t rxLen = 0;
+    size_t rxOff = 0;
+    bool repeatedStart = false;
+};
+
+class SPISettings {
+public:
+    SPISettings() {};
+    SPISettings(unsigned clock, uint8_t bitOrder, uint8_t dataMode) : clock(clock), bitOrder(bitOrder), dataMode(dataMode) {};
+
+    unsigned clock = 4 * MHZ;
+    uint8_t bitOrder = MSBFIRST;
+    uint8_t dataMode = SPI_MODE0;
+};
+
+typedef void (*wiring_spi_dma_transfercomplete_callback_t)(void);
+
+class SPIClass {
+public:
+    void begin() {};
+    void begin(pin_t ssPin) {};
+    void beginTransaction(const SPISettings &settings);
+    void endTransaction();
+    uint8_t transfer(uint8_t data);
+    void transfer(const void *txBuffer, void *rxBuffer, size_t length, wiring_spi_dma_transfercomplete_callback_t callback);
+    void transferCancel() {};
+
+    /**
+     * @brief Add a device to this bus, selected by the csPin going low
+     */
+    void mockAttach(pin_t csPin, MockBusDevice *device);
+
+    MockBusStats stats; //!< Bus timing statistics
+
+protected:
+    void busTime(size_t bytes);
+
+    std::recursive_mutex mutex;
+    unsigned clockHz = 4 * MHZ;
+};
+
+extern TwoWire Wire;
+extern TwoWire Wire1;
+extern SPIClass SPI;
+extern SPIClass SPI1;
+
+/**
+ * @brief Wait for the given time without yielding, used for the bus timing model
+ */
+void mockBusyWaitUs(double us);
+
+/**
+ * @brief Set the level of an input pin from a simulated device, calling interrupt handlers
+ *
+ * The handler for a falling edge is called from the calling thread with mockInterruptLock() held.
+ */
+void mockSetPin(pin_t pin, uint8_t level);
+
+/**
+ * @brief Provide the level of an input pin when it's read, instead of the last mockSetPin() value
+ */
+void mockSetPinReader(pin_t pin, std::function<int32_t()> reader);
+
+/**
+ * @brief End the program without running static destructors, which would race the detached threads
+ */
+void mockExit(int code) __attribute__((noreturn));
+
+#endif /* __MOCK_PARTICLE_H */
@@ -0,0 +1,139 @@
+#include "HostTest.h"
+#include "TestSetup.h"
+
+#include <math.h>
+
+/**
+ * @brief Expected result of SC16IS7xxPort::calculateDivisor()
+ */
+struct DivisorCase {
+    int oscillatorFreqHz;
+    int baudRate;
+    uint16_t divisor;
+    bool prescaler4;
+    int actualBaudRate;
+};
+
+static const DivisorCase divisorCases[] = {
+    // Standard baud rates with the default 1.8432 MHz oscillator are exact
+    { 1843200, 300, 384, false, 300 },
+    { 1843200, 1200, 96, false, 1200 },
+    { 1843200, 2400, 48, false, 2400 },
+    { 1843200, 4800, 24, false, 4800 },
+    { 1843200, 9600, 12, false, 9600 },
+    { 1843200, 14400, 8, false, 14400 },
+    { 1843200, 19200, 6, false, 19200 },
+    { 1843200, 38400, 3, false, 38400 },
+    { 1843200, 57600, 2, false, 57600 },
+    { 1843200, 115200, 1, false, 115200 },
+
+    // And with 14.7456 MHz, up to 921600
+    { 14745600, 300, 3072, false, 300 },
+    { 14745600, 9600, 96, false, 9600 },
+    { 14745600, 115200, 8, false, 115200 },
+    { 14745600, 230400, 4, false, 230400 },
+    { 14745600, 460800, 2, false, 460800 },
+    { 14745600, 921600, 1, false, 921600 },
+
+    // Nearest divisor: 11.52 rounds to 12, truncating would give 11 (10473 baud, 4.7% error)
+    { 1843200, 10000, 12, false, 9600 },
+    { 1843200, 9700, 12, false, 9600 },
+    // 3.69 rounds to 4
+    { 14745600, 250000, 4, false, 230400 },
+
+    // The divide by 4 prescaler is only used when the divisor does not fit in 16 bits
+    { 14745600, 10, 23040, true, 10 },
+    { 1843200, 1, 28800, true, 1 },
+    // Both prescalers are exact (16 and 4), prescaler 1 is preferred
+    { 14745600, 57600, 16, false, 57600 },
+
+    // Faster than the oscillator / 16 uses divisor 1. begin() rejects these using the tolerance.
+    { 1843200, 230400, 1, false, 115200 },
+    { 1843200, 921600, 1, false, 115200 },
+
+    // Invalid parameters
+    { 1843200, 0, 1, false, 0 },
+    { 0, 9600, 1, false, 0 },
+    { 1843200, -9600, 1, false, 0 },
+};
+
+TEST(calculate_divisor_table) {
+    for(const DivisorCase &c : divisorCases) {
+        uint16_t divisor = 0;
+        bool prescaler4 = true;
+        int actual = SC16IS7xxPort::calculateDivisor(c.oscillatorFreqHz, c.baudRate, divisor, prescaler4);
+        if (actual != c.actualBaudRate || divisor != c.divisor || prescaler4 != c.prescaler4) {
+            printf("oscillator=%d baud=%d got actual=%d divisor=%u prescaler4=%d\n",
+                c.oscillatorFreqHz, c.baudRate, actual, divisor, (int)prescaler4);
+        }
+        EXPECT_EQ(actual, c.actualBaudRate);
+        EXPECT_EQ(divisor, c.divisor);
+        EXPECT_EQ(prescaler4, c.prescaler4);
+    }
+}
+
+TEST(begin_baud_rate_tolerance) {
+    auto &dev = testDevice<SC16IS7x0>(SC16IS7xxSim::Model::SC16IS750, TEST_BUS_SPI_4M);
+    SC16IS7xxSim &sim = dev.sim;
+    auto &uart = dev.uart;
+    uart.softwareReset();
+
+    EXPECT(uart.begin(19200));
+    EXPECT(fabs(sim.getBaudRate(0) - 19200) < 1);
+
+    // 9700 baud is 9600 with a -1.03% error, within the default 2% tolerance
+    EXPECT(uart.begin(9700));
+    EXPECT_EQ(uart.getActualBaudRate(), 9600);
+    EXPECT(fabs(uart.getBaudRateError() + 1.03) < 0.01);
+    EXPECT(fabs(sim.getBaudRate(0) - 9600) < 1);
+
+    EXPECT(uart.begin(19200));
+
+    // Rejected with a 1% tolerance, and the chip keeps the previous baud rate
+    uart.withBaudRateTolerance(1.0);
+    EXPECT(!uart.begin(9700));
+    EXPECT(fabs(sim.getBaudRate(0) - 19200) < 1);
+
+    // 230400 requires a faster oscillator
+    uart.withBaudRateTolerance(2.0);
+    EXPECT(!uart.begin(230400));
+    EXPECT(fabs(sim.getBaudRate(0) - 19200) < 1);
+}
+
+TEST(begin_baud_rate_fast_oscillator) {
+    auto &dev = testDevice<SC16IS7x0>(SC16IS7xxSim::Model::SC16IS750, TEST_BUS_SPI_4M, false, 14745600);
+    SC16IS7xxSim &sim = dev.sim;
+    auto &uart = dev.uart;
+    uart.softwareReset();
+
+    EXPECT(uart.begin(921600));
+    EXPECT(fabs(sim.getBaudRate(0) - 921600) < 1);
+    EXPECT_EQ(uart.getBaudRateError(), 0);
+
+    // Uses the divide by 4 prescaler (MCR[7])
+    EXPECT(uart.begin(10));
+    EXPECT(fabs(sim.getBaudRate(0) - 10) < 0.01);
+
+    // Prescaler 1 again
+    EXPECT(uart.begin(9600));
+    EXPECT(fabs(sim.getBaudRate(0) - 9600) < 1);
+}
+
+TEST(begin_max_baud_rate) {
+    // 6000000 baud is exact with a 96 MHz clock (divisor 1), but is faster than MAX_BAUD_RATE
+    auto &dev = testDevice<SC16IS7x0>(SC16IS7xxSim::Model::SC16IS750, TEST_BUS_SPI_4M, false, 96000000);
+    SC16IS7xxSim &sim = dev.sim;
+    auto &uart = dev.uart;
+    uart.softwareReset();
+
+    uint16_t divisor;
+    bool prescaler4;
+    EXPECT_EQ(SC16IS7xxPort::calculateDivisor(96000000, 6000000, divisor, prescaler4), 6000000);
+    EXPECT(6000000 > SC16IS7xxPort::MAX_BAUD_RATE);
+
+    EXPECT(uart.begin(3000000));
+    EXPECT(fabs(sim.getBaudRate(0) - 3000000) < 1);
+
+    EXPECT(!uart.begin(6000000));
+    EXPECT(fabs(sim.getBaudRate(0) - 3000000) < 1);
+}
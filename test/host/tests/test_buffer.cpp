@@ -0,0 +1,81 @@
+#include "HostTest.h"
+#include "SC16IS7xxRK.h"
+
+static void bufferWrapTest(bool singleProducerSingleConsumer) {
+    SC16IS7xxBuffer buf;
+    EXPECT(buf.init(100, singleProducerSingleConsumer));
+
+    // Move the offsets through the end of the buffer several times with varying sizes
+    uint8_t next = 0;
+    uint8_t expected = 0;
+    for(size_t pass = 0; pass < 50; pass++) {
+        uint8_t data[64];
+        size_t size = 1 + (pass * 13) % 64;
+        for(size_t ii = 0; ii < size; ii++) {
+            data[ii] = next++;
+        }
+        EXPECT_EQ(buf.write(data, size), size);
+        EXPECT_EQ(buf.availableToRead(), size);
+
+        uint8_t out[64];
+        EXPECT_EQ(buf.read(out, sizeof(out)), (int)size);
+        for(size_t ii = 0; ii < size; ii++) {
+            EXPECT_EQ(out[ii], expected++);
+        }
+    }
+    EXPECT_EQ(buf.availableToRead(), 0);
+    EXPECT_EQ(buf.read(), -1);
+}
+
+TEST(buffer_wrap) {
+    bufferWrapTest(false);
+}
+
+TEST(buffer_wrap_lock_free) {
+    bufferWrapTest(true);
+}
+
+TEST(buffer_full) {
+    SC16IS7xxBuffer buf;
+    EXPECT(buf.init(32));
+
+    uint8_t data[40];
+    for(size_t ii = 0; ii < sizeof(data); ii++) {
+        data[ii] = (uint8_t)ii;
+    }
+    size_t written = buf.write(data, sizeof(data));
+    EXPECT(written < sizeof(data));
+    EXPECT_EQ(buf.availableToWrite(), 0);
+    EXPECT_EQ(buf.availableToRead(), written);
+
+    EXPECT_EQ(buf.peek(), 0);
+    EXPECT_EQ(buf.consume(10), 10);
+    EXPECT_EQ(buf.read(), 10);
+    EXPECT_EQ(buf.availableToWrite(), 11);
+}
+
+TEST(buffer_peek_contiguous) {
+    SC16IS7xxBuffer buf;
+    EXPECT(buf.init(16));
+
+    uint8_t data[12];
+    for(size_t ii = 0; ii < sizeof(data); ii++) {
+        data[ii] = (uint8_t)ii;
+    }
+    buf.write(data, sizeof(data));
+    buf.consume(10);
+    buf.write(data, sizeof(data));
+
+    // 2 bytes left from the first write, then the second write wraps around the end
+    const uint8_t *p;
+    size_t n = buf.peekContiguous(p);
+    EXPECT(n > 0 && n < 14);
+    EXPECT_EQ(p[0], 10);
+
+    size_t total = 0;
+    while((n = buf.peekContiguous(p)) > 0) {
+        total += n;
+        buf.consume(n);
+    }
+    EXPECT_EQ(total, 14);
+}
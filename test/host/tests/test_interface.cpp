@@ -0,0 +1,207 @@
+#include "HostTest.h"
+#include "TestSetup.h"
+
+TEST(i2c_reset_power_on_check_7x0) {
+    auto &dev = testDevice<SC16IS7x0>(SC16IS7xxSim::Model::SC16IS750, TEST_BUS_I2C_400K);
+    auto &uart = dev.uart;
+
+    uart.softwareReset();
+    EXPECT(uart.powerOnCheck());
+}
+
+TEST(spi_reset_power_on_check_7x0) {
+    auto &dev = testDevice<SC16IS7x0>(SC16IS7xxSim::Model::SC16IS740, TEST_BUS_SPI_4M);
+    auto &uart = dev.uart;
+
+    uart.softwareReset();
+    EXPECT(uart.powerOnCheck());
+}
+
+TEST(i2c_reset_power_on_check_7x2) {
+    auto &dev = testDevice<SC16IS7x2T<SC16IS7xxI2CTransport>>(SC16IS7xxSim::Model::SC16IS752, TEST_BUS_I2C_400K);
+    auto &uart = dev.uart;
+
+    uart.softwareReset();
+    EXPECT(uart.powerOnCheck());
+}
+
+TEST(spi_reset_power_on_check_7x2) {
+    auto &dev = testDevice<SC16IS7x2T<SC16IS7xxSpiTransport>>(SC16IS7xxSim::Model::SC16IS762, TEST_BUS_SPI_4M);
+    auto &uart = dev.uart;
+
+    uart.softwareReset();
+    EXPECT(uart.powerOnCheck());
+}
+
+TEST(power_on_check_no_device) {
+    // Nothing at 0x49, so all transactions are NACKed
+    SC16IS7xxSim sim(SC16IS7xxSim::Model::SC16IS750);
+    sim.attachI2C(Wire, 0x49);
+    SC16IS7x0 uart;
+    uart.withI2C(&Wire, 0);
+
+    EXPECT(!uart.powerOnCheck());
+}
+
+TEST(begin_sets_baud_and_format) {
+    auto &dev = testDevice<SC16IS7x0>(SC16IS7xxSim::Model::SC16IS750, TEST_BUS_SPI_4M);
+    SC16IS7xxSim &sim = dev.sim;
+    auto &uart = dev.uart;
+    uart.softwareReset();
+
+    EXPECT(uart.begin(9600));
+    EXPECT(fabs(sim.getBaudRate(0) - 9600) < 1);
+    EXPECT(fabs(sim.getCharTimeUs(0) - 10 * 1000000.0 / 9600) < 1);
+
+    EXPECT(uart.begin(115200, SC16IS7xxPort::OPTIONS_8E2));
+    EXPECT(fabs(sim.getBaudRate(0) - 115200) < 1);
+    EXPECT(fabs(sim.getCharTimeUs(0) - 12 * 1000000.0 / 115200) < 0.1);
+}
+
+TEST(begin_both_ports_7x2) {
+    auto &dev = testDevice<SC16IS7x2>(SC16IS7xxSim::Model::SC16IS752, TEST_BUS_I2C_400K);
+    SC16IS7xxSim &sim = dev.sim;
+    auto &uart = dev.uart;
+    uart.softwareReset();
+
+    EXPECT(uart.a().begin(19200));
+    EXPECT(uart.b().begin(57600));
+    EXPECT(fabs(sim.getBaudRate(0) - 19200) < 1);
+    EXPECT(fabs(sim.getBaudRate(1) - 57600) < 1);
+}
+
+TEST(shadow_registers_verify) {
+    auto &dev = testDevice<SC16IS7x0>(SC16IS7xxSim::Model::SC16IS750, TEST_BUS_SPI_4M);
+    SC16IS7xxSim &sim = dev.sim;
+    auto &uart = dev.uart;
+    uart.withShadowRegisters();
+    uart.softwareReset();
+    EXPECT(uart.begin(115200));
+
+    EXPECT(uart.verifyShadowRegisters());
+
+    // Cached reads do not go to the chip
+    uint64_t before = sim.getStats(0).registerReads;
+    uart.readRegister(0, SC16IS7xxInterface::LCR_REG);
+    uart.readRegister(0, SC16IS7xxInterface::IER_REG);
+    EXPECT_EQ(sim.getStats(0).registerReads, before);
+}
+
+TEST(batch_overflow_not_executed) {
+    // A batch with more operations than MAX_OPS is not executed, so the chip is never partially configured
+    auto &dev = testDevice<SC16IS7x0>(SC16IS7xxSim::Model::SC16IS750, TEST_BUS_SPI_4M);
+    SC16IS7xxSim &sim = dev.sim;
+    auto &uart = dev.uart;
+    uart.softwareReset();
+
+    SC16IS7xxBatch batch;
+    for(size_t ii = 0; ii < SC16IS7xxBatch::MAX_OPS; ii++) {
+        EXPECT(batch.addWriteRegister(0, SC16IS7xxInterface::SPR_REG, (uint8_t)ii));
+    }
+    EXPECT(!batch.hasOverflowed());
+    EXPECT(!batch.addWriteRegister(0, SC16IS7xxInterface::SPR_REG, 0xaa));
+    EXPECT(batch.hasOverflowed());
+    EXPECT_EQ(batch.size(), SC16IS7xxBatch::MAX_OPS);
+
+    uint64_t before = sim.getStats(0).registerWrites;
+    EXPECT(!uart.execute(batch));
+    EXPECT_EQ(sim.getStats(0).registerWrites, before);
+
+    // clear() makes the batch usable again
+    batch.clear();
+    EXPECT(!batch.hasOverflowed());
+    EXPECT(batch.addWriteRegister(0, SC16IS7xxInterface::SPR_REG, 0x55));
+    EXPECT(uart.execute(batch));
+    EXPECT_EQ(sim.inspectRegister(0, SC16IS7xxInterface::SPR_REG), 0x55);
+}
+
+TEST(begin_all_options_fits_batch) {
+    // begin() with every feature that adds register writes still fits in one batch
+    auto &dev = testDevice<SC16IS7x0>(SC16IS7xxSim::Model::SC16IS750, TEST_BUS_SPI_4M, true);
+    auto &uart = dev.uart;
+    uart.softwareReset();
+    uart.withBufferedRead(1024).withBufferedWrite(1024).withRS485().withFrameDelimiter('\n');
+    EXPECT(uart.begin(115200, SC16IS7xxPort::OPTIONS_8N1 | SC16IS7xxPort::OPTIONS_FLOW_CONTROL_RTS_CTS | 
+        SC16IS7xxPort::OPTIONS_FLOW_CONTROL_XON_XOFF));
+}
+
+TEST(shadow_registers_off_by_default) {
+    auto &dev = testDevice<SC16IS7x0>(SC16IS7xxSim::Model::SC16IS750, TEST_BUS_SPI_4M);
+    SC16IS7xxSim &sim = dev.sim;
+    auto &uart = dev.uart;
+    uart.softwareReset();
+    EXPECT(uart.begin(115200));
+
+    uint64_t before = sim.getStats(0).registerReads;
+    uart.readRegister(0, SC16IS7xxInterface::LCR_REG);
+    EXPECT_EQ(sim.getStats(0).registerReads, before + 1);
+}
+
+TEST(shadow_registers_after_chip_reset) {
+    // After the chip resets without the library knowing, powerOnCheck() and begin() use the chip registers,
+    // not the cache
+    auto &dev = testDevice<SC16IS7x0>(SC16IS7xxSim::Model::SC16IS750, TEST_BUS_SPI_4M);
+    SC16IS7xxSim &sim = dev.sim;
+    auto &uart = dev.uart;
+    uart.withShadowRegisters();
+    uart.softwareReset();
+    EXPECT(uart.begin(115200));
+    EXPECT(!uart.powerOnCheck());
+
+    sim.hardwareReset();
+    EXPECT(uart.powerOnCheck());
+
+    sim.hardwareReset();
+    EXPECT(uart.begin(115200));
+    EXPECT(fabs(sim.getBaudRate(0) - 115200) < 1);
+    EXPECT(uart.verifyShadowRegisters());
+}
+
+// Exposes the FIFO transfer limits of the interface
+class InternalMaxUart : public SC16IS7x0 {
+public:
+    size_t readMax() const { return readInternalMax(); };
+    size_t writeMax() const { return writeInternalMax(); };
+};
+
+TEST(i2c_buffer_size_limits_fifo_transfers) {
+    auto &dev = testDevice<InternalMaxUart>(SC16IS7xxSim::Model::SC16IS750, TEST_BUS_I2C_400K);
+    SC16IS7xxSim &sim = dev.sim;
+    auto &uart = dev.uart;
+
+    // Default 32 byte Wire buffers, one transmit byte is the register address
+    EXPECT_EQ(uart.readMax(), 32);
+    EXPECT_EQ(uart.writeMax(), 31);
+
+    uart.withI2CBufferSize(48);
+    EXPECT_EQ(uart.readMax(), 48);
+    EXPECT_EQ(uart.writeMax(), 47);
+
+    // Limited by the 64 byte FIFO
+    uart.withI2CBufferSize(128);
+    EXPECT_EQ(uart.readMax(), 64);
+    EXPECT_EQ(uart.writeMax(), 64);
+
+    // A full FIFO is read in one I2C read
+    Wire.mockSetBufferSize(128);
+    uart.softwareReset();
+    uart.withBufferedRead(1024);
+    EXPECT(uart.begin(115200));
+
+    Wire.lock();
+    sim.peerWriteSequence(0, 64);
+    bool arrived = hostTestWaitFor([&]() { return sim.peerWriteDone(0); }, 100);
+    uint32_t rxBusOps = uart.getStats().rxBusOps;
+    Wire.unlock();
+    EXPECT(arrived);
+    EXPECT(hostTestWaitFor([&]() { return uart.available() == 64; }, 100));
+    // LSR, RXLVL and a single 64 byte FIFO read. With 32 byte Wire buffers this takes two FIFO reads.
+    EXPECT(uart.getStats().rxBusOps - rxBusOps <= 3);
+
+    uint8_t buf[64];
+    EXPECT_EQ(uart.read(buf, sizeof(buf)), 64);
+    for(size_t ii = 0; ii < sizeof(buf); ii++) {
+        EXPECT_EQ(buf[ii], ii);
+    }
+    Wire.mockSetBufferSize(32);
+}
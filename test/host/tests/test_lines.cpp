@@ -0,0 +1,193 @@
+#include "HostTest.h"
+#include "TestSetup.h"
+
+#include <string>
+#include <vector>
+
+// Buffered read device with the onLine() handler appending to lines
+static TestDevice<SC16IS7x0> &lineDevice(size_t bufferSize, std::vector<std::string> &lines, size_t maxLength = 256) {
+    auto &dev = testDevice<SC16IS7x0>(SC16IS7xxSim::Model::SC16IS750, TEST_BUS_SPI_4M);
+    auto &uart = dev.uart;
+    uart.softwareReset();
+    uart.withBufferedRead(bufferSize).onLine([&lines](const char *line, size_t length) {
+        // The line is null terminated
+        lines.push_back((line[length] == 0) ? std::string(line, length) : std::string("not terminated"));
+    }, maxLength);
+    uart.begin(115200);
+    return dev;
+}
+
+// Sends data from the peer and waits until it is in the read buffer
+static bool peerSend(TestDevice<SC16IS7x0> &dev, const char *data) {
+    int expected = dev.uart.available() + (int)strlen(data);
+    dev.sim.peerWrite(0, (const uint8_t *)data, strlen(data));
+    return hostTestWaitFor([&]() { return dev.uart.available() == expected; }, 100);
+}
+
+TEST(lines_full_buffer_without_delimiter) {
+    // The default onLine() maxLength of 256 is larger than the 63 bytes a 64 byte read buffer holds,
+    // so a long line is returned in pieces of the full buffer instead of stopping the port
+    std::vector<std::string> lines;
+    auto &dev = lineDevice(64, lines);
+    SC16IS7xxSim &sim = dev.sim;
+    auto &uart = dev.uart;
+
+    std::string text;
+    for(size_t ii = 0; ii < 100; ii++) {
+        text += (char)('A' + ii % 26);
+    }
+    sim.peerWrite(0, (const uint8_t *)text.c_str(), text.size());
+    EXPECT(hostTestWaitFor([&]() { uart.processLines(); return lines.size() == 1; }, 200));
+    EXPECT_EQ(lines[0].size(), 63);
+
+    // The rest was left in the RX FIFO and is not a complete line yet
+    EXPECT(hostTestWaitFor([&]() { return uart.available() == 37; }, 100));
+    EXPECT_EQ(uart.processLines(), 0);
+
+    EXPECT(peerSend(dev, "\n"));
+    EXPECT_EQ(uart.processLines(), 1);
+    EXPECT_EQ(lines.size(), 2);
+    EXPECT_EQ(lines[1].size(), 37);
+
+    EXPECT(lines[0] + lines[1] == text);
+    EXPECT_EQ(sim.getStats(0).rxOverruns, 0);
+}
+
+TEST(lines_readline_full_buffer_without_delimiter) {
+    std::vector<std::string> lines;
+    auto &dev = lineDevice(64, lines);
+    auto &uart = dev.uart;
+
+    char line[300];
+    std::string text(70, 'x');
+    dev.sim.peerWrite(0, (const uint8_t *)text.c_str(), text.size());
+    EXPECT(hostTestWaitFor([&]() { return uart.available() == 63; }, 100));
+    EXPECT_EQ(uart.readLine(line, sizeof(line)), 63);
+    EXPECT_EQ(strlen(line), 63);
+
+    EXPECT(hostTestWaitFor([&]() { return uart.available() == 7; }, 100));
+    EXPECT_EQ(uart.readLine(line, sizeof(line)), -1);
+    EXPECT(peerSend(dev, "\n"));
+    EXPECT_EQ(uart.readLine(line, sizeof(line)), 7);
+    EXPECT(strcmp(line, "xxxxxxx") == 0);
+}
+
+TEST(lines_wrap_read_buffer) {
+    std::vector<std::string> lines;
+    auto &dev = lineDevice(64, lines);
+    auto &uart = dev.uart;
+
+    // 40 bytes, contiguous
+    std::string first(39, 'a');
+    EXPECT(peerSend(dev, (first + "\n").c_str()));
+    EXPECT_EQ(uart.processLines(), 1);
+
+    // Starts at offset 40 and wraps around the end of the 64 byte buffer
+    std::string second = "0123456789abcdefghijklmnopqrstuvwxyz";
+    EXPECT(peerSend(dev, (second + "\n").c_str()));
+    EXPECT_EQ(uart.processLines(), 1);
+
+    EXPECT_EQ(lines.size(), 2);
+    EXPECT(lines[0] == first);
+    EXPECT(lines[1] == second);
+
+    // And with readLine()
+    EXPECT(peerSend(dev, (second + "\n").c_str()));
+    char line[64];
+    EXPECT_EQ(uart.readLine(line, sizeof(line)), (int)second.size());
+    EXPECT(second == line);
+}
+
+TEST(lines_longer_than_max_length) {
+    std::vector<std::string> lines;
+    auto &dev = lineDevice(256, lines, 10);
+    auto &uart = dev.uart;
+
+    EXPECT(peerSend(dev, "0123456789abcdefghijXYZ\n"));
+    EXPECT_EQ(uart.processLines(), 3);
+    EXPECT_EQ(lines.size(), 3);
+    EXPECT(lines[0] == "0123456789");
+    EXPECT(lines[1] == "abcdefghij");
+    EXPECT(lines[2] == "XYZ");
+    EXPECT_EQ(uart.available(), 0);
+}
+
+TEST(lines_delimiter_after_max_length) {
+    // A line of exactly maxLength bytes is one line, not a piece followed by an empty line
+    std::vector<std::string> lines;
+    auto &dev = lineDevice(256, lines, 10);
+    auto &uart = dev.uart;
+
+    EXPECT(peerSend(dev, "0123456789\n"));
+    EXPECT_EQ(uart.processLines(), 1);
+    EXPECT(lines[0] == "0123456789");
+
+    // One byte more is a piece and the last byte
+    EXPECT(peerSend(dev, "0123456789A\n"));
+    EXPECT_EQ(uart.processLines(), 2);
+    EXPECT(lines[1] == "0123456789");
+    EXPECT(lines[2] == "A");
+
+    // The same with readLine() and an 11 byte buffer
+    char line[11];
+    EXPECT(peerSend(dev, "0123456789\n0123456789A\n"));
+    EXPECT_EQ(uart.readLine(line, sizeof(line)), 10);
+    EXPECT(strcmp(line, "0123456789") == 0);
+    EXPECT_EQ(uart.readLine(line, sizeof(line)), 10);
+    EXPECT(strcmp(line, "0123456789") == 0);
+    EXPECT_EQ(uart.readLine(line, sizeof(line)), 1);
+    EXPECT(strcmp(line, "A") == 0);
+    EXPECT_EQ(uart.readLine(line, sizeof(line)), -1);
+}
+
+TEST(lines_read_between_scans) {
+    std::vector<std::string> lines;
+    auto &dev = lineDevice(256, lines);
+    auto &uart = dev.uart;
+    char line[64];
+
+    // The first 6 bytes are scanned without finding a delimiter. read() removes 2 of them, so the next
+    // scan must not resume at offset 6, which would skip the delimiter now at offset 4.
+    EXPECT(peerSend(dev, "abcdef"));
+    EXPECT_EQ(uart.readLine(line, sizeof(line)), -1);
+    EXPECT_EQ(uart.read(), 'a');
+    EXPECT_EQ(uart.read(), 'b');
+    EXPECT(peerSend(dev, "\nxyz"));
+    EXPECT_EQ(uart.readLine(line, sizeof(line)), 4);
+    EXPECT(strcmp(line, "cdef") == 0);
+
+    // The same with processLines() and read(buffer, size)
+    uint8_t buf[3];
+    EXPECT(peerSend(dev, "123"));
+    EXPECT_EQ(uart.processLines(), 0);
+    EXPECT_EQ(uart.read(buf, 3), 3);
+    EXPECT(memcmp(buf, "xyz", 3) == 0);
+    EXPECT(peerSend(dev, "\nend\n"));
+    EXPECT_EQ(uart.processLines(), 2);
+    EXPECT(lines[0] == "123");
+    EXPECT(lines[1] == "end");
+}
+
+TEST(lines_in_place_terminator) {
+    // processLines() replaces the delimiter with a null terminator in the read buffer. The data after
+    // the line is not modified.
+    std::vector<std::string> lines;
+    auto &dev = lineDevice(256, lines);
+    auto &uart = dev.uart;
+
+    EXPECT(peerSend(dev, "ab\ncd\nef"));
+    EXPECT_EQ(uart.processLines(), 2);
+    EXPECT(lines[0] == "ab");
+    EXPECT(lines[1] == "cd");
+
+    EXPECT_EQ(uart.available(), 2);
+    EXPECT_EQ(uart.read(), 'e');
+    EXPECT_EQ(uart.read(), 'f');
+
+    // Nothing remains of the consumed lines
+    EXPECT(peerSend(dev, "gh\n"));
+    char line[16];
+    EXPECT_EQ(uart.readLine(line, sizeof(line)), 2);
+    EXPECT(strcmp(line, "gh") == 0);
+    EXPECT_EQ(uart.available(), 0);
+}
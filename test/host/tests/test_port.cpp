@@ -0,0 +1,577 @@
+#include "HostTest.h"
+#include "TestSetup.h"
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+// Reads count bytes of the peerWriteSequence() pattern from port. Returns the number of bytes
+// that were not the expected value.
+static size_t readSequence(SC16IS7xxPort &port, size_t count, system_tick_t timeoutMs) {
+    size_t received = 0;
+    size_t mismatches = 0;
+    system_tick_t start = millis();
+    while(received < count && millis() - start < timeoutMs) {
+        uint8_t buf[128];
+        int n = port.read(buf, sizeof(buf));
+        if (n <= 0) {
+            delay(1);
+            continue;
+        }
+        for(int ii = 0; ii < n; ii++, received++) {
+            if (buf[ii] != (uint8_t)received) {
+                mismatches++;
+            }
+        }
+    }
+    return mismatches + (count - received);
+}
+
+TEST(write_reaches_peer) {
+    auto &dev = testDevice<SC16IS7x0>(SC16IS7xxSim::Model::SC16IS750, TEST_BUS_I2C_400K);
+    SC16IS7xxSim &sim = dev.sim;
+    auto &uart = dev.uart;
+    uart.softwareReset();
+    EXPECT(uart.begin(115200));
+
+    const char *msg = "hello, world";
+    EXPECT_EQ(uart.write((const uint8_t *)msg, strlen(msg)), strlen(msg));
+    uart.flush();
+
+    EXPECT(hostTestWaitFor([&]() { return sim.peerAvailable(0) == strlen(msg); }, 100));
+    char buf[32] = {0};
+    sim.peerRead(0, (uint8_t *)buf, sizeof(buf) - 1);
+    EXPECT(strcmp(buf, msg) == 0);
+}
+
+TEST(polled_read) {
+    auto &dev = testDevice<SC16IS7x0>(SC16IS7xxSim::Model::SC16IS750, TEST_BUS_SPI_4M);
+    SC16IS7xxSim &sim = dev.sim;
+    auto &uart = dev.uart;
+    uart.softwareReset();
+    EXPECT(uart.begin(115200));
+
+    sim.peerWrite(0, (const uint8_t *)"abc", 3);
+    EXPECT(hostTestWaitFor([&]() { return uart.available() == 3; }, 100));
+    EXPECT_EQ(uart.peek(), 'a');
+    EXPECT_EQ(uart.read(), 'a');
+    EXPECT_EQ(uart.read(), 'b');
+    EXPECT_EQ(uart.read(), 'c');
+    EXPECT_EQ(uart.read(), -1);
+}
+
+TEST(unbuffered_read_overruns) {
+    // Without buffered read, a slow reader loses data when the 64-byte FIFO fills
+    auto &dev = testDevice<SC16IS7x0>(SC16IS7xxSim::Model::SC16IS750, TEST_BUS_SPI_4M);
+    SC16IS7xxSim &sim = dev.sim;
+    auto &uart = dev.uart;
+    uart.softwareReset();
+    EXPECT(uart.begin(115200));
+
+    sim.peerWriteSequence(0, 200);
+    EXPECT(hostTestWaitFor([&]() { return sim.peerWriteDone(0); }, 200));
+    EXPECT_EQ(sim.getStats(0).rxOverruns, 200 - SC16IS7xxSim::FIFO_SIZE);
+}
+
+static void bufferedReadTest(const TestBus &bus, bool irq) {
+    auto &dev = testDevice<SC16IS7x0>(SC16IS7xxSim::Model::SC16IS750, bus, irq);
+    SC16IS7xxSim &sim = dev.sim;
+    auto &uart = dev.uart;
+    uart.softwareReset();
+    uart.withBufferedRead(20000);
+    EXPECT(uart.begin(115200));
+
+    // About 1.7 seconds of continuous data at 115200 baud
+    const size_t count = 20000;
+    sim.peerWriteSequence(0, count);
+    EXPECT_EQ(readSequence(uart, count, 5000), 0);
+    EXPECT_EQ(sim.getStats(0).rxOverruns, 0);
+
+    SC16IS7xxPortStats stats = uart.getStats();
+    EXPECT_EQ(stats.rxBytes, count);
+    EXPECT_EQ(stats.lsrOverrun, 0);
+}
+
+TEST(buffered_read_polled_spi) {
+    bufferedReadTest(TEST_BUS_SPI_4M, false);
+}
+
+TEST(buffered_read_polled_i2c) {
+    bufferedReadTest(TEST_BUS_I2C_400K, false);
+}
+
+TEST(buffered_read_irq_spi) {
+    bufferedReadTest(TEST_BUS_SPI_4M, true);
+}
+
+TEST(buffered_read_irq_i2c) {
+    bufferedReadTest(TEST_BUS_I2C_400K, true);
+}
+
+TEST(buffered_read_slow_reader) {
+    // The read buffer absorbs a reader that stops for longer than the FIFO lasts
+    auto &dev = testDevice<SC16IS7x0>(SC16IS7xxSim::Model::SC16IS750, TEST_BUS_SPI_4M);
+    SC16IS7xxSim &sim = dev.sim;
+    auto &uart = dev.uart;
+    uart.softwareReset();
+    uart.withBufferedRead(4096);
+    EXPECT(uart.begin(115200));
+
+    sim.peerWriteSequence(0, 2000);
+    delay(250);
+    EXPECT_EQ(readSequence(uart, 2000, 1000), 0);
+    EXPECT_EQ(sim.getStats(0).rxOverruns, 0);
+}
+
+TEST(buffered_write) {
+    auto &dev = testDevice<SC16IS7x0>(SC16IS7xxSim::Model::SC16IS750, TEST_BUS_I2C_400K);
+    SC16IS7xxSim &sim = dev.sim;
+    auto &uart = dev.uart;
+    uart.softwareReset();
+    uart.withBufferedWrite(4096);
+    EXPECT(uart.begin(115200));
+
+    std::vector<uint8_t> data(3000);
+    for(size_t ii = 0; ii < data.size(); ii++) {
+        data[ii] = (uint8_t)(ii * 7);
+    }
+
+    // The write returns before the data is sent
+    system_tick_t start = millis();
+    EXPECT_EQ(uart.write(data.data(), data.size()), data.size());
+    EXPECT(millis() - start < 50);
+
+    std::vector<uint8_t> received;
+    EXPECT(hostTestWaitFor([&]() {
+        uint8_t buf[256];
+        size_t n = sim.peerRead(0, buf, sizeof(buf));
+        received.insert(received.end(), buf, buf + n);
+        return received.size() >= data.size();
+    }, 2000));
+    EXPECT(received == data);
+    EXPECT_EQ(sim.getStats(0).txFifoFull, 0);
+}
+
+TEST(buffered_write_irq_slow_bus) {
+    // At 100 kHz, writing 32 bytes over I2C takes longer than sending them at 115200 baud, so the
+    // TX FIFO drains while it's being refilled after a THR interrupt
+    const TestBus bus = { false, CLOCK_SPEED_100KHZ, "i2c100k" };
+    auto &dev = testDevice<SC16IS7x0>(SC16IS7xxSim::Model::SC16IS750, bus, true);
+    SC16IS7xxSim &sim = dev.sim;
+    auto &uart = dev.uart;
+    uart.softwareReset();
+    uart.withBufferedWrite(4096);
+    EXPECT(uart.begin(115200));
+
+    std::vector<uint8_t> data(3000);
+    for(size_t ii = 0; ii < data.size(); ii++) {
+        data[ii] = (uint8_t)(ii * 7);
+    }
+    EXPECT_EQ(uart.write(data.data(), data.size()), data.size());
+
+    std::vector<uint8_t> received;
+    EXPECT(hostTestWaitFor([&]() {
+        uint8_t buf[256];
+        size_t n = sim.peerRead(0, buf, sizeof(buf));
+        received.insert(received.end(), buf, buf + n);
+        return received.size() >= data.size();
+    }, 2000));
+    EXPECT(received == data);
+}
+
+TEST(buffered_write_no_block) {
+    // With blockOnOverrun(false), the data that does not fit in the buffer is discarded, not the queued data
+    auto &dev = testDevice<SC16IS7x0>(SC16IS7xxSim::Model::SC16IS750, TEST_BUS_SPI_4M);
+    SC16IS7xxSim &sim = dev.sim;
+    auto &uart = dev.uart;
+    uart.softwareReset();
+    uart.withBufferedWrite(1024);
+    EXPECT(uart.begin(115200));
+    uart.blockOnOverrun(false);
+
+    std::vector<uint8_t> data(4000);
+    for(size_t ii = 0; ii < data.size(); ii++) {
+        data[ii] = (uint8_t)ii;
+    }
+    size_t written = uart.write(data.data(), data.size());
+    EXPECT(written >= 1000 && written < data.size());
+
+    std::vector<uint8_t> received;
+    EXPECT(hostTestWaitFor([&]() {
+        uint8_t buf[256];
+        size_t n = sim.peerRead(0, buf, sizeof(buf));
+        received.insert(received.end(), buf, buf + n);
+        return received.size() >= written;
+    }, 1000));
+    delay(10);
+    EXPECT_EQ(sim.peerAvailable(0), 0);
+    EXPECT(std::equal(received.begin(), received.end(), data.begin()));
+}
+
+TEST(dual_loop) {
+    // Like example 08-dual-loop: port A TX is connected to port B RX and port B TX to port A RX
+    auto &dev = testDevice<SC16IS7x2>(SC16IS7xxSim::Model::SC16IS752, TEST_BUS_SPI_4M);
+    SC16IS7xxSim &sim = dev.sim;
+    auto &uart = dev.uart;
+    sim.loopback(0, 1);
+    sim.loopback(1, 0);
+    uart.softwareReset();
+    uart.a().withBufferedRead(4096);
+    uart.b().withBufferedRead(4096);
+    EXPECT(uart.a().begin(115200));
+    EXPECT(uart.b().begin(115200));
+
+    std::vector<uint8_t> data(1000);
+    for(size_t ii = 0; ii < data.size(); ii++) {
+        data[ii] = (uint8_t)ii;
+    }
+    uart.a().write(data.data(), data.size());
+    uart.b().write(data.data(), data.size());
+
+    EXPECT_EQ(readSequence(uart.b(), data.size(), 1000), 0);
+    EXPECT_EQ(readSequence(uart.a(), data.size(), 1000), 0);
+    EXPECT_EQ(sim.getStats(0).rxOverruns, 0);
+    EXPECT_EQ(sim.getStats(1).rxOverruns, 0);
+}
+
+TEST(multidrop_match_mid_batch) {
+    // An address match in the middle of a FIFO read when the read buffer is nearly full
+    auto &dev = testDevice<SC16IS7x0>(SC16IS7xxSim::Model::SC16IS750, TEST_BUS_I2C_400K);
+    SC16IS7xxSim &sim = dev.sim;
+    auto &uart = dev.uart;
+    uart.softwareReset();
+    uart.withBufferedRead(32).withMultidrop(0x42);
+    EXPECT(uart.begin(115200));
+
+    std::vector<uint8_t> expected;
+    auto peerData = [&](uint8_t first, size_t count, bool forThisNode) {
+        std::vector<uint8_t> data(count);
+        for(size_t ii = 0; ii < count; ii++) {
+            data[ii] = (uint8_t)(first + ii);
+        }
+        sim.peerWrite(0, data.data(), data.size());
+        if (forThisNode) {
+            expected.insert(expected.end(), data.begin(), data.end());
+        }
+    };
+
+    // Leave 3 bytes free in the read buffer, which holds 31 bytes
+    sim.peerWriteAddress(0, 0x42);
+    peerData(0, 28, true);
+    EXPECT(hostTestWaitFor([&]() { return uart.available() == 28; }, 100));
+
+    // Hold the bus so the next FIFO read has a byte with a framing error, a frame for another node,
+    // and then the address of this node followed by more data than fits in the buffer
+    Wire.lock();
+    sim.peerWriteFramingError(0, 'z');
+    expected.push_back('z');
+    sim.peerWriteAddress(0, 0x17);
+    peerData(0xe0, 5, false);
+    sim.peerWriteAddress(0, 0x42);
+    peerData(100, 20, true);
+    bool arrived = hostTestWaitFor([&]() { return sim.peerWriteDone(0); }, 100);
+    Wire.unlock();
+    EXPECT(arrived);
+
+    // The buffer fills and the rest of the data stays in the FIFO until there is space
+    EXPECT(hostTestWaitFor([&]() { return uart.available() == 31; }, 100));
+    delay(5);
+    EXPECT_EQ(uart.available(), 31);
+
+    // The receiver is still enabled for data for this node
+    peerData(200, 10, true);
+
+    std::vector<uint8_t> received;
+    system_tick_t start = millis();
+    while(received.size() < expected.size() && millis() - start < 1000) {
+        uint8_t buf[16];
+        int n = uart.read(buf, sizeof(buf));
+        if (n <= 0) {
+            delay(1);
+            continue;
+        }
+        received.insert(received.end(), buf, buf + n);
+    }
+    EXPECT(received == expected);
+    EXPECT_EQ(sim.getStats(0).rxOverruns, 0);
+
+    // Each byte's line status is counted once, and address bytes are not parity errors
+    SC16IS7xxPortStats stats = uart.getStats();
+    EXPECT_EQ(stats.lsrFraming, 1);
+    EXPECT_EQ(stats.lsrParity, 0);
+    EXPECT(stats.rxBufferFull > 0);
+}
+
+TEST(modbus_irq_long_frames) {
+    // Frames longer than the RX FIFO trigger level must not be cut at the inter-frame gap while the
+    // rest of the frame is still in the FIFO waiting for the 4 character RX timeout
+    auto &dev = testDevice<SC16IS7x0>(SC16IS7xxSim::Model::SC16IS750, TEST_BUS_SPI_4M, true);
+    SC16IS7xxSim &sim = dev.sim;
+    auto &uart = dev.uart;
+    uart.softwareReset();
+
+    std::mutex framesMutex;
+    std::vector<std::vector<uint8_t>> frames;
+    uart.withBufferedRead(1024).withModbusRTU([&](const uint8_t *frame, size_t length) {
+        std::lock_guard<std::mutex> lock(framesMutex);
+        frames.emplace_back(frame, frame + length);
+    });
+    EXPECT(uart.begin(19200));
+
+    const size_t numFrames = 3;
+    std::vector<uint8_t> frame(98);
+    for(size_t ii = 0; ii < numFrames; ii++) {
+        for(size_t jj = 0; jj < frame.size(); jj++) {
+            frame[jj] = (uint8_t)(ii * 31 + jj);
+        }
+        uint16_t crc = SC16IS7xxPort::modbusCRC16(frame.data(), frame.size());
+        uint8_t crcBytes[2] = { (uint8_t)(crc & 0xff), (uint8_t)(crc >> 8) };
+        sim.peerWrite(0, frame.data(), frame.size());
+        sim.peerWrite(0, crcBytes, sizeof(crcBytes));
+        sim.peerWriteIdle(0, 8);
+    }
+
+    EXPECT(hostTestWaitFor([&]() {
+        std::lock_guard<std::mutex> lock(framesMutex);
+        return frames.size() >= numFrames;
+    }, 1000));
+    delay(10);
+
+    std::lock_guard<std::mutex> lock(framesMutex);
+    EXPECT_EQ(frames.size(), numFrames);
+    for(size_t ii = 0; ii < frames.size(); ii++) {
+        EXPECT_EQ(frames[ii].size(), frame.size());
+        EXPECT_EQ(frames[ii][0], (uint8_t)(ii * 31));
+    }
+    SC16IS7xxPortStats stats = uart.getStats();
+    EXPECT_EQ(stats.modbusFrames, numFrames);
+    EXPECT_EQ(stats.modbusCrcErrors, 0);
+    EXPECT_EQ(stats.modbusFrameErrors, 0);
+}
+
+TEST(modbus_write_waits_for_queued_data) {
+    // The inter-frame gap before the next frame is measured from when the frame is actually sent,
+    // after data that was already in the write buffer and TX FIFO
+    auto &dev = testDevice<SC16IS7x0>(SC16IS7xxSim::Model::SC16IS750, TEST_BUS_SPI_4M);
+    SC16IS7xxSim &sim = dev.sim;
+    auto &uart = dev.uart;
+    uart.softwareReset();
+    uart.withBufferedRead(1024).withBufferedWrite(1024).withModbusRTU(nullptr);
+    EXPECT(uart.begin(19200));
+
+    std::vector<uint8_t> data(200, 0x55);
+    EXPECT_EQ(uart.write(data.data(), data.size()), data.size());
+
+    std::vector<uint8_t> frame(98, 0xaa);
+    EXPECT(uart.writeModbusFrame(frame.data(), frame.size()));
+    EXPECT(uart.writeModbusFrame(frame.data(), frame.size()));
+
+    // The second frame was only queued after the first one was sent
+    EXPECT(sim.peerAvailable(0) >= data.size() + frame.size() + 2);
+}
+
+// Exposes the number of worker thread functions registered on the interface
+class ThreadCountUart : public SC16IS7x0 {
+public:
+    size_t threadFunctionCount() const { return threadFunctions.size(); };
+};
+
+TEST(begin_again_replaces_buffers) {
+    // Calling begin() again, for example to change the baud rate, replaces the buffers and does not
+    // register the worker thread functions again
+    auto &dev = testDevice<ThreadCountUart>(SC16IS7xxSim::Model::SC16IS750, TEST_BUS_SPI_4M, true);
+    SC16IS7xxSim &sim = dev.sim;
+    auto &uart = dev.uart;
+    uart.softwareReset();
+    uart.withBufferedRead(1024).withBufferedWrite(1024);
+    EXPECT(uart.begin(9600));
+    size_t threadFunctions = uart.threadFunctionCount();
+
+    std::vector<uint8_t> data(500);
+    for(size_t ii = 0; ii < data.size(); ii++) {
+        data[ii] = (uint8_t)ii;
+    }
+    for(int baud : { 57600, 115200 }) {
+        EXPECT(uart.begin(baud));
+        EXPECT_EQ(uart.threadFunctionCount(), threadFunctions);
+        EXPECT_EQ(uart.availableForWrite(), 1023);
+
+        EXPECT_EQ(uart.write(data.data(), data.size()), data.size());
+        std::vector<uint8_t> received;
+        EXPECT(hostTestWaitFor([&]() {
+            uint8_t buf[256];
+            size_t n = sim.peerRead(0, buf, sizeof(buf));
+            received.insert(received.end(), buf, buf + n);
+            return received.size() >= data.size();
+        }, 1000));
+        EXPECT(received == data);
+
+        // A multiple of 256 so the next sequence starts at 0 again
+        sim.peerWriteSequence(0, 512);
+        EXPECT_EQ(readSequence(uart, 512, 1000), 0);
+    }
+}
+
+TEST(rs485_efcr_and_echo_suppression) {
+    auto &dev = testDevice<SC16IS7x0>(SC16IS7xxSim::Model::SC16IS750, TEST_BUS_SPI_4M);
+    SC16IS7xxSim &sim = dev.sim;
+    auto &uart = dev.uart;
+    uart.softwareReset();
+    uart.withRS485();
+    EXPECT(uart.begin(115200));
+
+    // RTS controlled by the transmitter EFCR[4], high while transmitting EFCR[5]
+    EXPECT_EQ(sim.inspectRegister(0, SC16IS7xxInterface::EFCR_REG), 0x30);
+
+    // A transceiver with the receiver always enabled echoes what is sent
+    sim.loopback(0, 0);
+
+    uint8_t msg[16];
+    for(size_t ii = 0; ii < sizeof(msg); ii++) {
+        msg[ii] = (uint8_t)ii;
+    }
+    uint32_t start = micros();
+    EXPECT_EQ(uart.write(msg, sizeof(msg)), sizeof(msg));
+
+    // Receiver disabled EFCR[1] while transmitting
+    EXPECT_EQ(sim.inspectRegister(0, SC16IS7xxInterface::EFCR_REG), 0x32);
+
+    uart.flush();
+    uint32_t elapsed = micros() - start;
+
+    // flush() returns after the last stop bit (LSR[6]), not when the TX FIFO is empty, with the receiver enabled
+    EXPECT((sim.inspectRegister(0, SC16IS7xxInterface::LSR_REG) & 0x40) != 0);
+    EXPECT(elapsed >= (uint32_t)(sizeof(msg) * sim.getCharTimeUs(0)) - 10);
+    EXPECT_EQ(sim.inspectRegister(0, SC16IS7xxInterface::EFCR_REG), 0x30);
+
+    // Polled at half character intervals, so the turnaround is a fraction of a character plus a register write
+    EXPECT(uart.getTurnaroundUs() < 1000);
+
+    // The echo was not received, but the response is
+    sim.loopback(0, -1);
+    EXPECT_EQ(uart.available(), 0);
+    sim.peerWrite(0, (const uint8_t *)"ok", 2);
+    EXPECT(hostTestWaitFor([&]() { return uart.available() == 2; }, 100));
+    EXPECT_EQ(uart.read(), 'o');
+    EXPECT_EQ(uart.read(), 'k');
+}
+
+TEST(rs485_echo_rts_low_during_tx) {
+    auto &dev = testDevice<SC16IS7x0>(SC16IS7xxSim::Model::SC16IS750, TEST_BUS_SPI_4M);
+    SC16IS7xxSim &sim = dev.sim;
+    auto &uart = dev.uart;
+    uart.softwareReset();
+    uart.withRS485(false, false);
+    EXPECT(uart.begin(115200));
+
+    // EFCR[4] only, and the receiver is never disabled
+    EXPECT_EQ(sim.inspectRegister(0, SC16IS7xxInterface::EFCR_REG), 0x10);
+
+    sim.loopback(0, 0);
+    EXPECT_EQ(uart.write((const uint8_t *)"abcd", 4), 4);
+    EXPECT_EQ(sim.inspectRegister(0, SC16IS7xxInterface::EFCR_REG), 0x10);
+    uart.flush();
+    sim.loopback(0, -1);
+
+    EXPECT(hostTestWaitFor([&]() { return uart.available() == 4; }, 100));
+    EXPECT_EQ(uart.read(), 'a');
+}
+
+TEST(xon_xoff_registers_and_handler) {
+    auto &dev = testDevice<SC16IS7x0>(SC16IS7xxSim::Model::SC16IS750, TEST_BUS_SPI_4M, true);
+    SC16IS7xxSim &sim = dev.sim;
+    auto &uart = dev.uart;
+    uart.softwareReset();
+
+    std::atomic<int> xoffCount(0);
+    uart.withXonXoffCharacters(0x11, 0x13, 0x12, 0x14).withXoffHandler([&]() { xoffCount++; });
+    EXPECT(uart.begin(115200, SC16IS7xxPort::OPTIONS_8N1 | SC16IS7xxPort::OPTIONS_FLOW_CONTROL_XON_XOFF));
+
+    EXPECT_EQ(sim.inspectEnhancedRegister(0, SC16IS7xxInterface::XON1_REG), 0x11);
+    EXPECT_EQ(sim.inspectEnhancedRegister(0, SC16IS7xxInterface::XON2_REG), 0x12);
+    EXPECT_EQ(sim.inspectEnhancedRegister(0, SC16IS7xxInterface::XOFF1_REG), 0x13);
+    EXPECT_EQ(sim.inspectEnhancedRegister(0, SC16IS7xxInterface::XOFF2_REG), 0x14);
+    // Enhanced functions EFR[4], send Xon1/Xoff1 EFR[3], compare Xon1/Xoff1 EFR[1], no special character EFR[5]
+    EXPECT_EQ(sim.inspectEnhancedRegister(0, SC16IS7xxInterface::EFR_REG), 0x1a);
+    // Xoff interrupt IER[5], and TCR enabled MCR[2] for the halt and resume levels
+    EXPECT((sim.inspectRegister(0, SC16IS7xxInterface::IER_REG) & 0x20) != 0);
+    EXPECT((sim.inspectRegister(0, SC16IS7xxInterface::MCR_REG) & 0x04) != 0);
+
+    // Xoff1 from the other side pauses the transmitter and calls the handler from the worker thread
+    const uint8_t xoff = 0x13;
+    sim.peerWrite(0, &xoff, 1);
+    EXPECT(hostTestWaitFor([&]() { return xoffCount == 1; }, 100));
+    EXPECT_EQ(uart.getStats().xoffReceived, 1);
+
+    EXPECT_EQ(uart.write((const uint8_t *)"abcdefgh", 8), 8);
+    delay(5);
+    EXPECT_EQ(sim.peerAvailable(0), 0);
+
+    // Xon1 resumes. Neither character is stored in the RX FIFO.
+    const uint8_t xon = 0x11;
+    sim.peerWrite(0, &xon, 1);
+    EXPECT(hostTestWaitFor([&]() { return sim.peerAvailable(0) == 8; }, 100));
+    EXPECT_EQ(uart.available(), 0);
+    EXPECT_EQ(xoffCount, 1);
+}
+
+TEST(frame_delimiter_irq) {
+    auto &dev = testDevice<SC16IS7x0>(SC16IS7xxSim::Model::SC16IS750, TEST_BUS_SPI_4M, true);
+    SC16IS7xxSim &sim = dev.sim;
+    auto &uart = dev.uart;
+    uart.softwareReset();
+
+    // Records the state at the first call to the handler
+    std::atomic<int> frameCount(0);
+    std::atomic<int> firstAvailable(0);
+    std::atomic<bool> firstPeerDone(false);
+    uart.withBufferedRead(1024).withFrameDelimiter('\n', [&]() {
+        if (frameCount++ == 0) {
+            firstAvailable = uart.available();
+            firstPeerDone = sim.peerWriteDone(0);
+        }
+    });
+    EXPECT(uart.begin(9600));
+
+    // Special character detect EFR[5] with the delimiter in XOFF2, and its interrupt IER[5]
+    EXPECT_EQ(sim.inspectEnhancedRegister(0, SC16IS7xxInterface::XOFF2_REG), '\n');
+    EXPECT((sim.inspectEnhancedRegister(0, SC16IS7xxInterface::EFR_REG) & 0x30) == 0x30);
+    EXPECT((sim.inspectRegister(0, SC16IS7xxInterface::IER_REG) & 0x20) != 0);
+
+    // The line is read as soon as the delimiter arrives, while the rest is still being received,
+    // instead of at the RX trigger level
+    const char *msg = "line\n0123456789012345678901234567890";
+    sim.peerWrite(0, (const uint8_t *)msg, strlen(msg));
+    EXPECT(hostTestWaitFor([&]() { return frameCount > 0; }, 100));
+    EXPECT(!firstPeerDone);
+    EXPECT(firstAvailable >= 5 && firstAvailable <= 6);
+
+    EXPECT(hostTestWaitFor([&]() { return uart.available() == (int)strlen(msg); }, 200));
+    char buf[64] = {0};
+    EXPECT_EQ(uart.read((uint8_t *)buf, strlen(msg)), strlen(msg));
+    EXPECT(strcmp(buf, msg) == 0);
+    EXPECT_EQ(frameCount, 1);
+}
+
+TEST(frame_delimiter_polled) {
+    auto &dev = testDevice<SC16IS7x0>(SC16IS7xxSim::Model::SC16IS750, TEST_BUS_SPI_4M);
+    SC16IS7xxSim &sim = dev.sim;
+    auto &uart = dev.uart;
+    uart.softwareReset();
+
+    std::atomic<int> frameCount(0);
+    uart.withBufferedRead(1024).withFrameDelimiter('\n', [&]() { frameCount++; });
+    EXPECT(uart.begin(115200));
+
+    // Without IRQ special character detect is not used, the handler is called after the next poll
+    EXPECT_EQ(sim.inspectEnhancedRegister(0, SC16IS7xxInterface::EFR_REG) & 0x20, 0);
+
+    sim.peerWrite(0, (const uint8_t *)"abc", 3);
+    EXPECT(hostTestWaitFor([&]() { return uart.available() == 3; }, 100));
+    EXPECT_EQ(frameCount, 0);
+
+    sim.peerWrite(0, (const uint8_t *)"def\n", 4);
+    EXPECT(hostTestWaitFor([&]() { return frameCount == 1; }, 100));
+    EXPECT_EQ(uart.available(), 7);
+}
@@ -0,0 +1,138 @@
+#include "HostTest.h"
+#include "TestSetup.h"
+
+#include <vector>
+
+TEST(bus_timing_i2c) {
+    // A register read is the write of the subaddress and a 1-byte read: 2 transactions,
+    // 4 bytes including the two address bytes, and about 40 bit times at 100 kHz
+    auto &dev = testDevice<SC16IS7x0>(SC16IS7xxSim::Model::SC16IS750, TEST_BUS_I2C_400K);
+    auto &uart = dev.uart;
+    Wire.setSpeed(CLOCK_SPEED_100KHZ);
+
+    Wire.stats = MockBusStats();
+    uint32_t start = micros();
+    uart.readRegister(0, SC16IS7xxInterface::SPR_REG);
+    uint32_t elapsed = micros() - start;
+
+    EXPECT_EQ(Wire.stats.transactions, 2);
+    EXPECT_EQ(Wire.stats.bytes, 4);
+    EXPECT(Wire.stats.busyUs > 350 && Wire.stats.busyUs < 450);
+    EXPECT(elapsed >= 350);
+}
+
+TEST(bus_timing_spi) {
+    // A register read is 2 bytes: 4 microseconds at 4 MHz
+    auto &dev = testDevice<SC16IS7x0>(SC16IS7xxSim::Model::SC16IS750, TEST_BUS_SPI_4M);
+    auto &uart = dev.uart;
+
+    SPI.stats = MockBusStats();
+    uart.readRegister(0, SC16IS7xxInterface::SPR_REG);
+
+    EXPECT_EQ(SPI.stats.transactions, 1);
+    EXPECT_EQ(SPI.stats.bytes, 2);
+    EXPECT(SPI.stats.busyUs > 3.9 && SPI.stats.busyUs < 4.1);
+}
+
+TEST(port_stats_and_histograms) {
+    auto &dev = testDevice<SC16IS7x0>(SC16IS7xxSim::Model::SC16IS750, TEST_BUS_SPI_4M);
+    SC16IS7xxSim &sim = dev.sim;
+    auto &uart = dev.uart;
+    uart.withHistograms();
+    uart.softwareReset();
+    uart.withBufferedRead(4096);
+    EXPECT(uart.begin(115200));
+
+    uart.getBusUtilization(true);
+    sim.peerWriteSequence(0, 1000);
+    EXPECT(hostTestWaitFor([&]() { return uart.available() == 1000; }, 1000));
+
+    SC16IS7xxPortStats stats = uart.getStats();
+    EXPECT_EQ(stats.rxBytes, 1000);
+    EXPECT(stats.rxBusOps > 0);
+    EXPECT(stats.rxFifoHighWater > 0 && stats.rxFifoHighWater <= SC16IS7xxSim::FIFO_SIZE);
+    EXPECT(stats.rxBufferHighWater >= 1000);
+    EXPECT(stats.serviceCount > 0);
+    EXPECT_EQ(stats.lsrOverrun, 0);
+
+    SC16IS7xxPortHistograms histograms = uart.getHistograms();
+    EXPECT(histograms.serviceIntervalUs.count > 0);
+    EXPECT(uart.getBusOpHistogram().count > 0);
+
+    float utilization = uart.getBusUtilization();
+    EXPECT(utilization > 0 && utilization < 100);
+
+    // Reset clears the counters
+    uart.getStats(true);
+    EXPECT_EQ(uart.getStats().rxBytes, 0);
+}
+
+TEST(bus_utilization_excludes_shadow_cache) {
+    // Register reads answered from the shadow register cache do not use the bus
+    auto &dev = testDevice<SC16IS7x0>(SC16IS7xxSim::Model::SC16IS750, TEST_BUS_I2C_400K);
+    auto &uart = dev.uart;
+    uart.withHistograms();
+    uart.withShadowRegisters();
+    uart.softwareReset();
+    EXPECT(uart.begin(115200));
+
+    uart.getBusUtilization(true);
+    Wire.stats = MockBusStats();
+    for(size_t ii = 0; ii < 1000; ii++) {
+        uart.readRegister(0, SC16IS7xxInterface::LCR_REG);
+        SC16IS7xxBatch batch;
+        uint8_t lcr, ier;
+        batch.addReadRegister(0, SC16IS7xxInterface::LCR_REG, &lcr);
+        batch.addReadRegister(0, SC16IS7xxInterface::IER_REG, &ier);
+        uart.execute(batch);
+    }
+    EXPECT_EQ(Wire.stats.transactions, 0);
+    EXPECT(uart.getBusUtilization(true) == 0);
+
+    // Uncached reads are counted
+    for(size_t ii = 0; ii < 100; ii++) {
+        uart.readRegister(0, SC16IS7xxInterface::RXLVL_REG);
+    }
+    EXPECT(uart.getBusUtilization() > 0);
+}
+
+TEST(irq_stats_multiple_causes) {
+    // RHR and THR interrupts pending at the same time are both handled in one wakeup
+    auto &dev = testDevice<SC16IS7x0>(SC16IS7xxSim::Model::SC16IS750, TEST_BUS_I2C_400K, true);
+    SC16IS7xxSim &sim = dev.sim;
+    auto &uart = dev.uart;
+    uart.softwareReset();
+    uart.withBufferedRead(1024).withBufferedWrite(1024);
+    EXPECT(uart.begin(115200));
+
+    std::vector<uint8_t> data(500, 0x55);
+    EXPECT_EQ(uart.write(data.data(), data.size()), data.size());
+    EXPECT(hostTestWaitFor([&]() { return sim.peerAvailable(0) > 0; }, 100));
+
+    // Hold the bus while the TX FIFO drains below the THR level and the RX FIFO fills above the RHR
+    // trigger level, about 5.6 ms for 64 characters at 115200 baud
+    Wire.lock();
+    sim.peerWriteSequence(0, 40);
+    delay(10);
+    Wire.unlock();
+
+    EXPECT(hostTestWaitFor([&]() { return uart.available() == 40; }, 1000));
+    EXPECT(hostTestWaitFor([&]() { return sim.peerAvailable(0) >= data.size(); }, 1000));
+
+    SC16IS7xxIrqStats irqStats = uart.getIrqStats();
+    EXPECT(irqStats.maxCausesPerWakeup >= 2);
+    EXPECT_EQ(irqStats.limitReached, 0);
+
+    uint32_t wakeups = 0, causes = 0;
+    for(size_t ii = 0; ii < SC16IS7xxIrqStats::MAX_CAUSES_PER_WAKEUP; ii++) {
+        wakeups += irqStats.causesPerWakeup[ii];
+        causes += irqStats.causesPerWakeup[ii] * (uint32_t)(ii + 1);
+    }
+    EXPECT(irqStats.causesPerWakeup[1] > 0);
+    EXPECT_EQ(wakeups, irqStats.wakeups);
+    EXPECT_EQ(causes, irqStats.causes);
+
+    // Reset clears the counters
+    uart.getIrqStats(true);
+    EXPECT_EQ(uart.getIrqStats().wakeups, 0);
+}